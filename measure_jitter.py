@@ -9,7 +9,17 @@ HOST = '127.0.0.1'
 PORT = 1588
 COUNT = 10000 
 
+# Extended time request (taas_proto.h): the reply carries the server's
+# receive and transmit times, so its residence can be taken out of the RTT
+TAAS_MAGIC = 0x53414154
+TAAS_VERSION = 1
+TAAS_MSG_EXT_TIME_REQ = 10
+TAAS_MSG_EXT_TIME_REPLY = 11
+HDR = struct.Struct('<IBBHI')
+EXT_REPLY = struct.Struct('<IBBHIQQ')
+
 latencies = array.array('d', [0.0] * COUNT)
+residences = array.array('d', [0.0] * COUNT)
 hw_timestamps = array.array('Q', [0] * COUNT)
 
 sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
@@ -20,6 +30,10 @@ get_time = time.perf_counter
 send = sock.send
 recv = sock.recv
 unpack = struct.unpack
+unpack_ext = EXT_REPLY.unpack
+requests = [HDR.pack(TAAS_MAGIC, TAAS_VERSION, TAAS_MSG_EXT_TIME_REQ, 0, i)
+            for i in range(COUNT)]
+extended = True
 
 print(f"[*] Initialize...")
 
@@ -30,14 +44,21 @@ try:
     for i in range(COUNT):
         t0 = get_time()
         
-        send(b'T')
-        data = recv(8)
+        send(requests[i])
+        data = recv(64)
         
         t1 = get_time()
         
         latencies[i] = (t1 - t0) * 1_000_000
 
-        hw_timestamps[i] = unpack('<Q', data)[0]
+        if len(data) == EXT_REPLY.size:
+            rx_ns, tx_ns = unpack_ext(data)[5:]
+            residences[i] = (tx_ns - rx_ns) / 1000
+            hw_timestamps[i] = rx_ns
+        else:
+            # Node without extended replies: a raw reply, RTT only
+            extended = False
+            hw_timestamps[i] = unpack('<Q', data[:8])[0]
 
 finally:
     gc.enable()
@@ -58,5 +79,11 @@ print(f"Latencia Máxima : {max_lat:.2f} us")
 print(f"Desviación Est.: {stdev:.2f} us")
 print("-" * 40)
 print(f"JITTER REAL: {jitter_pico:.2f} us")
+if extended:
+    network = array.array('d', (l - r for l, r in zip(latencies, residences)))
+    print("-" * 40)
+    print(f"Residencia Servidor (prom/máx): {statistics.mean(residences):.2f} / {max(residences):.2f} us")
+    print(f"Red (RTT - residencia) mín/prom/máx: {min(network):.2f} / {statistics.mean(network):.2f} / {max(network):.2f} us")
+    print(f"JITTER DE RED: {max(network) - min(network):.2f} us")
 print("="*40)
 print(f"Último HW TS: {hw_timestamps[-1]}")
@@ -13,6 +13,29 @@ echo "[*] Building kernel module and node..."
 make clean > /dev/null
 make
 
+# Same driver and a node running: upgrade in place. The node starts the
+# freshly built binary with --takeover, hands it the sockets and the
+# clock, and exits; the port never closes.
+INSTALLED_KO="/lib/modules/$(uname -r)/extra/taas_driver.ko"
+if systemctl is-active --quiet taas && lsmod | grep -q "taas_driver" && \
+   cmp -s taas_driver.ko "$INSTALLED_KO"; then
+    echo "[*] Driver unchanged, handing over to the new node..."
+    cp taas.service taas_exporter.service /etc/systemd/system/
+    systemctl daemon-reload
+    OLD_PID=$(systemctl show -p MainPID --value taas)
+    systemctl kill -s SIGUSR2 --kill-who=main taas
+    for i in $(seq 1 50); do
+        NEW_PID=$(systemctl show -p MainPID --value taas)
+        if [ "$NEW_PID" != "$OLD_PID" ] && [ "$NEW_PID" != "0" ]; then
+            echo "[OK] TaaS handed over from pid $OLD_PID to $NEW_PID."
+            systemctl status taas --no-pager | grep "Active:"
+            exit 0
+        fi
+        sleep 0.2
+    done
+    echo "[!] Handover did not complete, falling back to a restart."
+fi
+
 if lsmod | grep -q "taas_driver"; then
     echo "[*] Stopping service and removing existing module..."
     systemctl stop taas 2>/dev/null || true
@@ -31,10 +54,17 @@ if [ ! -c /dev/taas_timer ]; then
     exit 1
 fi
 
+echo "[*] Certifying core 3 (taas_node --selftest)..."
+if ! ./taas_node --selftest; then
+    echo "[!] Self-test failed: core 3 is not fit to serve, service not started."
+    exit 1
+fi
+
 echo "[*] Deploying systemd service..."
-cp taas.service /etc/systemd/system/
+cp taas.service taas_exporter.service /etc/systemd/system/
 systemctl daemon-reload
 systemctl enable --now taas
+systemctl enable --now taas_exporter
 
 echo "[OK] TaaS is active and running."
 systemctl status taas --no-pager | grep "Active:"
@@ -0,0 +1,599 @@
+/*
+ * TaaS Bench - open-loop load generator and latency benchmark
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Offers requests on a fixed schedule, independent of how fast the node
+ * answers, from many connected UDP sockets (one source port each) with
+ * sendmmsg(). Latency is measured from the time each request was
+ * *scheduled* to go out, not the time it actually left: if the node (or
+ * the generator) stalls, every request that should have been sent
+ * during the stall is charged the wait. This is the coordinated-omission
+ * correction; the uncorrected figure (from the actual send) is printed
+ * next to it for comparison.
+ *
+ * Replies are matched exactly: TSA requests carry their sequence number
+ * in the hash the certificate echoes, raw replies are matched in order
+ * per socket (the node answers raw requests inline, so per source port
+ * they never overtake each other).
+ *
+ * Usage: taas_bench [options] [HOST]   (see --help)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sched.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "taas_proto.h"
+
+#define BENCH_RATE_DEFAULT      10000
+#define BENCH_DURATION_DEFAULT  10
+#define BENCH_SOCKETS_DEFAULT   16
+#define BENCH_SOCKETS_MAX       256
+#define BENCH_TIMEOUT_MS        1000
+#define BENCH_SOCKBUF           (4 << 20)
+
+#define SEND_BATCH_MAX  64          /* messages per sendmmsg() */
+#define RECV_BATCH      64          /* messages per recvmmsg() */
+#define RECV_BUF        128         /* enough to read a certificate's hash */
+
+/* In-flight requests, indexed by sequence number */
+#define PENDING_BITS    18
+#define PENDING_MAX     (1U << PENDING_BITS)
+#define SOCK_FIFO       1024        /* raw requests in flight per socket */
+
+/*
+ * Log-linear histogram, as in HdrHistogram: values below 2^HIST_SUB_BITS
+ * are exact, above that each power of two is split into
+ * 2^(HIST_SUB_BITS - 1) buckets (better than 0.8% resolution).
+ */
+#define HIST_SUB_BITS   8
+#define HIST_HALF       (1U << (HIST_SUB_BITS - 1))
+#define HIST_BUCKETS    ((64 - HIST_SUB_BITS + 1) * HIST_HALF + HIST_HALF)
+
+#define NSEC_PER_SEC    1000000000ULL
+
+enum bench_mode { BENCH_RAW, BENCH_TSA };
+
+struct pending {
+    uint64_t seq;
+    uint64_t intended_ns;
+    uint64_t sent_ns;               /* 0 once answered or expired */
+};
+
+struct bench_sock {
+    int fd;
+    uint64_t head, tail;            /* raw: sequence numbers in send order */
+    uint64_t fifo[SOCK_FIFO];
+};
+
+struct hist {
+    uint64_t count, min, max;
+    double sum, sum_sq;
+    uint64_t b[HIST_BUCKETS];
+};
+
+static enum bench_mode mode = BENCH_RAW;
+static uint64_t rate = BENCH_RATE_DEFAULT;
+static unsigned int burst = 1;
+static unsigned int duration_s = BENCH_DURATION_DEFAULT;
+static unsigned int nsock = BENCH_SOCKETS_DEFAULT;
+static unsigned int timeout_ms = BENCH_TIMEOUT_MS;
+static int cpu = -1;
+static const char *host = "127.0.0.1";
+static const char *port = "1588";
+static const char *hdr_file = NULL;
+
+static struct bench_sock *socks;
+static struct pending pend[PENDING_MAX];
+static struct hist corrected, uncorrected;
+
+static uint64_t next_seq, expire_seq;
+static uint64_t sent, received, lost, late, send_errors;
+static uint64_t max_lag_ns;
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+static inline unsigned int hist_index(uint64_t v)
+{
+    unsigned int e;
+
+    if (v < 2 * HIST_HALF)
+        return (unsigned int)v;
+
+    e = 63 - (unsigned int)__builtin_clzll(v) - (HIST_SUB_BITS - 1);
+    return e * HIST_HALF + (unsigned int)(v >> e);
+}
+
+/* Highest value that lands in bucket i, as HdrHistogram reports it */
+static inline uint64_t hist_value(unsigned int i)
+{
+    unsigned int e;
+
+    if (i < 2 * HIST_HALF)
+        return i;
+
+    e = i / HIST_HALF - 1;
+    return (((uint64_t)(i - e * HIST_HALF)) << e) + ((1ULL << e) - 1);
+}
+
+static inline void hist_record(struct hist *h, uint64_t v)
+{
+    if (!h->count || v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+    h->count++;
+    h->sum += (double)v;
+    h->sum_sq += (double)v * (double)v;
+    h->b[hist_index(v)]++;
+}
+
+/* Value at percentile p (0-100), in ns */
+static uint64_t hist_percentile(const struct hist *h, double p)
+{
+    uint64_t want = (uint64_t)ceil(p / 100.0 * (double)h->count), seen = 0;
+
+    if (!want)
+        want = 1;
+    for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->b[i];
+        if (seen >= want)
+            return hist_value(i) < h->max ? hist_value(i) : h->max;
+    }
+    return h->max;
+}
+
+/*
+ * hist_dump - Percentile distribution in HdrHistogram's text format
+ * (values in microseconds), readable by its plotting tools.
+ */
+static void hist_dump(FILE *out, const struct hist *h)
+{
+    double mean = h->count ? h->sum / (double)h->count : 0.0;
+    double var = h->count ? h->sum_sq / (double)h->count - mean * mean : 0.0;
+    uint64_t seen = 0;
+    double p = 0.0;
+    unsigned int i = 0;
+
+    fprintf(out, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+
+    /* Report more often towards the tail: 5 steps per halving of the
+     * remaining distance to 100%.
+     */
+    while (h->count && i < HIST_BUCKETS) {
+        uint64_t want = (uint64_t)ceil(p / 100.0 * (double)h->count);
+
+        while (i < HIST_BUCKETS && (seen < want || !seen))
+            seen += h->b[i++];
+
+        if (seen >= h->count) {
+            fprintf(out, "%12.3f %14.12f %10llu\n", (double)h->max / 1e3, 1.0,
+                    (unsigned long long)seen);
+            break;
+        }
+        fprintf(out, "%12.3f %14.12f %10llu %14.2f\n",
+                (double)hist_value(i - 1) / 1e3, (double)seen / (double)h->count,
+                (unsigned long long)seen, 1.0 / (1.0 - (double)seen / (double)h->count));
+
+        p = 100.0 * (double)seen / (double)h->count;
+        p += 100.0 / (5.0 * exp2(floor(log2(100.0 / (100.0 - p))) + 1.0));
+    }
+
+    fprintf(out, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", mean / 1e3, sqrt(var > 0 ? var : 0) / 1e3);
+    fprintf(out, "#[Max     = %12.3f, Total count    = %12llu]\n", (double)h->max / 1e3,
+            (unsigned long long)h->count);
+    fprintf(out, "#[Buckets = %12u, SubBuckets     = %12u]\n", HIST_BUCKETS, 2 * HIST_HALF);
+}
+
+static void print_latency(const char *label, const struct hist *h)
+{
+    static const double pct[] = { 50, 90, 99, 99.9, 99.99 };
+
+    printf("%-12s %9.1f", label, h->count ? (double)h->min / 1e3 : 0.0);
+    for (size_t i = 0; i < sizeof(pct) / sizeof(pct[0]); i++)
+        printf(" %9.1f", h->count ? (double)hist_percentile(h, pct[i]) / 1e3 : 0.0);
+    printf(" %9.1f\n", (double)h->max / 1e3);
+}
+
+static void answer(uint64_t seq, uint64_t now)
+{
+    struct pending *p = &pend[seq & (PENDING_MAX - 1)];
+
+    if (p->seq != seq || !p->sent_ns) {
+        late++;                     /* already expired, or a duplicate */
+        return;
+    }
+
+    hist_record(&corrected, now - p->intended_ns);
+    hist_record(&uncorrected, now - p->sent_ns);
+    p->sent_ns = 0;
+    received++;
+}
+
+/*
+ * expire - Give up on requests older than the timeout. Sequence numbers
+ * are scheduled in order, so the oldest one still outstanding bounds
+ * the scan.
+ */
+static void expire(uint64_t now)
+{
+    uint64_t limit = (uint64_t)timeout_ms * 1000000ULL;
+
+    while (expire_seq < next_seq) {
+        struct pending *p = &pend[expire_seq & (PENDING_MAX - 1)];
+
+        if (p->seq == expire_seq && p->sent_ns) {
+            if (now - p->intended_ns < limit)
+                break;
+            p->sent_ns = 0;
+            lost++;
+        }
+        expire_seq++;
+    }
+}
+
+/*
+ * send_requests - Send n requests scheduled at intended on one socket.
+ */
+static void send_requests(struct bench_sock *s, unsigned int n, uint64_t intended)
+{
+    static uint8_t buf[SEND_BATCH_MAX][32];
+    static struct iovec iov[SEND_BATCH_MAX];
+    static struct mmsghdr msgs[SEND_BATCH_MAX];
+    size_t len = mode == BENCH_TSA ? 32 : sizeof(uint64_t);
+    uint64_t t;
+    int ret;
+
+    for (unsigned int i = 0; i < n; i++) {
+        uint64_t seq = next_seq + i;
+
+        /* TSA: the sequence number is the start of the "document hash"
+         * (echoed in client_hash). Raw: any 8 bytes do.
+         */
+        memcpy(buf[i], &seq, sizeof(seq));
+        iov[i].iov_base = buf[i];
+        iov[i].iov_len = len;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    t = now_ns();
+    ret = sendmmsg(s->fd, msgs, n, 0);
+    if (ret < 0)
+        ret = 0;
+    send_errors += n - (unsigned int)ret;
+    if (t - intended > max_lag_ns)
+        max_lag_ns = t - intended;
+
+    for (int i = 0; i < ret; i++) {
+        uint64_t seq = next_seq + (uint64_t)i;
+        struct pending *p = &pend[seq & (PENDING_MAX - 1)];
+
+        /* Slot still busy: that request has been in flight for
+         * PENDING_MAX newer ones, call it lost.
+         */
+        if (p->sent_ns)
+            lost++;
+        p->seq = seq;
+        p->intended_ns = intended;
+        p->sent_ns = t;
+
+        if (mode == BENCH_RAW) {
+            if (s->tail - s->head == SOCK_FIFO)
+                s->head++;          /* left to expire() */
+            s->fifo[s->tail++ & (SOCK_FIFO - 1)] = seq;
+        }
+    }
+    /* Unsent requests keep their numbers so expire() skips them */
+    next_seq += n;
+    sent += (uint64_t)ret;
+}
+
+/*
+ * send_burst - Spread one burst round-robin over the sockets, one
+ * sendmmsg() per socket.
+ */
+static void send_burst(unsigned int n, uint64_t intended)
+{
+    static unsigned int cursor;
+    unsigned int per = (n + nsock - 1) / nsock;
+
+    if (per > SEND_BATCH_MAX)
+        per = SEND_BATCH_MAX;
+
+    while (n) {
+        unsigned int k = n < per ? n : per;
+
+        send_requests(&socks[cursor], k, intended);
+        cursor = (cursor + 1) % nsock;
+        n -= k;
+    }
+}
+
+static void drain(struct bench_sock *s)
+{
+    static uint8_t buf[RECV_BATCH][RECV_BUF];
+    static struct iovec iov[RECV_BATCH];
+    static struct mmsghdr msgs[RECV_BATCH];
+    int n;
+
+    for (int i = 0; i < RECV_BATCH; i++) {
+        iov[i].iov_base = buf[i];
+        iov[i].iov_len = RECV_BUF;
+        memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while ((n = recvmmsg(s->fd, msgs, RECV_BATCH, MSG_DONTWAIT, NULL)) > 0) {
+        uint64_t t = now_ns();
+
+        for (int i = 0; i < n; i++) {
+            uint64_t seq;
+
+            if (mode == BENCH_TSA) {
+                if (msgs[i].msg_len < offsetof(struct taas_certificate, signature)) {
+                    late++;
+                    continue;
+                }
+                memcpy(&seq, buf[i], sizeof(seq));
+                answer(seq, t);
+                continue;
+            }
+
+            /* Raw: the oldest request on this socket still waiting */
+            seq = UINT64_MAX;
+            while (s->head != s->tail) {
+                uint64_t q = s->fifo[s->head++ & (SOCK_FIFO - 1)];
+                const struct pending *p = &pend[q & (PENDING_MAX - 1)];
+
+                if (p->seq == q && p->sent_ns) {
+                    seq = q;
+                    break;
+                }
+            }
+            if (seq == UINT64_MAX)
+                late++;
+            else
+                answer(seq, t);
+        }
+        if (n < RECV_BATCH)
+            break;
+    }
+}
+
+static int open_sockets(int epfd)
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_DGRAM };
+    struct addrinfo *ai;
+    int err, sz = BENCH_SOCKBUF;
+
+    err = getaddrinfo(host, port, &hints, &ai);
+    if (err) {
+        fprintf(stderr, "taas_bench: %s: %s\n", host, gai_strerror(err));
+        return -1;
+    }
+
+    socks = calloc(nsock, sizeof(*socks));
+    if (!socks) {
+        freeaddrinfo(ai);
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < nsock; i++) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &socks[i] };
+        int fd = socket(ai->ai_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+
+        /* connect() gives every socket its own source port */
+        if (fd < 0 || connect(fd, ai->ai_addr, ai->ai_addrlen) < 0 ||
+            epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("taas_bench: socket");
+            freeaddrinfo(ai);
+            return -1;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+        socks[i].fd = fd;
+    }
+
+    freeaddrinfo(ai);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [HOST]   (default 127.0.0.1)\n"
+            "  -m, --mode=raw|tsa  raw timestamps or 32-byte TSA requests (default raw)\n"
+            "  -r, --rate=N        requests offered per second (default %d)\n"
+            "  -B, --burst=N       send in bursts of N, every N/rate seconds (default 1)\n"
+            "  -d, --duration=S    seconds of load (default %d)\n"
+            "  -c, --sockets=N     concurrent source ports (1-%d, default %d)\n"
+            "  -t, --timeout=MS    count a request lost after MS (default %d)\n"
+            "  -p, --port=PORT     node port (default %d)\n"
+            "  -C, --cpu=N         pin the generator to CPU N\n"
+            "  -o, --output=FILE   write the corrected percentile distribution\n"
+            "                      in HdrHistogram format\n"
+            "  -h, --help          show this help\n",
+            prog, BENCH_RATE_DEFAULT, BENCH_DURATION_DEFAULT,
+            BENCH_SOCKETS_MAX, BENCH_SOCKETS_DEFAULT, BENCH_TIMEOUT_MS, TAAS_PORT);
+}
+
+static int parse_args(int argc, char **argv)
+{
+    static const struct option opts[] = {
+        { "mode",     required_argument, NULL, 'm' },
+        { "rate",     required_argument, NULL, 'r' },
+        { "burst",    required_argument, NULL, 'B' },
+        { "duration", required_argument, NULL, 'd' },
+        { "sockets",  required_argument, NULL, 'c' },
+        { "timeout",  required_argument, NULL, 't' },
+        { "port",     required_argument, NULL, 'p' },
+        { "cpu",      required_argument, NULL, 'C' },
+        { "output",   required_argument, NULL, 'o' },
+        { "help",     no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int c;
+
+    while ((c = getopt_long(argc, argv, "m:r:B:d:c:t:p:C:o:h", opts, NULL)) != -1) {
+        switch (c) {
+        case 'm':
+            if (!strcmp(optarg, "raw")) {
+                mode = BENCH_RAW;
+            } else if (!strcmp(optarg, "tsa")) {
+                mode = BENCH_TSA;
+            } else {
+                fprintf(stderr, "taas_bench: --mode must be raw or tsa\n");
+                return -1;
+            }
+            break;
+        case 'r':
+            rate = strtoull(optarg, NULL, 10);
+            break;
+        case 'B':
+            burst = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            duration_s = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            nsock = (unsigned int)strtoul(optarg, NULL, 10);
+            if (nsock < 1 || nsock > BENCH_SOCKETS_MAX) {
+                fprintf(stderr, "taas_bench: --sockets must be 1-%d\n", BENCH_SOCKETS_MAX);
+                return -1;
+            }
+            break;
+        case 't':
+            timeout_ms = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            port = optarg;
+            break;
+        case 'C':
+            cpu = atoi(optarg);
+            break;
+        case 'o':
+            hdr_file = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (!rate || !burst || !duration_s) {
+        fprintf(stderr, "taas_bench: --rate, --burst and --duration must be positive\n");
+        return -1;
+    }
+    if (optind < argc)
+        host = argv[optind];
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct epoll_event ev[BENCH_SOCKETS_MAX];
+    uint64_t total, bursts, k = 0, start, send_end = 0, elapsed;
+    int epfd;
+
+    if (parse_args(argc, argv) < 0)
+        return EXIT_FAILURE;
+
+    if (cpu >= 0) {
+        cpu_set_t cpuset;
+
+        CPU_ZERO(&cpuset);
+        CPU_SET(cpu, &cpuset);
+        if (sched_setaffinity(0, sizeof(cpuset), &cpuset) < 0)
+            perror("taas_bench: warning: sched_setaffinity");
+    }
+
+    epfd = epoll_create1(0);
+    if (epfd < 0 || open_sockets(epfd) < 0)
+        return EXIT_FAILURE;
+
+    total = rate * duration_s;
+    bursts = (total + burst - 1) / burst;
+
+    printf("[TaaS] Bench: %s, %llu req/s for %u s, burst %u, %u sockets -> %s:%s\n",
+           mode == BENCH_TSA ? "tsa" : "raw", (unsigned long long)rate, duration_s,
+           burst, nsock, host, port);
+
+    /* One busy-polling thread: pacing to the schedule needs a spinning
+     * core, and sockets are drained between sends.
+     */
+    start = now_ns();
+    for (;;) {
+        uint64_t now = now_ns();
+        int n;
+
+        while (k < bursts) {
+            uint64_t intended = start + k * burst * NSEC_PER_SEC / rate;
+            uint64_t left = total - k * burst;
+
+            if (intended > now)
+                break;
+            send_burst(left < burst ? (unsigned int)left : burst, intended);
+            if (++k == bursts)
+                send_end = now_ns();
+        }
+
+        n = epoll_wait(epfd, ev, (int)nsock, 0);
+        now = now_ns();
+        for (int i = 0; i < n; i++)
+            drain(ev[i].data.ptr);
+
+        expire(now);
+        if (k == bursts && expire_seq == next_seq)
+            break;
+    }
+    elapsed = now_ns() - start;
+
+    printf("[TaaS] Sent %llu, received %llu, lost %llu (%.3f%%), send errors %llu, late %llu\n",
+           (unsigned long long)sent, (unsigned long long)received, (unsigned long long)lost,
+           sent ? 100.0 * (double)lost / (double)sent : 0.0,
+           (unsigned long long)send_errors, (unsigned long long)late);
+    printf("[TaaS] Offered %.0f req/s, answered %.0f req/s\n",
+           (double)sent * 1e9 / (double)(send_end - start + 1),
+           (double)received * 1e9 / (double)elapsed);
+    if (max_lag_ns > 1000000)
+        printf("[TaaS] Warning: generator fell up to %.1f ms behind schedule (charged to latency)\n",
+               (double)max_lag_ns / 1e6);
+
+    printf("\n%-12s %9s %9s %9s %9s %9s %9s %9s  (us)\n",
+           "latency", "min", "p50", "p90", "p99", "p99.9", "p99.99", "max");
+    print_latency("corrected", &corrected);
+    print_latency("uncorrected", &uncorrected);
+
+    if (hdr_file) {
+        FILE *f = fopen(hdr_file, "w");
+
+        if (!f) {
+            perror("taas_bench: output");
+            return EXIT_FAILURE;
+        }
+        hist_dump(f, &corrected);
+        fclose(f);
+    }
+
+    return received ? EXIT_SUCCESS : EXIT_FAILURE;
+}
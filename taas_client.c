@@ -0,0 +1,651 @@
+/*
+ * TaaS client library - pipelined queries and bulk certificate checks
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * One connected, non-blocking UDP socket per client. Outstanding
+ * requests live in a ring indexed by request_id, which the library
+ * hands out sequentially from a random start, so a reply finds its
+ * request with one masked lookup and replies meant for an earlier
+ * process (same port, restarted client) don't match.
+ *
+ * A federation is just an array of clients polled together.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+
+#include "taas_ed25519.h"
+#include "taas_client.h"
+
+#define RX_BATCH     32
+#define RX_BUF_SIZE  256             /* above any reply to an extended request */
+#define VERIFY_BATCH 1024            /* certificates per call into the verifier */
+#define FED_RX_BATCH 64
+
+struct pending {
+    uint32_t request_id;
+    uint8_t  used;
+    uint8_t  tsa;
+    uint64_t t1;
+    uint8_t  hash[32];
+};
+
+struct taas_client {
+    int fd;
+    uint32_t next_id;
+    struct pending pending[TAAS_CLIENT_INFLIGHT];
+
+    struct mmsghdr msgs[RX_BATCH];
+    struct iovec iov[RX_BATCH];
+    uint8_t buf[RX_BATCH][RX_BUF_SIZE];
+    uint8_t ctrl[RX_BATCH][64];
+};
+
+static inline uint64_t realtime_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+struct taas_client *taas_client_open(const char *host, uint16_t port)
+{
+    struct addrinfo hints = { .ai_socktype = SOCK_DGRAM }, *res, *ai;
+    struct taas_client *c;
+    char service[8];
+    int on = 1, err;
+
+    c = calloc(1, sizeof(*c));
+    if (!c)
+        return NULL;
+    c->fd = -1;
+
+    snprintf(service, sizeof(service), "%u", port ? port : TAAS_PORT);
+    err = getaddrinfo(host, service, &hints, &res);
+    if (err) {
+        free(c);
+        errno = err == EAI_SYSTEM ? errno : EHOSTUNREACH;
+        return NULL;
+    }
+
+    for (ai = res; ai; ai = ai->ai_next) {
+        c->fd = socket(ai->ai_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (c->fd < 0)
+            continue;
+        if (!connect(c->fd, ai->ai_addr, ai->ai_addrlen))
+            break;
+        close(c->fd);
+        c->fd = -1;
+    }
+    freeaddrinfo(res);
+    if (c->fd < 0)
+        goto fail;
+
+    /* T4 is the kernel's receive time, not when poll() got around to it */
+    if (setsockopt(c->fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0)
+        goto fail;
+
+    if (getrandom(&c->next_id, sizeof(c->next_id), 0) != sizeof(c->next_id))
+        goto fail;
+
+    for (unsigned int i = 0; i < RX_BATCH; i++) {
+        c->iov[i].iov_base = c->buf[i];
+        c->iov[i].iov_len = RX_BUF_SIZE;
+        c->msgs[i].msg_hdr.msg_iov = &c->iov[i];
+        c->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    return c;
+
+fail:
+    err = errno;
+    taas_client_close(c);
+    errno = err;
+    return NULL;
+}
+
+void taas_client_close(struct taas_client *c)
+{
+    if (!c)
+        return;
+
+    if (c->fd >= 0)
+        close(c->fd);
+    free(c);
+}
+
+int taas_client_fd(const struct taas_client *c)
+{
+    return c->fd;
+}
+
+static int send_request(struct taas_client *c, const void *req, size_t len,
+                        const uint8_t *hash, uint32_t *request_id)
+{
+    uint32_t id = c->next_id;
+    struct pending *p = &c->pending[id % TAAS_CLIENT_INFLIGHT];
+
+    p->request_id = id;
+    p->tsa = hash != NULL;
+    if (hash)
+        memcpy(p->hash, hash, sizeof(p->hash));
+    p->t1 = realtime_ns();
+    if (send(c->fd, req, len, 0) < 0) {
+        p->used = 0;
+        return -1;
+    }
+
+    p->used = 1;
+    c->next_id++;
+    if (request_id)
+        *request_id = id;
+    return 0;
+}
+
+static inline void fill_hdr(struct taas_hdr *h, uint8_t type, uint32_t request_id)
+{
+    h->magic = TAAS_MAGIC;
+    h->version = TAAS_VERSION;
+    h->type = type;
+    h->flags = 0;
+    h->request_id = request_id;
+}
+
+int taas_client_send_time(struct taas_client *c, uint32_t *request_id)
+{
+    struct taas_ext_time_request req;
+
+    fill_hdr(&req.hdr, TAAS_MSG_EXT_TIME_REQ, c->next_id);
+    return send_request(c, &req, sizeof(req), NULL, request_id);
+}
+
+int taas_client_send_tsa(struct taas_client *c, const uint8_t hash[32], uint32_t *request_id)
+{
+    struct taas_ext_tsa_request req;
+
+    fill_hdr(&req.hdr, TAAS_MSG_EXT_TSA_REQ, c->next_id);
+    memcpy(req.client_hash, hash, sizeof(req.client_hash));
+    return send_request(c, &req, sizeof(req), hash, request_id);
+}
+
+static uint64_t rx_stamp(const struct msghdr *mh)
+{
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(mh); cm; cm = CMSG_NXTHDR((struct msghdr *)mh, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+
+            memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+            return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+        }
+    }
+    return realtime_ns();
+}
+
+static inline void set_times(struct taas_result *r, uint64_t t2, uint64_t t3)
+{
+    r->t2 = t2;
+    r->t3 = t3;
+    r->offset_ns = ((int64_t)(t2 - r->t1) + (int64_t)(t3 - r->t4)) / 2;
+    r->delay_ns = (int64_t)(r->t4 - r->t1) - (int64_t)(t3 - t2);
+}
+
+/*
+ * parse_reply - Match one datagram to its outstanding request.
+ * Returns 1 with *r filled in, 0 if it answers nothing we sent.
+ */
+static int parse_reply(struct taas_client *c, const uint8_t *buf, size_t len, uint64_t t4,
+                       struct taas_result *r)
+{
+    const struct taas_hdr *hdr = (const struct taas_hdr *)buf;
+    struct pending *p;
+
+    if (len < sizeof(*hdr) || hdr->magic != TAAS_MAGIC || hdr->version != TAAS_VERSION)
+        return 0;
+
+    p = &c->pending[hdr->request_id % TAAS_CLIENT_INFLIGHT];
+    if (!p->used || p->request_id != hdr->request_id)
+        return 0;
+
+    memset(r, 0, sizeof(*r));
+    r->request_id = hdr->request_id;
+    r->t1 = p->t1;
+    r->t4 = t4;
+
+    if (hdr->type == TAAS_MSG_EXT_TIME_REPLY && len == sizeof(struct taas_ext_time_reply) &&
+        !p->tsa) {
+        const struct taas_ext_time_reply *rep = (const void *)buf;
+
+        r->type = TAAS_RESULT_TIME;
+        set_times(r, rep->rx_timestamp_ns, rep->tx_timestamp_ns);
+    } else if (hdr->type == TAAS_MSG_EXT_CERT && len == sizeof(struct taas_ext_certificate) &&
+               p->tsa) {
+        const struct taas_ext_certificate *ec = (const void *)buf;
+
+        if (memcmp(ec->client_hash, p->hash, sizeof(p->hash)))
+            return 0;
+        r->type = TAAS_RESULT_CERT;
+        memcpy(r->cert.client_hash, ec->client_hash, sizeof(r->cert.client_hash));
+        r->cert.utc_timestamp_ns = ec->utc_timestamp_ns;
+        memcpy(r->cert.signature, ec->signature, sizeof(r->cert.signature));
+        set_times(r, ec->utc_timestamp_ns, ec->tx_timestamp_ns);
+    } else if (hdr->type == TAAS_MSG_BUSY && len == sizeof(struct taas_busy_reply) && p->tsa) {
+        const struct taas_busy_reply *b = (const void *)buf;
+
+        if (memcmp(b->hash_prefix, p->hash, sizeof(b->hash_prefix)))
+            return 0;
+        r->type = TAAS_RESULT_BUSY;
+        r->retry_after_us = b->retry_after_us;
+    } else {
+        return 0;
+    }
+
+    p->used = 0;
+    return 1;
+}
+
+int taas_client_poll(struct taas_client *c, struct taas_result *res, unsigned int max,
+                     int timeout_ms)
+{
+    struct pollfd pfd = { .fd = c->fd, .events = POLLIN };
+    unsigned int got = 0;
+
+    if (!max)
+        return 0;
+
+    if (timeout_ms) {
+        int r = poll(&pfd, 1, timeout_ms);
+
+        if (r <= 0)
+            return r;
+    }
+
+    while (got < max) {
+        unsigned int want = max - got < RX_BATCH ? max - got : RX_BATCH;
+        int n;
+
+        for (unsigned int i = 0; i < want; i++) {
+            c->msgs[i].msg_hdr.msg_control = c->ctrl[i];
+            c->msgs[i].msg_hdr.msg_controllen = sizeof(c->ctrl[i]);
+            c->msgs[i].msg_hdr.msg_flags = 0;
+        }
+        n = recvmmsg(c->fd, c->msgs, want, MSG_DONTWAIT, NULL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                break;
+            /* e.g. ECONNREFUSED from an earlier send: report it only alone */
+            return got ? (int)got : -1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            const struct msghdr *mh = &c->msgs[i].msg_hdr;
+
+            if (mh->msg_flags & MSG_TRUNC)
+                continue;
+            got += parse_reply(c, c->buf[i], c->msgs[i].msg_len, rx_stamp(mh), &res[got]);
+        }
+        if ((unsigned int)n < want)
+            break;
+    }
+    return (int)got;
+}
+
+int taas_client_sync(struct taas_client *c, unsigned int n, int timeout_ms,
+                     struct taas_result *best)
+{
+    struct taas_result res[RX_BATCH];
+    uint64_t deadline = monotonic_ns() + (uint64_t)timeout_ms * 1000000ULL;
+    unsigned int sent, got = 0;
+    uint32_t first = c->next_id;
+
+    if (n > TAAS_CLIENT_INFLIGHT)
+        n = TAAS_CLIENT_INFLIGHT;
+
+    for (sent = 0; sent < n; sent++)
+        if (taas_client_send_time(c, NULL) < 0)
+            break;
+    if (!sent)
+        return -1;
+
+    while (got < sent) {
+        uint64_t now = monotonic_ns();
+        int r;
+
+        if (now >= deadline)
+            break;
+        r = taas_client_poll(c, res, RX_BATCH, (int)((deadline - now + 999999) / 1000000));
+        if (r < 0)
+            return got ? (int)got : -1;
+
+        for (int i = 0; i < r; i++) {
+            if (res[i].type != TAAS_RESULT_TIME || res[i].request_id - first >= sent)
+                continue;
+            if (!got++ || res[i].delay_ns < best->delay_ns)
+                *best = res[i];
+        }
+    }
+
+    if (!got) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return (int)got;
+}
+
+long taas_verify_certificates(const uint8_t pub[32], const struct taas_certificate *certs,
+                              size_t n, uint8_t *valid)
+{
+    struct taas_ed25519_item items[VERIFY_BATCH];
+    long good = 0;
+
+    for (size_t base = 0; base < n; base += VERIFY_BATCH) {
+        size_t m = n - base < VERIFY_BATCH ? n - base : VERIFY_BATCH;
+        long r;
+
+        /* The signature covers client_hash || utc_timestamp_ns */
+        for (size_t i = 0; i < m; i++) {
+            items[i].msg = (const uint8_t *)&certs[base + i];
+            items[i].len = offsetof(struct taas_certificate, signature);
+            items[i].sig = certs[base + i].signature;
+        }
+        r = taas_ed25519_verify_batch(pub, items, m, valid + base);
+        if (r < 0)
+            return -1;
+        good += r;
+    }
+    return good;
+}
+
+/* ------------------------------------------------------------------ */
+/* Federation                                                           */
+/* ------------------------------------------------------------------ */
+
+struct taas_federation {
+    unsigned int n;
+    struct taas_client *node[TAAS_FED_MAX];
+    uint64_t seed[TAAS_FED_MAX];        /* rendezvous weight of each node */
+};
+
+/* splitmix64 finaliser */
+static inline uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/* FNV-1a of the node's address, so every client ranks nodes alike */
+static uint64_t node_seed(int fd)
+{
+    struct sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    const uint8_t *p = (const uint8_t *)&ss;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t from = 0, to = 0;
+
+    memset(&ss, 0, sizeof(ss));
+    if (getpeername(fd, (struct sockaddr *)&ss, &len) == 0) {
+        if (ss.ss_family == AF_INET) {
+            from = offsetof(struct sockaddr_in, sin_port);
+            to = offsetof(struct sockaddr_in, sin_addr) + sizeof(struct in_addr);
+        } else {
+            from = offsetof(struct sockaddr_in6, sin6_port);
+            to = sizeof(struct sockaddr_in6);
+        }
+    }
+    for (size_t i = from; i < to; i++)
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    return mix64(h);
+}
+
+struct taas_federation *taas_fed_open(const char *const *hosts, unsigned int n, uint16_t port)
+{
+    struct taas_federation *f;
+    int err;
+
+    if (!n || n > TAAS_FED_MAX) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    f = calloc(1, sizeof(*f));
+    if (!f)
+        return NULL;
+
+    for (f->n = 0; f->n < n; f->n++) {
+        f->node[f->n] = taas_client_open(hosts[f->n], port);
+        if (!f->node[f->n])
+            goto fail;
+        f->seed[f->n] = node_seed(f->node[f->n]->fd);
+    }
+    return f;
+
+fail:
+    err = errno;
+    taas_fed_close(f);
+    errno = err;
+    return NULL;
+}
+
+void taas_fed_close(struct taas_federation *f)
+{
+    if (!f)
+        return;
+
+    for (unsigned int i = 0; i < f->n; i++)
+        taas_client_close(f->node[i]);
+    free(f);
+}
+
+unsigned int taas_fed_size(const struct taas_federation *f)
+{
+    return f->n;
+}
+
+struct taas_client *taas_fed_client(struct taas_federation *f, unsigned int node)
+{
+    return node < f->n ? f->node[node] : NULL;
+}
+
+int taas_fed_poll(struct taas_federation *f, struct taas_result *res, unsigned int max,
+                  int timeout_ms)
+{
+    struct pollfd pfd[TAAS_FED_MAX];
+    unsigned int got = 0;
+    int r;
+
+    for (unsigned int i = 0; i < f->n; i++) {
+        pfd[i].fd = f->node[i]->fd;
+        pfd[i].events = POLLIN;
+        pfd[i].revents = 0;
+    }
+    r = poll(pfd, f->n, timeout_ms);
+    if (r <= 0)
+        return r;
+
+    for (unsigned int i = 0; i < f->n && got < max; i++) {
+        if (!pfd[i].revents)
+            continue;
+        r = taas_client_poll(f->node[i], res + got, max - got, 0);
+        for (int k = 0; k < r; k++)
+            res[got + (unsigned int)k].node = i;
+        got += r > 0 ? (unsigned int)r : 0;
+    }
+    return (int)got;
+}
+
+struct edge {
+    int64_t at;
+    int start;
+};
+
+static int cmp_edge(const void *a, const void *b)
+{
+    const struct edge *x = a, *y = b;
+
+    if (x->at != y->at)
+        return x->at < y->at ? -1 : 1;
+    return y->start - x->start;         /* touching intervals overlap */
+}
+
+/*
+ * marzullo - The range shared by the most of n intervals.
+ * Returns how many share it.
+ */
+static unsigned int marzullo(const int64_t *lo, const int64_t *hi, unsigned int n,
+                             int64_t *best_lo, int64_t *best_hi)
+{
+    struct edge e[2 * TAAS_FED_MAX];
+    unsigned int best = 0, count = 0;
+    int open = 0;
+
+    for (unsigned int i = 0; i < n; i++) {
+        e[2 * i] = (struct edge){ .at = lo[i], .start = 1 };
+        e[2 * i + 1] = (struct edge){ .at = hi[i], .start = 0 };
+    }
+    qsort(e, 2 * n, sizeof(e[0]), cmp_edge);
+
+    for (unsigned int i = 0; i < 2 * n; i++) {
+        if (e[i].start) {
+            if (++count > best) {
+                best = count;
+                *best_lo = e[i].at;
+                open = 1;
+            }
+        } else {
+            if (open && count == best) {
+                *best_hi = e[i].at;
+                open = 0;
+            }
+            count--;
+        }
+    }
+    return best;
+}
+
+int taas_fed_sync(struct taas_federation *f, unsigned int samples, int timeout_ms,
+                  struct taas_fed_time *t)
+{
+    struct taas_result res[FED_RX_BATCH], best[TAAS_FED_MAX];
+    uint64_t deadline = monotonic_ns() + (uint64_t)timeout_ms * 1000000ULL;
+    unsigned int sent[TAAS_FED_MAX] = { 0 }, got[TAAS_FED_MAX] = { 0 };
+    uint32_t first[TAAS_FED_MAX];
+    int64_t lo[TAAS_FED_MAX], hi[TAAS_FED_MAX];
+    unsigned int pending = 0, answered = 0, idx[TAAS_FED_MAX];
+
+    if (samples > TAAS_CLIENT_INFLIGHT)
+        samples = TAAS_CLIENT_INFLIGHT;
+
+    /* Interleaved, so every node is sampled over the same stretch of time */
+    for (unsigned int i = 0; i < f->n; i++)
+        first[i] = f->node[i]->next_id;
+    for (unsigned int s = 0; s < samples; s++)
+        for (unsigned int i = 0; i < f->n; i++)
+            if (sent[i] == s && taas_client_send_time(f->node[i], NULL) == 0)
+                sent[i]++;
+    for (unsigned int i = 0; i < f->n; i++)
+        pending += sent[i];
+
+    while (pending) {
+        uint64_t now = monotonic_ns();
+        int r;
+
+        if (now >= deadline)
+            break;
+        r = taas_fed_poll(f, res, FED_RX_BATCH, (int)((deadline - now + 999999) / 1000000));
+        if (r < 0)
+            return -1;
+
+        for (int k = 0; k < r; k++) {
+            unsigned int i = res[k].node;
+
+            if (res[k].type != TAAS_RESULT_TIME || res[k].request_id - first[i] >= sent[i])
+                continue;
+            pending--;
+            if (!got[i]++ || res[k].delay_ns < best[i].delay_ns)
+                best[i] = res[k];
+        }
+    }
+
+    /* Each node's bounds: the reply may have spent any part of the path delay either way */
+    for (unsigned int i = 0; i < f->n; i++) {
+        int64_t half;
+
+        if (!got[i])
+            continue;
+        half = best[i].delay_ns > 0 ? best[i].delay_ns / 2 : 0;
+        lo[answered] = best[i].offset_ns - half;
+        hi[answered] = best[i].offset_ns + half;
+        idx[answered++] = i;
+    }
+
+    memset(t, 0, sizeof(*t));
+    t->answered = answered;
+    if (!answered) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    int64_t ilo = 0, ihi = 0;
+
+    t->agree = marzullo(lo, hi, answered, &ilo, &ihi);
+    t->offset_ns = ilo + (ihi - ilo) / 2;
+    t->error_ns = (ihi - ilo) / 2;
+    for (unsigned int k = 0; k < answered; k++)
+        if (lo[k] > ilo || hi[k] < ihi)
+            t->falsetickers |= 1U << idx[k];
+
+    if (2 * t->agree <= answered) {
+        errno = EPROTO;
+        return -1;
+    }
+    return (int)t->agree;
+}
+
+unsigned int taas_fed_route(const struct taas_federation *f, const uint8_t hash[32],
+                            unsigned int rank)
+{
+    unsigned int order[TAAS_FED_MAX];
+    uint64_t score[TAAS_FED_MAX], key;
+
+    memcpy(&key, hash, sizeof(key));
+    for (unsigned int i = 0; i < f->n; i++) {
+        unsigned int j = i;
+
+        /* Highest score first: insertion sort, n is tiny */
+        score[i] = mix64(key ^ f->seed[i]);
+        while (j && score[order[j - 1]] < score[i]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+    return order[rank % f->n];
+}
+
+int taas_fed_send_tsa(struct taas_federation *f, const uint8_t hash[32], unsigned int rank,
+                      unsigned int *node, uint32_t *request_id)
+{
+    unsigned int i = taas_fed_route(f, hash, rank);
+
+    if (node)
+        *node = i;
+    return taas_client_send_tsa(f->node[i], hash, request_id);
+}
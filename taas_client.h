@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: GPL-2.0
+ *
+ * TaaS client library
+ *
+ * Talks to a node over UDP/1588 with the extended requests of
+ * taas_proto.h, so every sample carries the server's receive and
+ * transmit times (T2, T3) next to the client's own (T1, T4):
+ *
+ * - Requests are pipelined: send as many as needed, then collect
+ *   replies as they come back, matched by request_id. Up to
+ *   TAAS_CLIENT_INFLIGHT are tracked; a request still unanswered when
+ *   its slot comes round again counts as lost.
+ * - taas_client_sync() takes the best of N samples, the one with the
+ *   smallest round-trip delay, which is the one least disturbed by
+ *   queueing on the path.
+ * - taas_verify_certificates() checks certificates in bulk with
+ *   Ed25519 batch verification (taas_ed25519.h), for auditors with
+ *   millions of them.
+ * - A federation (taas_fed_*) treats several nodes as one service:
+ *   time from all of them, combined by Marzullo's intersection so a
+ *   node whose crystal or reference went astray is outvoted, and TSA
+ *   requests spread over the nodes by rendezvous hashing of the
+ *   document hash.
+ *
+ * T1 is CLOCK_REALTIME right before send(), T4 the kernel receive
+ * stamp of the reply (SO_TIMESTAMPNS), so offsets are relative to the
+ * client's system clock. A client object is not thread-safe.
+ *
+ * Build with `make client` and link against libtaas.a.
+ */
+#ifndef TAAS_CLIENT_H
+#define TAAS_CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "taas_proto.h"
+
+#define TAAS_CLIENT_INFLIGHT 256
+
+struct taas_client;
+
+enum taas_result_type {
+    TAAS_RESULT_TIME,           /* taas_client_send_time() */
+    TAAS_RESULT_CERT,           /* taas_client_send_tsa(): cert is filled in */
+    TAAS_RESULT_BUSY,           /* TSA refused by the node's rate limit */
+};
+
+struct taas_result {
+    uint32_t request_id;
+    enum taas_result_type type;
+    uint64_t t1, t2, t3, t4;    /* UTC ns: client send, server rx, server tx, client rx */
+    int64_t  offset_ns;         /* server - client, ((T2 - T1) + (T3 - T4)) / 2 */
+    int64_t  delay_ns;          /* (T4 - T1) - (T3 - T2) */
+    uint32_t retry_after_us;    /* TAAS_RESULT_BUSY only */
+    unsigned int node;          /* taas_fed_poll(): index of the answering node */
+    struct taas_certificate cert;
+};
+
+/*
+ * taas_client_open - Connect a UDP socket to host (name or address,
+ * IPv4 or IPv6) on port, TAAS_PORT if 0.
+ * Returns NULL with errno set on failure.
+ */
+struct taas_client *taas_client_open(const char *host, uint16_t port);
+
+void taas_client_close(struct taas_client *c);
+
+/* The socket, for callers that wait in their own poll loop */
+int taas_client_fd(const struct taas_client *c);
+
+/*
+ * taas_client_send_time - Send one extended time request without
+ * waiting for the reply. Its request_id is stored in *request_id if
+ * that is not NULL.
+ * Returns 0, or -1 with errno set (EAGAIN: socket buffer full).
+ */
+int taas_client_send_time(struct taas_client *c, uint32_t *request_id);
+
+/* taas_client_send_tsa - Same, asking for a certificate over hash */
+int taas_client_send_tsa(struct taas_client *c, const uint8_t hash[32], uint32_t *request_id);
+
+/*
+ * taas_client_poll - Collect up to max replies, waiting at most
+ * timeout_ms for the first (0: don't wait, -1: forever). Replies that
+ * match no outstanding request, e.g. duplicates, are dropped.
+ * Returns the number of results, or -1 with errno set.
+ */
+int taas_client_poll(struct taas_client *c, struct taas_result *res, unsigned int max,
+                     int timeout_ms);
+
+/*
+ * taas_client_sync - Send n time requests back to back and keep the
+ * reply with the smallest delay, waiting up to timeout_ms for all of
+ * them. n is capped at TAAS_CLIENT_INFLIGHT. Replies to other
+ * outstanding requests that arrive meanwhile are consumed and dropped.
+ * Returns the number of samples received, or -1 with errno set
+ * (ETIMEDOUT if none came back).
+ */
+int taas_client_sync(struct taas_client *c, unsigned int n, int timeout_ms,
+                     struct taas_result *best);
+
+/*
+ * taas_verify_certificates - Check the signatures of n certificates
+ * issued by the node whose raw 32-byte Ed25519 public key is pub (the
+ * last 32 bytes of `openssl pkey -pubout -outform DER`). valid[i] is
+ * 1 or 0 per certificate.
+ * Returns the number of valid ones, or -1 with errno set.
+ */
+long taas_verify_certificates(const uint8_t pub[32], const struct taas_certificate *certs,
+                              size_t n, uint8_t *valid);
+
+/*
+ * Federation. Each node's best sample bounds the true offset to
+ * [offset - delay / 2, offset + delay / 2]; the combined time is the
+ * midpoint of the range most of those intervals share. A node whose
+ * interval misses it is a falseticker: answered, but wrong.
+ */
+#define TAAS_FED_MAX 16
+
+struct taas_federation;
+
+struct taas_fed_time {
+    int64_t  offset_ns;         /* server - client, midpoint of the intersection */
+    int64_t  error_ns;          /* half its width */
+    unsigned int agree;         /* nodes whose interval contains it */
+    unsigned int answered;
+    uint32_t falsetickers;      /* bit i set: node i answered but disagrees */
+};
+
+/*
+ * taas_fed_open - One client per host, in the given order, which is
+ * what node indices refer to. port as for taas_client_open().
+ * Returns NULL with errno set if any host fails.
+ */
+struct taas_federation *taas_fed_open(const char *const *hosts, unsigned int n, uint16_t port);
+
+void taas_fed_close(struct taas_federation *f);
+
+unsigned int taas_fed_size(const struct taas_federation *f);
+
+/* The client of one node, e.g. to send it requests of its own */
+struct taas_client *taas_fed_client(struct taas_federation *f, unsigned int node);
+
+/*
+ * taas_fed_sync - Take the best of samples from every node at once,
+ * waiting up to timeout_ms, and intersect them.
+ * Returns the number of nodes that agree, or -1 with errno set:
+ * ETIMEDOUT if no node answered, EPROTO if no majority of those that
+ * did agree (*t is still filled in, with the largest minority).
+ */
+int taas_fed_sync(struct taas_federation *f, unsigned int samples, int timeout_ms,
+                  struct taas_fed_time *t);
+
+/*
+ * taas_fed_route - The node serving hash at rank (0: first choice,
+ * 1: where to retry after a busy reply or timeout, ...). Rendezvous
+ * hashing on the node addresses: taking a node out moves only its own
+ * hashes, and a node added takes 1/(n+1) of them from the others.
+ */
+unsigned int taas_fed_route(const struct taas_federation *f, const uint8_t hash[32],
+                            unsigned int rank);
+
+/* taas_fed_send_tsa - Send a TSA request for hash to its node at rank */
+int taas_fed_send_tsa(struct taas_federation *f, const uint8_t hash[32], unsigned int rank,
+                      unsigned int *node, uint32_t *request_id);
+
+/*
+ * taas_fed_poll - taas_client_poll() over every node; res[i].node says
+ * which one answered.
+ */
+int taas_fed_poll(struct taas_federation *f, struct taas_result *res, unsigned int max,
+                  int timeout_ms);
+
+#endif /* TAAS_CLIENT_H */
@@ -0,0 +1,120 @@
+/*
+ * TaaS local clock - same-host time without the loopback round trip
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * The anchor page is written by the driver whenever the node
+ * recalibrates, i.e. about once a minute, so readers practically never
+ * retry. Ticks are read from whichever source the anchor names, so
+ * one library serves nodes built with either timer backend.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "taas_ioctl.h"
+#include "taas_timer.h"
+#include "taas_clock.h"
+
+#define TIMER_DEVICE "/dev/taas_timer"
+#define MAP_SIZE 4096
+
+struct taas_clock {
+    int fd;
+    void *regs;
+    const struct taas_anchor_page *page;
+};
+
+struct taas_clock *taas_clock_open(void)
+{
+    struct taas_clock *c = calloc(1, sizeof(*c));
+    int err;
+
+    if (!c)
+        return NULL;
+
+    c->fd = open(TIMER_DEVICE, O_RDONLY | O_CLOEXEC);
+    if (c->fd < 0)
+        goto fail;
+
+    c->regs = mmap(NULL, MAP_SIZE, PROT_READ, MAP_SHARED, c->fd,
+                   (off_t)TAAS_MMAP_TIMER * MAP_SIZE);
+    if (c->regs == MAP_FAILED)
+        goto fail;
+
+    c->page = mmap(NULL, MAP_SIZE, PROT_READ, MAP_SHARED, c->fd,
+                   (off_t)TAAS_MMAP_ANCHOR * MAP_SIZE);
+    if (c->page == MAP_FAILED)
+        goto fail;
+    return c;
+
+fail:
+    err = errno;
+    taas_clock_close(c);
+    errno = err;
+    return NULL;
+}
+
+void taas_clock_close(struct taas_clock *c)
+{
+    if (!c)
+        return;
+
+    if (c->page && c->page != MAP_FAILED)
+        munmap((void *)c->page, MAP_SIZE);
+    if (c->regs && c->regs != MAP_FAILED)
+        munmap(c->regs, MAP_SIZE);
+    if (c->fd >= 0)
+        close(c->fd);
+    free(c);
+}
+
+static inline int read_ticks(const struct taas_clock *c, uint32_t source, uint64_t *ticks)
+{
+    switch (source) {
+    case TAAS_TIMER_ST:
+        *ticks = taas_st_read(c->regs);
+        return 0;
+#ifdef __aarch64__
+    case TAAS_TIMER_CNTVCT:
+        *ticks = taas_cntvct_read();
+        return 0;
+#endif
+    default:
+        return -1;
+    }
+}
+
+int taas_clock_now(struct taas_clock *c, uint64_t *utc_ns)
+{
+    struct taas_anchor a;
+    uint32_t seq, valid;
+    uint64_t ticks;
+
+    /* Seqlock read side: copy the anchor, keep it only if no update
+     * started or finished meanwhile.
+     */
+    do {
+        seq = __atomic_load_n(&c->page->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+        valid = c->page->valid;
+        a     = c->page->anchor;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || __atomic_load_n(&c->page->seq, __ATOMIC_RELAXED) != seq);
+
+    if (!valid) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    if (read_ticks(c, a.source, &ticks) < 0) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    *utc_ns = taas_anchor_to_utc(&a, ticks);
+    return 0;
+}
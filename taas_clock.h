@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: GPL-2.0
+ *
+ * TaaS local clock
+ *
+ * In-process TaaS time for programs on the node itself. Instead of a
+ * UDP round trip to 127.0.0.1:1588, the caller maps the timer
+ * registers and the anchor page published by taas_driver and
+ * evaluates the node's time equation directly:
+ * two cached loads, one MMIO timer read and a multiply.
+ *
+ * Build with `make clock` and link against libtaas_clock.a.
+ */
+#ifndef TAAS_CLOCK_H
+#define TAAS_CLOCK_H
+
+#include <stdint.h>
+
+struct taas_clock;
+
+/*
+ * taas_clock_open - Map /dev/taas_timer for reading TaaS time.
+ * Returns NULL with errno set on failure.
+ */
+struct taas_clock *taas_clock_open(void);
+
+void taas_clock_close(struct taas_clock *c);
+
+/*
+ * taas_clock_now - Current UTC in nanoseconds, exactly as taas_node
+ * would serve it in raw mode.
+ * Returns 0 on success, or -1 with errno EAGAIN while no node is
+ * publishing an anchor, ENOTSUP if its tick source can't be read here.
+ */
+int taas_clock_now(struct taas_clock *c, uint64_t *utc_ns);
+
+#endif /* TAAS_CLOCK_H */
@@ -11,6 +11,19 @@
  * - No scheduler interaction
  * - No abstraction over hardware
  *
+ * With responder=1 the driver also answers raw-mode UDP/1588 requests
+ * itself, from a netfilter hook, using the anchor the node publishes
+ * through TAAS_IOC_SET_ANCHOR. The node then only sees TSA and
+ * versioned traffic.
+ *
+ * With pps_gpio=N a PPS signal (e.g. from a GPS module) on GPIO N is
+ * timestamped in its edge interrupt and exposed as a read-only ring,
+ * so the node can discipline its anchor without NTP.
+ *
+ * Every accepted anchor is also republished to a read-only page that
+ * local processes map next to the timer registers (see taas_clock.c),
+ * so same-host clients compute TaaS time without any request at all.
+ *
  * This is NOT a general-purpose clocksource and is not intended
  * for upstream inclusion.
  */
@@ -20,7 +33,27 @@
 #include <linux/io.h>
 #include <linux/mm.h>
 #include <linux/uaccess.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/timekeeping.h>
+#include <linux/gpio.h>
+#include <linux/interrupt.h>
+#ifdef CONFIG_ARM64
+#include <asm/arch_timer.h>
+#endif
 #include <linux/miscdevice.h>
+#include <linux/seqlock.h>
+#include <linux/skbuff.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter_ipv4.h>
+#include <net/ip.h>
+#include <net/route.h>
+#include <net/checksum.h>
+
+#include "taas_proto.h"
+#include "taas_ioctl.h"
 
 #define DEVICE_NAME "taas_timer"
 #define BCM2837_ST_BASE 0x3F003000
@@ -32,8 +65,34 @@
  */
 static void __iomem *timer_base;
 
+static bool responder;
+module_param(responder, bool, 0444);
+MODULE_PARM_DESC(responder, "Answer raw-mode UDP/1588 requests in the kernel");
+
+static int pps_gpio = -1;
+module_param(pps_gpio, int, 0444);
+MODULE_PARM_DESC(pps_gpio, "Global GPIO number of a PPS input, rising edge (-1: none)");
+
+/*
+ * Anchor pushed by the node. Written from ioctl (process context),
+ * read from softirq: the writer disables BHs so a reader can never
+ * spin on a sequence held by the task it interrupted.
+ * anchor_owner is the file that set it; NULL means no anchor.
+ *
+ * anchor_page is the user-visible copy, updated under the same lock
+ * with its own sequence counter since the seqlock cannot be mapped.
+ */
+static DEFINE_SEQLOCK(anchor_lock);
+static struct taas_anchor anchor;
+static struct file *anchor_owner;
+static struct taas_anchor_page *anchor_page;
+
+/* PPS edge ring; only written from the edge interrupt */
+static struct taas_pps_page *pps_page;
+static int pps_irq = -1;
+
 /*
- * dev_read - return a consistent 64-bit system timer value
+ * timer_read - return a consistent 64-bit system timer value
  *
  * The BCM2837 exposes the system timer as two 32-bit registers
  * (low/high). Since the bus is 32-bit, a verification loop is
@@ -41,16 +100,11 @@ static void __iomem *timer_base;
  *
  * No locking is required:
  * - Registers are read-only
- * - No shared mutable state exists
  * - Consistency is ensured by re-reading the high register
  */
-static ssize_t dev_read(struct file *filep, char __user *buffer, size_t len, loff_t *offset)
+static inline u64 timer_read(void)
 {
     u32 low, high, high_verify;
-    u64 timestamp;
-
-    if (len < sizeof(u64))
-        return -EINVAL;
 
     /* Atomic 64-bit read on 32-bit bus */
     do {
@@ -59,7 +113,45 @@ static ssize_t dev_read(struct file *filep, char __user *buffer, size_t len, lof
         high_verify = ioread32(timer_base + 0x08);
     } while (high != high_verify);
 
-    timestamp = ((u64)high << 32) | low;
+    return ((u64)high << 32) | low;
+}
+
+/*
+ * source_read - read the tick source a node was built for
+ *
+ * CNTVCT_EL0 exists on arm64 only; elsewhere it reads as 0 and anchors
+ * naming it are refused.
+ */
+static inline u64 source_read(u32 source)
+{
+#ifdef CONFIG_ARM64
+    if (source == TAAS_TIMER_CNTVCT)
+        return __arch_counter_get_cntvct();
+#endif
+    return source == TAAS_TIMER_ST ? timer_read() : 0;
+}
+
+static inline bool source_valid(u32 source)
+{
+    return source == TAAS_TIMER_ST ||
+           (IS_ENABLED(CONFIG_ARM64) && source == TAAS_TIMER_CNTVCT);
+}
+
+/* Latch every source at once, cheapest first */
+static inline void sources_read(u64 ticks[TAAS_TIMER_SOURCES])
+{
+    ticks[TAAS_TIMER_CNTVCT] = source_read(TAAS_TIMER_CNTVCT);
+    ticks[TAAS_TIMER_ST]     = source_read(TAAS_TIMER_ST);
+}
+
+static ssize_t dev_read(struct file *filep, char __user *buffer, size_t len, loff_t *offset)
+{
+    u64 timestamp;
+
+    if (len < sizeof(u64))
+        return -EINVAL;
+
+    timestamp = timer_read();
 
     if (copy_to_user(buffer, &timestamp, sizeof(u64)))
         return -EFAULT;
@@ -68,28 +160,170 @@ static ssize_t dev_read(struct file *filep, char __user *buffer, size_t len, lof
 }
 
 /*
- * dev_mmap - map system timer registers into user space
+ * dev_mmap - map system timer registers or the anchor page into user space
  *
- * The mapping is marked as non-cached to prevent stale reads.
- * User space is expected to perform direct MMIO loads only.
+ * Page offset TAAS_MMAP_TIMER maps the registers, marked as non-cached
+ * to prevent stale reads; user space is expected to perform direct
+ * MMIO loads only. Page offset TAAS_MMAP_ANCHOR maps the anchor page
+ * as ordinary cached memory, read-only.
  *
- * No write access is provided.
+ * No write access is provided to the anchor page.
  */
+static int map_readonly(struct vm_area_struct *vma, void *page, unsigned long size)
+{
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+    vm_flags_clear(vma, VM_MAYWRITE);
+
+    return remap_pfn_range(vma, vma->vm_start,
+                           virt_to_phys(page) >> PAGE_SHIFT,
+                           size, vma->vm_page_prot);
+}
+
 static int dev_mmap(struct file *filp, struct vm_area_struct *vma)
 {
     unsigned long size = vma->vm_end - vma->vm_start;
-    
-    vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
-    
-    return remap_pfn_range(vma, vma->vm_start, 
-                           BCM2837_ST_BASE >> PAGE_SHIFT, 
-                           size, vma->vm_page_prot);
+
+    if (size > PAGE_SIZE)
+        return -EINVAL;
+
+    switch (vma->vm_pgoff) {
+    case TAAS_MMAP_TIMER:
+        vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+
+        return remap_pfn_range(vma, vma->vm_start,
+                               BCM2837_ST_BASE >> PAGE_SHIFT,
+                               size, vma->vm_page_prot);
+    case TAAS_MMAP_ANCHOR:
+        return map_readonly(vma, anchor_page, size);
+    case TAAS_MMAP_PPS:
+        if (!pps_page)
+            return -ENODEV;
+        return map_readonly(vma, pps_page, size);
+    default:
+        return -EINVAL;
+    }
+}
+
+/*
+ * anchor_page_update - republish the anchor (or its absence)
+ *
+ * Caller holds anchor_lock, which serialises writers.
+ */
+static void anchor_page_update(const struct taas_anchor *a)
+{
+    u32 seq = anchor_page->seq;
+
+    WRITE_ONCE(anchor_page->seq, seq + 1);
+    smp_wmb();
+
+    if (a)
+        anchor_page->anchor = *a;
+    WRITE_ONCE(anchor_page->valid, a ? 1 : 0);
+
+    smp_wmb();
+    WRITE_ONCE(anchor_page->seq, seq + 2);
+}
+
+/*
+ * sys_offset - interleaved CLOCK_REALTIME / system timer samples
+ *
+ * Interrupts stay off for the whole run, so nothing but the bus itself
+ * can land between the reads of one sample. 25 samples of three reads
+ * keep that window in the tens of microseconds.
+ */
+static long sys_offset(struct taas_sys_offset __user *uarg)
+{
+    struct taas_sys_offset *req;
+    unsigned long flags;
+    long ret = 0;
+    u32 i;
+
+    req = memdup_user(uarg, sizeof(*req));
+    if (IS_ERR(req))
+        return PTR_ERR(req);
+
+    if (!source_valid(req->source) || !req->n_samples || req->n_samples > TAAS_MAX_SAMPLES) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    local_irq_save(flags);
+    for (i = 0; i < req->n_samples; i++) {
+        req->ts[i][0] = ktime_get_real_ns();
+        req->ts[i][1] = source_read(req->source);
+        req->ts[i][2] = ktime_get_real_ns();
+    }
+    local_irq_restore(flags);
+
+    if (copy_to_user(uarg, req, sizeof(*req)))
+        ret = -EFAULT;
+out:
+    kfree(req);
+    return ret;
+}
+
+/*
+ * set_anchor - accept a new anchor from the node
+ *
+ * Setting the clock that goes out on the wire is a privileged
+ * operation even though the device itself is world-readable.
+ */
+static long set_anchor(struct file *filp, const struct taas_anchor __user *uarg)
+{
+    struct taas_anchor a;
+
+    if (!capable(CAP_SYS_TIME))
+        return -EPERM;
+
+    if (copy_from_user(&a, uarg, sizeof(a)))
+        return -EFAULT;
+
+    if (!source_valid(a.source) || a.shift >= 64)
+        return -EINVAL;
+
+    write_seqlock_bh(&anchor_lock);
+    anchor = a;
+    anchor_owner = filp;
+    anchor_page_update(&a);
+    write_sequnlock_bh(&anchor_lock);
+
+    return 0;
+}
+
+static long dev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    switch (cmd) {
+    case TAAS_IOC_SET_ANCHOR:
+        return set_anchor(filp, (const struct taas_anchor __user *)arg);
+    case TAAS_IOC_SYS_OFFSET:
+        return sys_offset((struct taas_sys_offset __user *)arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
+/*
+ * dev_release - retire the anchor together with the node that owns it
+ */
+static int dev_release(struct inode *inode, struct file *filp)
+{
+    write_seqlock_bh(&anchor_lock);
+    if (anchor_owner == filp) {
+        anchor_owner = NULL;
+        anchor_page_update(NULL);
+    }
+    write_sequnlock_bh(&anchor_lock);
+
+    return 0;
 }
 
 static const struct file_operations fops = {
-    .owner = THIS_MODULE,
-    .read  = dev_read,
-    .mmap  = dev_mmap,
+    .owner          = THIS_MODULE,
+    .read           = dev_read,
+    .mmap           = dev_mmap,
+    .unlocked_ioctl = dev_ioctl,
+    .release        = dev_release,
 };
 
 static struct miscdevice taas_misc = {
@@ -99,36 +333,278 @@ static struct miscdevice taas_misc = {
     .mode  = 0666,
 };
 
+/*
+ * pps_edge - latch the system timer on a PPS rising edge
+ *
+ * The timers are read first; everything between the edge and these
+ * reads is interrupt latency and shows up as a constant offset.
+ */
+static irqreturn_t pps_edge(int irq, void *dev_id)
+{
+    u64 count = pps_page->count;
+
+    sources_read(pps_page->ticks[count % TAAS_PPS_RING]);
+    smp_wmb();
+    WRITE_ONCE(pps_page->count, count + 1);
+
+    return IRQ_HANDLED;
+}
+
+static int pps_setup(void)
+{
+    int ret;
+
+    pps_page = (struct taas_pps_page *)get_zeroed_page(GFP_KERNEL);
+    if (!pps_page)
+        return -ENOMEM;
+
+    ret = gpio_request_one(pps_gpio, GPIOF_IN, "taas_pps");
+    if (ret)
+        goto err_page;
+
+    pps_irq = gpio_to_irq(pps_gpio);
+    if (pps_irq < 0) {
+        ret = pps_irq;
+        goto err_gpio;
+    }
+
+    ret = request_irq(pps_irq, pps_edge, IRQF_TRIGGER_RISING, "taas_pps", NULL);
+    if (ret)
+        goto err_gpio;
+
+    pr_info("taas: PPS capture on GPIO %d (irq %d)\n", pps_gpio, pps_irq);
+    return 0;
+
+err_gpio:
+    gpio_free(pps_gpio);
+err_page:
+    free_page((unsigned long)pps_page);
+    pps_page = NULL;
+    return ret;
+}
+
+static void pps_teardown(void)
+{
+    if (!pps_page)
+        return;
+
+    free_irq(pps_irq, NULL);
+    gpio_free(pps_gpio);
+    free_page((unsigned long)pps_page);
+    pps_page = NULL;
+}
+
+/*
+ * taas_send_raw - build and send the raw reply to a request
+ *
+ * Same construction as nf_send_reset(): a fresh skb with addresses and
+ * ports swapped, routed as locally generated traffic. The payload is
+ * the bare little-endian uint64_t of a raw reply.
+ */
+static int taas_send_raw(struct net *net, struct sk_buff *oldskb,
+                         const struct udphdr *ouh, u64 utc_ns)
+{
+    const struct iphdr *oiph = ip_hdr(oldskb);
+    const unsigned int len = sizeof(struct udphdr) + sizeof(__le64);
+    __le64 payload = cpu_to_le64(utc_ns);
+    struct sk_buff *nskb;
+    struct iphdr *niph;
+    struct udphdr *nuh;
+
+    nskb = alloc_skb(LL_MAX_HEADER + sizeof(struct iphdr) + len, GFP_ATOMIC);
+    if (!nskb)
+        return -ENOMEM;
+
+    skb_reserve(nskb, LL_MAX_HEADER);
+    nskb->protocol = htons(ETH_P_IP);
+
+    skb_reset_network_header(nskb);
+    niph = skb_put(nskb, sizeof(struct iphdr));
+    niph->version  = 4;
+    niph->ihl      = sizeof(struct iphdr) / 4;
+    niph->tos      = 0;
+    niph->id       = 0;
+    niph->frag_off = htons(IP_DF);
+    niph->protocol = IPPROTO_UDP;
+    niph->check    = 0;
+    niph->saddr    = oiph->daddr;
+    niph->daddr    = oiph->saddr;
+    niph->tot_len  = htons(sizeof(struct iphdr) + len);
+
+    skb_set_transport_header(nskb, sizeof(struct iphdr));
+    nuh = skb_put(nskb, sizeof(struct udphdr));
+    nuh->source = ouh->dest;
+    nuh->dest   = ouh->source;
+    nuh->len    = htons(len);
+    nuh->check  = 0;
+    skb_put_data(nskb, &payload, sizeof(payload));
+
+    nuh->check = csum_tcpudp_magic(niph->saddr, niph->daddr, len, IPPROTO_UDP,
+                                   csum_partial(nuh, len, 0));
+    if (!nuh->check)
+        nuh->check = CSUM_MANGLED_0;
+    nskb->ip_summed = CHECKSUM_NONE;
+
+    if (ip_route_me_harder(net, NULL, nskb, RTN_UNSPEC)) {
+        kfree_skb(nskb);
+        return -EHOSTUNREACH;
+    }
+    niph->ttl = ip4_dst_hoplimit(skb_dst(nskb));
+
+    /* __ip_local_out() fills in the IP checksum */
+    ip_local_out(net, NULL, nskb);
+    return 0;
+}
+
+/*
+ * taas_nf_hook - answer raw-mode requests before they reach a socket
+ *
+ * Runs at LOCAL_IN, the first hook where the packet is known to be
+ * ours and its reply route exists, yet still ahead of the socket
+ * lookup, the receive queue and the wakeup of the node. The timers are
+ * read as soon as the packet is identified as a TaaS request.
+ *
+ * Anything the node must handle (32-byte TSA hashes, versioned
+ * messages, requests to or from broadcast and multicast addresses) or
+ * anything we cannot answer is passed on untouched.
+ */
+static unsigned int taas_nf_hook(void *priv, struct sk_buff *skb,
+                                 const struct nf_hook_state *state)
+{
+    const struct iphdr *iph = ip_hdr(skb);
+    unsigned int thoff = ip_hdrlen(skb);
+    const struct rtable *rt = skb_rtable(skb);
+    const struct udphdr *uh;
+    struct udphdr _uh;
+    const __le32 *magic;
+    __le32 _magic;
+    struct taas_anchor a;
+    unsigned int seq, payload;
+    u64 ticks[TAAS_TIMER_SOURCES];
+
+    if (iph->protocol != IPPROTO_UDP)
+        return NF_ACCEPT;
+
+    uh = skb_header_pointer(skb, thoff, sizeof(_uh), &_uh);
+    if (!uh || uh->dest != htons(TAAS_PORT))
+        return NF_ACCEPT;
+
+    sources_read(ticks);
+
+    /* No reply to a group, a broadcast or an unset source, nor to a
+     * request sent to a group or a broadcast: one spoofed datagram
+     * must not draw replies from every node on the segment.
+     */
+    if (ipv4_is_multicast(iph->saddr) || ipv4_is_lbcast(iph->saddr) ||
+        ipv4_is_zeronet(iph->saddr) ||
+        (rt && (rt->rt_flags & (RTCF_BROADCAST | RTCF_MULTICAST))))
+        return NF_ACCEPT;
+
+    payload = ntohs(uh->len);
+    if (payload < sizeof(*uh) || payload > skb->len - thoff)
+        return NF_ACCEPT;
+    payload -= sizeof(*uh);
+
+    if (payload == 32)
+        return NF_ACCEPT;
+
+    magic = skb_header_pointer(skb, thoff + sizeof(*uh), sizeof(_magic), &_magic);
+    if (payload >= sizeof(_magic) && magic && le32_to_cpu(*magic) == TAAS_MAGIC)
+        return NF_ACCEPT;
+
+    do {
+        seq = read_seqbegin(&anchor_lock);
+        if (!anchor_owner)
+            return NF_ACCEPT;
+        a = anchor;
+    } while (read_seqretry(&anchor_lock, seq));
+
+    if (taas_send_raw(state->net, skb, uh,
+                      a.base_utc_ns + (((ticks[a.source] - a.base_hw_ticks) * a.mult) >> a.shift)))
+        return NF_ACCEPT;   /* let the node answer it instead */
+
+    consume_skb(skb);
+    return NF_STOLEN;
+}
+
+static const struct nf_hook_ops taas_nf_ops = {
+    .hook     = taas_nf_hook,
+    .pf       = NFPROTO_IPV4,
+    .hooknum  = NF_INET_LOCAL_IN,
+    .priority = NF_IP_PRI_FIRST,
+};
+
 /*
  * Module initialization:
  * - Map timer MMIO region
+ * - Allocate the anchor page
+ * - Claim the PPS GPIO and its interrupt (pps_gpio set only)
  * - Register misc device
+ * - Register the raw responder hook (responder=1 only)
  *
  * No background activity is started.
  */
 static int __init taas_init(void)
 {
+    int ret;
+
     timer_base = ioremap(BCM2837_ST_BASE, ST_SIZE);
     if (!timer_base)
         return -ENOMEM;
 
+    anchor_page = (struct taas_anchor_page *)get_zeroed_page(GFP_KERNEL);
+    if (!anchor_page) {
+        ret = -ENOMEM;
+        goto err_unmap;
+    }
+
+    if (pps_gpio >= 0) {
+        ret = pps_setup();
+        if (ret)
+            goto err_anchor;
+    }
+
     if (misc_register(&taas_misc)) {
-        iounmap(timer_base);
-        return -EBUSY;
+        ret = -EBUSY;
+        goto err_pps;
+    }
+
+    if (responder) {
+        ret = nf_register_net_hook(&init_net, &taas_nf_ops);
+        if (ret)
+            goto err_misc;
+        pr_info("taas: in-kernel raw responder enabled\n");
     }
 
     pr_info("taas: BCM2837 system timer driver loaded\n");
     return 0;
+
+err_misc:
+    misc_deregister(&taas_misc);
+err_pps:
+    pps_teardown();
+err_anchor:
+    free_page((unsigned long)anchor_page);
+err_unmap:
+    iounmap(timer_base);
+    return ret;
 }
 
 /*
  * Module teardown:
+ * - Unregister the responder hook
  * - Unregister device
+ * - Release the PPS interrupt and GPIO
+ * - Free the anchor page
  * - Unmap MMIO region
  */
 static void __exit taas_exit(void)
 {
+    if (responder)
+        nf_unregister_net_hook(&init_net, &taas_nf_ops);
     misc_deregister(&taas_misc);
+    pps_teardown();
+    free_page((unsigned long)anchor_page);
     iounmap(timer_base);
     pr_info("taas: driver unloaded\n");
 }
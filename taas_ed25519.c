@@ -0,0 +1,1119 @@
+/*
+ * TaaS Ed25519 - allocation-free signing for the TSA path
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Field elements mod p = 2^255 - 19 are five 51-bit limbs multiplied
+ * through the 64x64->128 multiplier (mul/umulh on ARMv8), the same
+ * representation the fast 64-bit implementations use. Points are in
+ * extended twisted Edwards coordinates; aB is computed with a signed
+ * radix-16 comb over 32 x 8 precomputed affine multiples of B, so a
+ * signature costs 64 mixed additions and 4 doublings. Scalars mod L
+ * use Barrett reduction on 64-bit limbs.
+ *
+ * Everything that touches the secret scalar or the nonce runs in
+ * constant time: table lookups scan every entry with masked moves and
+ * the reductions end in masked subtractions.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+
+#include "taas_ed25519.h"
+
+typedef unsigned __int128 u128;
+
+#define MASK51 ((1ULL << 51) - 1)
+
+/* ------------------------------------------------------------------ */
+/* SHA-512 (FIPS 180-4)                                                 */
+/* ------------------------------------------------------------------ */
+
+struct sha512 {
+    uint64_t h[8];
+    uint64_t len;
+    uint8_t buf[128];
+    size_t fill;
+};
+
+static const uint64_t sha512_k[80] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+    0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+    0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+    0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+    0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+    0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+    0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+static inline uint64_t ror64(uint64_t x, unsigned int n)
+{
+    return (x >> n) | (x << (64 - n));
+}
+
+static inline uint64_t load_be64(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, 8);
+    return __builtin_bswap64(v);
+}
+
+static inline uint64_t load_le64(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline void store_le64(uint8_t *p, uint64_t v)
+{
+    memcpy(p, &v, 8);
+}
+
+static void sha512_block(uint64_t h[8], const uint8_t *p)
+{
+    uint64_t w[80], a, b, c, d, e, f, g, hh;
+
+    for (int i = 0; i < 16; i++)
+        w[i] = load_be64(p + 8 * i);
+    for (int i = 16; i < 80; i++) {
+        uint64_t s0 = ror64(w[i - 15], 1) ^ ror64(w[i - 15], 8) ^ (w[i - 15] >> 7);
+        uint64_t s1 = ror64(w[i - 2], 19) ^ ror64(w[i - 2], 61) ^ (w[i - 2] >> 6);
+
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = h[0]; b = h[1]; c = h[2]; d = h[3];
+    e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+
+    for (int i = 0; i < 80; i++) {
+        uint64_t t1 = hh + (ror64(e, 14) ^ ror64(e, 18) ^ ror64(e, 41)) +
+                      ((e & f) ^ (~e & g)) + sha512_k[i] + w[i];
+        uint64_t t2 = (ror64(a, 28) ^ ror64(a, 34) ^ ror64(a, 39)) +
+                      ((a & b) ^ (a & c) ^ (b & c));
+
+        hh = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+}
+
+static void sha512_init(struct sha512 *s)
+{
+    static const uint64_t iv[8] = {
+        0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+        0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+    };
+
+    memcpy(s->h, iv, sizeof(iv));
+    s->len = 0;
+    s->fill = 0;
+}
+
+static void sha512_update(struct sha512 *s, const uint8_t *p, size_t n)
+{
+    s->len += n;
+
+    if (s->fill) {
+        size_t take = 128 - s->fill < n ? 128 - s->fill : n;
+
+        memcpy(s->buf + s->fill, p, take);
+        s->fill += take;
+        p += take;
+        n -= take;
+        if (s->fill < 128)
+            return;
+        sha512_block(s->h, s->buf);
+        s->fill = 0;
+    }
+    for (; n >= 128; p += 128, n -= 128)
+        sha512_block(s->h, p);
+    memcpy(s->buf, p, n);
+    s->fill = n;
+}
+
+static void sha512_final(struct sha512 *s, uint8_t out[64])
+{
+    uint64_t bits = s->len << 3;
+
+    s->buf[s->fill++] = 0x80;
+    if (s->fill > 112) {
+        memset(s->buf + s->fill, 0, 128 - s->fill);
+        sha512_block(s->h, s->buf);
+        s->fill = 0;
+    }
+    memset(s->buf + s->fill, 0, 120 - s->fill);
+    for (int i = 0; i < 8; i++)
+        s->buf[120 + i] = (uint8_t)(bits >> (56 - 8 * i));
+    sha512_block(s->h, s->buf);
+
+    for (int i = 0; i < 8; i++)
+        for (int j = 0; j < 8; j++)
+            out[8 * i + j] = (uint8_t)(s->h[i] >> (56 - 8 * j));
+}
+
+/* ------------------------------------------------------------------ */
+/* Field arithmetic mod 2^255 - 19                                      */
+/* ------------------------------------------------------------------ */
+
+typedef struct { uint64_t v[5]; } fe;
+
+static const uint8_t ed_d_bytes[32] = {
+    0xa3, 0x78, 0x59, 0x13, 0xca, 0x4d, 0xeb, 0x75, 0xab, 0xd8, 0x41, 0x41, 0x4d, 0x0a, 0x70, 0x00,
+    0x98, 0xe8, 0x79, 0x77, 0x79, 0x40, 0xc7, 0x8c, 0x73, 0xfe, 0x6f, 0x2b, 0xee, 0x6c, 0x03, 0x52,
+};
+
+static const uint8_t ed_bx_bytes[32] = {
+    0x1a, 0xd5, 0x25, 0x8f, 0x60, 0x2d, 0x56, 0xc9, 0xb2, 0xa7, 0x25, 0x95, 0x60, 0xc7, 0x2c, 0x69,
+    0x5c, 0xdc, 0xd6, 0xfd, 0x31, 0xe2, 0xa4, 0xc0, 0xfe, 0x53, 0x6e, 0xcd, 0xd3, 0x36, 0x69, 0x21,
+};
+
+static const uint8_t ed_sqrtm1_bytes[32] = {
+    0xb0, 0xa0, 0x0e, 0x4a, 0x27, 0x1b, 0xee, 0xc4, 0x78, 0xe4, 0x2f, 0xad, 0x06, 0x18, 0x43, 0x2f,
+    0xa7, 0xd7, 0xfb, 0x3d, 0x99, 0x00, 0x4d, 0x2b, 0x0b, 0xdf, 0xc1, 0x4f, 0x80, 0x24, 0x83, 0x2b,
+};
+
+static const uint8_t ed_by_bytes[32] = {
+    0x58, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+};
+
+static inline void fe_0(fe *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+static inline void fe_1(fe *h)
+{
+    fe_0(h);
+    h->v[0] = 1;
+}
+
+/* Bring every limb back under 2^51 (plus a tiny excess in v[1]) */
+static inline void fe_carry(fe *h)
+{
+    uint64_t c;
+
+    c = h->v[0] >> 51; h->v[0] &= MASK51; h->v[1] += c;
+    c = h->v[1] >> 51; h->v[1] &= MASK51; h->v[2] += c;
+    c = h->v[2] >> 51; h->v[2] &= MASK51; h->v[3] += c;
+    c = h->v[3] >> 51; h->v[3] &= MASK51; h->v[4] += c;
+    c = h->v[4] >> 51; h->v[4] &= MASK51; h->v[0] += 19 * c;
+    c = h->v[0] >> 51; h->v[0] &= MASK51; h->v[1] += c;
+}
+
+static inline void fe_add(fe *h, const fe *f, const fe *g)
+{
+    for (int i = 0; i < 5; i++)
+        h->v[i] = f->v[i] + g->v[i];
+    fe_carry(h);
+}
+
+/* f - g + 4p, so limbs never go negative */
+static inline void fe_sub(fe *h, const fe *f, const fe *g)
+{
+    h->v[0] = f->v[0] + 0x1fffffffffffb4ULL - g->v[0];
+    for (int i = 1; i < 5; i++)
+        h->v[i] = f->v[i] + 0x1ffffffffffffcULL - g->v[i];
+    fe_carry(h);
+}
+
+static inline void fe_neg(fe *h, const fe *f)
+{
+    fe z;
+
+    fe_0(&z);
+    fe_sub(h, &z, f);
+}
+
+static inline void fe_reduce128(fe *h, u128 r0, u128 r1, u128 r2, u128 r3, u128 r4)
+{
+    uint64_t c;
+
+    r1 += (uint64_t)(r0 >> 51); h->v[0] = (uint64_t)r0 & MASK51;
+    r2 += (uint64_t)(r1 >> 51); h->v[1] = (uint64_t)r1 & MASK51;
+    r3 += (uint64_t)(r2 >> 51); h->v[2] = (uint64_t)r2 & MASK51;
+    r4 += (uint64_t)(r3 >> 51); h->v[3] = (uint64_t)r3 & MASK51;
+    c = (uint64_t)(r4 >> 51);   h->v[4] = (uint64_t)r4 & MASK51;
+    h->v[0] += 19 * c;
+    h->v[1] += h->v[0] >> 51;
+    h->v[0] &= MASK51;
+}
+
+static void fe_mul(fe *h, const fe *f, const fe *g)
+{
+    const uint64_t f0 = f->v[0], f1 = f->v[1], f2 = f->v[2], f3 = f->v[3], f4 = f->v[4];
+    const uint64_t g0 = g->v[0], g1 = g->v[1], g2 = g->v[2], g3 = g->v[3], g4 = g->v[4];
+    const uint64_t g1_19 = 19 * g1, g2_19 = 19 * g2, g3_19 = 19 * g3, g4_19 = 19 * g4;
+
+    fe_reduce128(h,
+        (u128)f0 * g0 + (u128)f1 * g4_19 + (u128)f2 * g3_19 + (u128)f3 * g2_19 + (u128)f4 * g1_19,
+        (u128)f0 * g1 + (u128)f1 * g0 + (u128)f2 * g4_19 + (u128)f3 * g3_19 + (u128)f4 * g2_19,
+        (u128)f0 * g2 + (u128)f1 * g1 + (u128)f2 * g0 + (u128)f3 * g4_19 + (u128)f4 * g3_19,
+        (u128)f0 * g3 + (u128)f1 * g2 + (u128)f2 * g1 + (u128)f3 * g0 + (u128)f4 * g4_19,
+        (u128)f0 * g4 + (u128)f1 * g3 + (u128)f2 * g2 + (u128)f3 * g1 + (u128)f4 * g0);
+}
+
+static void fe_sq(fe *h, const fe *f)
+{
+    const uint64_t f0 = f->v[0], f1 = f->v[1], f2 = f->v[2], f3 = f->v[3], f4 = f->v[4];
+    const uint64_t f0_2 = 2 * f0, f1_2 = 2 * f1;
+    const uint64_t f1_38 = 38 * f1, f2_38 = 38 * f2, f3_38 = 38 * f3;
+    const uint64_t f3_19 = 19 * f3, f4_19 = 19 * f4;
+
+    fe_reduce128(h,
+        (u128)f0 * f0 + (u128)f1_38 * f4 + (u128)f2_38 * f3,
+        (u128)f0_2 * f1 + (u128)f2_38 * f4 + (u128)f3_19 * f3,
+        (u128)f0_2 * f2 + (u128)f1 * f1 + (u128)f3_38 * f4,
+        (u128)f0_2 * f3 + (u128)f1_2 * f2 + (u128)f4_19 * f4,
+        (u128)f0_2 * f4 + (u128)f1_2 * f3 + (u128)f2 * f2);
+}
+
+static void fe_sq_n(fe *h, const fe *f, int n)
+{
+    fe_sq(h, f);
+    while (--n > 0)
+        fe_sq(h, h);
+}
+
+/* z^(p-2) = 1/z, the addition chain of the reference implementation */
+static void fe_invert(fe *out, const fe *z)
+{
+    fe t0, t1, t2, t3;
+
+    fe_sq(&t0, z);                  /* 2 */
+    fe_sq_n(&t1, &t0, 2);           /* 8 */
+    fe_mul(&t1, z, &t1);            /* 9 */
+    fe_mul(&t0, &t0, &t1);          /* 11 */
+    fe_sq(&t2, &t0);                /* 22 */
+    fe_mul(&t1, &t1, &t2);          /* 2^5 - 1 */
+    fe_sq_n(&t2, &t1, 5);
+    fe_mul(&t1, &t2, &t1);          /* 2^10 - 1 */
+    fe_sq_n(&t2, &t1, 10);
+    fe_mul(&t2, &t2, &t1);          /* 2^20 - 1 */
+    fe_sq_n(&t3, &t2, 20);
+    fe_mul(&t2, &t3, &t2);          /* 2^40 - 1 */
+    fe_sq_n(&t2, &t2, 10);
+    fe_mul(&t1, &t2, &t1);          /* 2^50 - 1 */
+    fe_sq_n(&t2, &t1, 50);
+    fe_mul(&t2, &t2, &t1);          /* 2^100 - 1 */
+    fe_sq_n(&t3, &t2, 100);
+    fe_mul(&t2, &t3, &t2);          /* 2^200 - 1 */
+    fe_sq_n(&t2, &t2, 50);
+    fe_mul(&t1, &t2, &t1);          /* 2^250 - 1 */
+    fe_sq_n(&t1, &t1, 5);           /* 2^255 - 2^5 */
+    fe_mul(out, &t1, &t0);          /* 2^255 - 21 */
+}
+
+/* z^((p-5)/8) = z^(2^252 - 3), for the square root in decompression */
+static void fe_pow22523(fe *out, const fe *z)
+{
+    fe t0, t1, t2;
+
+    fe_sq(&t0, z);                  /* 2 */
+    fe_sq_n(&t1, &t0, 2);           /* 8 */
+    fe_mul(&t1, z, &t1);            /* 9 */
+    fe_mul(&t0, &t0, &t1);          /* 11 */
+    fe_sq(&t0, &t0);                /* 22 */
+    fe_mul(&t0, &t1, &t0);          /* 2^5 - 1 */
+    fe_sq_n(&t1, &t0, 5);
+    fe_mul(&t0, &t1, &t0);          /* 2^10 - 1 */
+    fe_sq_n(&t1, &t0, 10);
+    fe_mul(&t1, &t1, &t0);          /* 2^20 - 1 */
+    fe_sq_n(&t2, &t1, 20);
+    fe_mul(&t1, &t2, &t1);          /* 2^40 - 1 */
+    fe_sq_n(&t1, &t1, 10);
+    fe_mul(&t0, &t1, &t0);          /* 2^50 - 1 */
+    fe_sq_n(&t1, &t0, 50);
+    fe_mul(&t1, &t1, &t0);          /* 2^100 - 1 */
+    fe_sq_n(&t2, &t1, 100);
+    fe_mul(&t1, &t2, &t1);          /* 2^200 - 1 */
+    fe_sq_n(&t1, &t1, 50);
+    fe_mul(&t0, &t1, &t0);          /* 2^250 - 1 */
+    fe_sq_n(&t0, &t0, 2);           /* 2^252 - 4 */
+    fe_mul(out, &t0, z);            /* 2^252 - 3 */
+}
+
+static void fe_frombytes(fe *h, const uint8_t s[32])
+{
+    uint64_t w0 = load_le64(s), w1 = load_le64(s + 8), w2 = load_le64(s + 16), w3 = load_le64(s + 24);
+
+    h->v[0] = w0 & MASK51;
+    h->v[1] = ((w0 >> 51) | (w1 << 13)) & MASK51;
+    h->v[2] = ((w1 >> 38) | (w2 << 26)) & MASK51;
+    h->v[3] = ((w2 >> 25) | (w3 << 39)) & MASK51;
+    h->v[4] = (w3 >> 12) & MASK51;
+}
+
+static inline void fe_carry_full(uint64_t t[5])
+{
+    for (int i = 0; i < 4; i++) {
+        t[i + 1] += t[i] >> 51;
+        t[i] &= MASK51;
+    }
+    t[0] += 19 * (t[4] >> 51);
+    t[4] &= MASK51;
+}
+
+/* Canonical little-endian encoding, fully reduced mod p */
+static void fe_tobytes(uint8_t s[32], const fe *f)
+{
+    uint64_t t[5];
+
+    memcpy(t, f->v, sizeof(t));
+    fe_carry_full(t);
+    fe_carry_full(t);
+    fe_carry_full(t);
+
+    /* t < 2^255 now; add 19 so that t >= p shows up as a carry out of
+     * bit 255, then add 2^255 - 19 back limbwise and drop that bit.
+     */
+    t[0] += 19;
+    fe_carry_full(t);
+    t[0] += (1ULL << 51) - 19;
+    for (int i = 1; i < 5; i++)
+        t[i] += (1ULL << 51) - 1;
+    for (int i = 0; i < 4; i++) {
+        t[i + 1] += t[i] >> 51;
+        t[i] &= MASK51;
+    }
+    t[4] &= MASK51;
+
+    store_le64(s,      t[0] | (t[1] << 51));
+    store_le64(s + 8,  (t[1] >> 13) | (t[2] << 38));
+    store_le64(s + 16, (t[2] >> 26) | (t[3] << 25));
+    store_le64(s + 24, (t[3] >> 39) | (t[4] << 12));
+}
+
+static inline void fe_cmov(fe *f, const fe *g, uint64_t b)
+{
+    uint64_t mask = 0 - b;
+
+    for (int i = 0; i < 5; i++)
+        f->v[i] ^= mask & (f->v[i] ^ g->v[i]);
+}
+
+/* Verification only: neither of these is constant time */
+static int fe_iszero(const fe *f)
+{
+    static const uint8_t zero[32];
+    uint8_t s[32];
+
+    fe_tobytes(s, f);
+    return !memcmp(s, zero, sizeof(s));
+}
+
+static int fe_isnegative(const fe *f)
+{
+    uint8_t s[32];
+
+    fe_tobytes(s, f);
+    return s[0] & 1;
+}
+
+/* ------------------------------------------------------------------ */
+/* Edwards group: -x^2 + y^2 = 1 + d x^2 y^2                           */
+/* ------------------------------------------------------------------ */
+
+typedef struct { fe X, Y, Z, T; } ge_p3;             /* x = X/Z, y = Y/Z, xy = T/Z */
+typedef struct { fe yplusx, yminusx, xy2d; } ge_precomp;
+typedef struct { fe yplusx, yminusx, Z, T2d; } ge_cached;  /* for repeated additions */
+
+static fe ed_d, ed_d2, ed_sqrtm1;                    /* d, 2d, sqrt(-1) */
+static ge_precomp base_table[32][8];                 /* (j + 1) * 256^i * B */
+static pthread_once_t base_once = PTHREAD_ONCE_INIT;
+
+static void ge_p3_0(ge_p3 *h)
+{
+    fe_0(&h->X);
+    fe_1(&h->Y);
+    fe_1(&h->Z);
+    fe_0(&h->T);
+}
+
+/* h = p + q, q affine (add-2008-hwcd-3, complete for a = -1) */
+static void ge_madd(ge_p3 *h, const ge_p3 *p, const ge_precomp *q)
+{
+    fe a, b, c, d, e, f, g, hh;
+
+    fe_sub(&a, &p->Y, &p->X);
+    fe_mul(&a, &a, &q->yminusx);
+    fe_add(&b, &p->Y, &p->X);
+    fe_mul(&b, &b, &q->yplusx);
+    fe_mul(&c, &p->T, &q->xy2d);
+    fe_add(&d, &p->Z, &p->Z);
+    fe_sub(&e, &b, &a);
+    fe_sub(&f, &d, &c);
+    fe_add(&g, &d, &c);
+    fe_add(&hh, &b, &a);
+    fe_mul(&h->X, &e, &f);
+    fe_mul(&h->Y, &g, &hh);
+    fe_mul(&h->T, &e, &hh);
+    fe_mul(&h->Z, &f, &g);
+}
+
+/* h = p + q, both projective (table construction only) */
+static void ge_add(ge_p3 *h, const ge_p3 *p, const ge_p3 *q)
+{
+    fe a, b, c, d, e, f, g, hh, t;
+
+    fe_sub(&a, &p->Y, &p->X);
+    fe_sub(&t, &q->Y, &q->X);
+    fe_mul(&a, &a, &t);
+    fe_add(&b, &p->Y, &p->X);
+    fe_add(&t, &q->Y, &q->X);
+    fe_mul(&b, &b, &t);
+    fe_mul(&c, &p->T, &q->T);
+    fe_mul(&c, &c, &ed_d2);
+    fe_mul(&d, &p->Z, &q->Z);
+    fe_add(&d, &d, &d);
+    fe_sub(&e, &b, &a);
+    fe_sub(&f, &d, &c);
+    fe_add(&g, &d, &c);
+    fe_add(&hh, &b, &a);
+    fe_mul(&h->X, &e, &f);
+    fe_mul(&h->Y, &g, &hh);
+    fe_mul(&h->T, &e, &hh);
+    fe_mul(&h->Z, &f, &g);
+}
+
+/* h = 2p (dbl-2008-hwcd, a = -1) */
+static void ge_dbl(ge_p3 *h, const ge_p3 *p)
+{
+    fe a, b, c, e, f, g, hh;
+
+    fe_sq(&a, &p->X);
+    fe_sq(&b, &p->Y);
+    fe_sq(&c, &p->Z);
+    fe_add(&c, &c, &c);
+    fe_add(&e, &p->X, &p->Y);
+    fe_sq(&e, &e);
+    fe_sub(&e, &e, &a);
+    fe_sub(&e, &e, &b);
+    fe_sub(&g, &b, &a);             /* D + B, D = aA = -A */
+    fe_sub(&f, &g, &c);
+    fe_add(&hh, &a, &b);
+    fe_neg(&hh, &hh);               /* D - B */
+    fe_mul(&h->X, &e, &f);
+    fe_mul(&h->Y, &g, &hh);
+    fe_mul(&h->T, &e, &hh);
+    fe_mul(&h->Z, &f, &g);
+}
+
+static void ge_to_cached(ge_cached *r, const ge_p3 *p)
+{
+    fe_add(&r->yplusx, &p->Y, &p->X);
+    fe_sub(&r->yminusx, &p->Y, &p->X);
+    r->Z = p->Z;
+    fe_mul(&r->T2d, &p->T, &ed_d2);
+}
+
+/* h = p + q, or p - q with neg: -(x, y) swaps y+x and y-x and negates 2dT */
+static void ge_add_cached(ge_p3 *h, const ge_p3 *p, const ge_cached *q, int neg)
+{
+    fe a, b, c, d, e, f, g, hh, t;
+
+    fe_sub(&a, &p->Y, &p->X);
+    fe_mul(&a, &a, neg ? &q->yplusx : &q->yminusx);
+    fe_add(&b, &p->Y, &p->X);
+    fe_mul(&b, &b, neg ? &q->yminusx : &q->yplusx);
+    fe_mul(&c, &p->T, &q->T2d);
+    fe_mul(&t, &p->Z, &q->Z);
+    fe_add(&d, &t, &t);
+    fe_sub(&e, &b, &a);
+    if (neg) {
+        fe_add(&f, &d, &c);
+        fe_sub(&g, &d, &c);
+    } else {
+        fe_sub(&f, &d, &c);
+        fe_add(&g, &d, &c);
+    }
+    fe_add(&hh, &b, &a);
+    fe_mul(&h->X, &e, &f);
+    fe_mul(&h->Y, &g, &hh);
+    fe_mul(&h->T, &e, &hh);
+    fe_mul(&h->Z, &f, &g);
+}
+
+static void ge_to_precomp(ge_precomp *r, const ge_p3 *p)
+{
+    fe zi, x, y;
+
+    fe_invert(&zi, &p->Z);
+    fe_mul(&x, &p->X, &zi);
+    fe_mul(&y, &p->Y, &zi);
+    fe_add(&r->yplusx, &y, &x);
+    fe_sub(&r->yminusx, &y, &x);
+    fe_mul(&r->xy2d, &x, &y);
+    fe_mul(&r->xy2d, &r->xy2d, &ed_d2);
+}
+
+static void ge_tobytes(uint8_t s[32], const ge_p3 *p)
+{
+    uint8_t xb[32];
+    fe zi, x, y;
+
+    fe_invert(&zi, &p->Z);
+    fe_mul(&x, &p->X, &zi);
+    fe_mul(&y, &p->Y, &zi);
+    fe_tobytes(s, &y);
+    fe_tobytes(xb, &x);
+    s[31] ^= (uint8_t)((xb[0] & 1) << 7);
+}
+
+/*
+ * ge_frombytes - Decode a point (RFC 8032, 5.1.3). Fails on y >= p, on
+ * points off the curve and on the negative encoding of x = 0. Only ever
+ * sees public data, so it is not constant time.
+ */
+static int ge_frombytes(ge_p3 *h, const uint8_t s[32])
+{
+    uint8_t y[32], canon[32];
+    int sign = s[31] >> 7;
+    fe u, v, v3, vxx, t;
+
+    memcpy(y, s, sizeof(y));
+    y[31] &= 127;
+    fe_frombytes(&h->Y, y);
+    fe_tobytes(canon, &h->Y);
+    if (memcmp(canon, y, sizeof(y)))
+        return -1;
+
+    fe_1(&h->Z);
+    fe_sq(&u, &h->Y);
+    fe_mul(&v, &u, &ed_d);
+    fe_sub(&u, &u, &h->Z);          /* u = y^2 - 1 */
+    fe_add(&v, &v, &h->Z);          /* v = dy^2 + 1 */
+
+    /* x = uv^3 (uv^7)^((p-5)/8) */
+    fe_sq(&v3, &v);
+    fe_mul(&v3, &v3, &v);
+    fe_sq(&h->X, &v3);
+    fe_mul(&h->X, &h->X, &v);
+    fe_mul(&h->X, &h->X, &u);
+    fe_pow22523(&h->X, &h->X);
+    fe_mul(&h->X, &h->X, &v3);
+    fe_mul(&h->X, &h->X, &u);
+
+    /* vx^2 is u, or -u when x still needs a factor sqrt(-1) */
+    fe_sq(&vxx, &h->X);
+    fe_mul(&vxx, &vxx, &v);
+    fe_sub(&t, &vxx, &u);
+    if (!fe_iszero(&t)) {
+        fe_add(&t, &vxx, &u);
+        if (!fe_iszero(&t))
+            return -1;
+        fe_mul(&h->X, &h->X, &ed_sqrtm1);
+    }
+
+    if (sign && fe_iszero(&h->X))
+        return -1;
+    if (fe_isnegative(&h->X) != sign)
+        fe_neg(&h->X, &h->X);
+    fe_mul(&h->T, &h->X, &h->Y);
+    return 0;
+}
+
+static int ge_is_identity(const ge_p3 *p)
+{
+    fe t;
+
+    fe_sub(&t, &p->Y, &p->Z);
+    return fe_iszero(&p->X) && fe_iszero(&t);
+}
+
+static void base_init(void)
+{
+    ge_p3 base, m;
+
+    fe_frombytes(&ed_d, ed_d_bytes);
+    fe_add(&ed_d2, &ed_d, &ed_d);
+    fe_frombytes(&ed_sqrtm1, ed_sqrtm1_bytes);
+
+    fe_frombytes(&base.X, ed_bx_bytes);
+    fe_frombytes(&base.Y, ed_by_bytes);
+    fe_1(&base.Z);
+    fe_mul(&base.T, &base.X, &base.Y);
+
+    for (int i = 0; i < 32; i++) {
+        m = base;
+        for (int j = 0; j < 8; j++) {
+            ge_to_precomp(&base_table[i][j], &m);
+            ge_add(&m, &m, &base);
+        }
+        for (int k = 0; k < 8; k++)
+            ge_dbl(&base, &base);
+    }
+}
+
+static inline uint64_t ct_equal(uint32_t a, uint32_t b)
+{
+    return (uint64_t)(((a ^ b) - 1U) >> 31);
+}
+
+/* t = b * 256^pos * B for b in [-8, 8], scanning all 8 entries */
+static void select_precomp(ge_precomp *t, int pos, int8_t b)
+{
+    int32_t m = (int32_t)b >> 31;
+    uint64_t neg = (uint64_t)(m & 1);
+    uint32_t babs = (uint32_t)((b ^ m) - m);
+    ge_precomp minus;
+
+    fe_1(&t->yplusx);
+    fe_1(&t->yminusx);
+    fe_0(&t->xy2d);
+    for (int j = 0; j < 8; j++) {
+        uint64_t eq = ct_equal(babs, (uint32_t)j + 1);
+
+        fe_cmov(&t->yplusx, &base_table[pos][j].yplusx, eq);
+        fe_cmov(&t->yminusx, &base_table[pos][j].yminusx, eq);
+        fe_cmov(&t->xy2d, &base_table[pos][j].xy2d, eq);
+    }
+
+    /* -(x, y) = (-x, y): swap y+x with y-x and negate xy */
+    minus.yplusx = t->yminusx;
+    minus.yminusx = t->yplusx;
+    fe_neg(&minus.xy2d, &t->xy2d);
+    fe_cmov(&t->yplusx, &minus.yplusx, neg);
+    fe_cmov(&t->yminusx, &minus.yminusx, neg);
+    fe_cmov(&t->xy2d, &minus.xy2d, neg);
+}
+
+/* a < 2^255 as 64 signed radix-16 digits, each in [-8, 8) but the last */
+static void sc_digits(int8_t e[64], const uint8_t a[32])
+{
+    int8_t carry = 0;
+
+    for (int i = 0; i < 32; i++) {
+        e[2 * i]     = (int8_t)(a[i] & 15);
+        e[2 * i + 1] = (int8_t)(a[i] >> 4);
+    }
+    for (int i = 0; i < 63; i++) {
+        e[i] = (int8_t)(e[i] + carry);
+        carry = (int8_t)((e[i] + 8) >> 4);
+        e[i] = (int8_t)(e[i] - (carry << 4));
+    }
+    e[63] = (int8_t)(e[63] + carry);
+}
+
+/* h = aB, a < 2^255 as 32 little-endian bytes */
+static void ge_scalarmult_base(ge_p3 *h, const uint8_t a[32])
+{
+    int8_t e[64];
+    ge_precomp t;
+
+    sc_digits(e, a);
+    ge_p3_0(h);
+    for (int i = 1; i < 64; i += 2) {
+        select_precomp(&t, i / 2, e[i]);
+        ge_madd(h, h, &t);
+    }
+    for (int i = 0; i < 4; i++)
+        ge_dbl(h, h);
+    for (int i = 0; i < 64; i += 2) {
+        select_precomp(&t, i / 2, e[i]);
+        ge_madd(h, h, &t);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Scalars mod L = 2^252 + 27742317777372353535851937790883648493       */
+/* ------------------------------------------------------------------ */
+
+static const uint64_t sc_l[4] = {
+    0x5812631a5cf5d3edULL, 0x14def9dea2f79cd6ULL, 0x0000000000000000ULL, 0x1000000000000000ULL,
+};
+
+/* floor(2^512 / L), the Barrett constant */
+static const uint64_t sc_mu[5] = {
+    0xed9ce5a30a2c131bULL, 0x2106215d086329a7ULL, 0xffffffffffffffebULL, 0xffffffffffffffffULL,
+    0x000000000000000fULL,
+};
+
+static void mp_mul(uint64_t *out, const uint64_t *a, int na, const uint64_t *b, int nb)
+{
+    memset(out, 0, (size_t)(na + nb) * sizeof(*out));
+    for (int i = 0; i < na; i++) {
+        uint64_t carry = 0;
+
+        for (int j = 0; j < nb; j++) {
+            u128 t = (u128)a[i] * b[j] + out[i + j] + carry;
+
+            out[i + j] = (uint64_t)t;
+            carry = (uint64_t)(t >> 64);
+        }
+        out[i + nb] = carry;
+    }
+}
+
+/*
+ * sc_reduce - out = x mod L for x < 2^512 (HAC 14.42 with b = 2^64,
+ * k = 4). The estimate leaves r < 3L; two masked subtractions finish.
+ */
+static void sc_reduce(uint8_t out[32], const uint64_t x[8])
+{
+    uint64_t q2[10], p[9], r[5], t[5];
+    uint64_t borrow = 0;
+
+    mp_mul(q2, x + 3, 5, sc_mu, 5);             /* q1 * mu, q1 = x >> 192 */
+    mp_mul(p, q2 + 5, 5, sc_l, 4);              /* q3 * L, q3 = q2 >> 320 */
+
+    for (int i = 0; i < 5; i++) {               /* r = (x - q3 L) mod 2^320 */
+        u128 d = (u128)x[i] - p[i] - borrow;
+
+        r[i] = (uint64_t)d;
+        borrow = (uint64_t)(d >> 64) & 1;
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        uint64_t mask;
+
+        borrow = 0;
+        for (int i = 0; i < 5; i++) {
+            u128 d = (u128)r[i] - (i < 4 ? sc_l[i] : 0) - borrow;
+
+            t[i] = (uint64_t)d;
+            borrow = (uint64_t)(d >> 64) & 1;
+        }
+        mask = borrow - 1;                      /* all ones: r >= L */
+        for (int i = 0; i < 5; i++)
+            r[i] ^= mask & (r[i] ^ t[i]);
+    }
+
+    for (int i = 0; i < 4; i++)
+        store_le64(out + 8 * i, r[i]);
+}
+
+static void sc_reduce64(uint8_t out[32], const uint8_t in[64])
+{
+    uint64_t x[8];
+
+    for (int i = 0; i < 8; i++)
+        x[i] = load_le64(in + 8 * i);
+    sc_reduce(out, x);
+}
+
+/* s = (a * b + c) mod L */
+static void sc_muladd(uint8_t s[32], const uint8_t a[32], const uint8_t b[32], const uint8_t c[32])
+{
+    uint64_t al[4], bl[4], x[8], carry = 0;
+
+    for (int i = 0; i < 4; i++) {
+        al[i] = load_le64(a + 8 * i);
+        bl[i] = load_le64(b + 8 * i);
+    }
+    mp_mul(x, al, 4, bl, 4);
+    for (int i = 0; i < 8; i++) {
+        u128 t = (u128)x[i] + (i < 4 ? load_le64(c + 8 * i) : 0) + carry;
+
+        x[i] = (uint64_t)t;
+        carry = (uint64_t)(t >> 64);
+    }
+    sc_reduce(s, x);
+}
+
+/* s < L, which RFC 8032 requires of the S half of a signature */
+static int sc_is_canonical(const uint8_t s[32])
+{
+    for (int i = 3; i >= 0; i--) {
+        uint64_t w = load_le64(s + 8 * i);
+
+        if (w != sc_l[i])
+            return w < sc_l[i];
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+
+void taas_ed25519_expand(struct taas_ed25519_key *k, const uint8_t seed[TAAS_ED25519_SEED_LEN])
+{
+    struct sha512 h;
+    uint8_t digest[64];
+    ge_p3 A;
+
+    pthread_once(&base_once, base_init);
+
+    sha512_init(&h);
+    sha512_update(&h, seed, TAAS_ED25519_SEED_LEN);
+    sha512_final(&h, digest);
+
+    memcpy(k->scalar, digest, 32);
+    k->scalar[0]  &= 248;
+    k->scalar[31] &= 127;
+    k->scalar[31] |= 64;
+    memcpy(k->prefix, digest + 32, 32);
+
+    ge_scalarmult_base(&A, k->scalar);
+    ge_tobytes(k->pub, &A);
+
+    explicit_bzero(digest, sizeof(digest));
+    explicit_bzero(&h, sizeof(h));
+}
+
+void taas_ed25519_sign(uint8_t sig[TAAS_ED25519_SIG_LEN], const struct taas_ed25519_key *k,
+                       const uint8_t *msg, size_t len)
+{
+    struct sha512 h;
+    uint8_t digest[64], r[32], hram[32];
+    ge_p3 R;
+
+    /* r = H(prefix || M), R = rB */
+    sha512_init(&h);
+    sha512_update(&h, k->prefix, 32);
+    sha512_update(&h, msg, len);
+    sha512_final(&h, digest);
+    sc_reduce64(r, digest);
+
+    ge_scalarmult_base(&R, r);
+    ge_tobytes(sig, &R);
+
+    /* S = (H(R || A || M) * a + r) mod L */
+    sha512_init(&h);
+    sha512_update(&h, sig, 32);
+    sha512_update(&h, k->pub, 32);
+    sha512_update(&h, msg, len);
+    sha512_final(&h, digest);
+    sc_reduce64(hram, digest);
+
+    sc_muladd(sig + 32, hram, k->scalar, r);
+
+    /* The nonce gives the key away */
+    explicit_bzero(r, sizeof(r));
+    explicit_bzero(digest, sizeof(digest));
+    explicit_bzero(&h, sizeof(h));
+}
+
+/* ------------------------------------------------------------------ */
+/* Batch verification                                                   */
+/* ------------------------------------------------------------------ */
+
+/*
+ * Every signature has to satisfy the cofactored equation
+ *
+ *   8(S_i B - R_i - h_i A) = 0,  h_i = H(R_i || A || M_i) mod L
+ *
+ * so a random combination with 128-bit weights z_i,
+ *
+ *   8((sum z_i S_i) B - sum z_i R_i - (sum z_i h_i) A) = 0,
+ *
+ * holds for a whole chunk at once and fails, except with probability
+ * 2^-128, as soon as one member fails. All signatures share A, so the
+ * chunk costs one fixed-base multiplication, one 253-bit multiple of A
+ * and a 128-bit multiple of each R_i, evaluated together (Straus) with
+ * one shared chain of doublings. A failed chunk is split in halves
+ * until the bad signatures are isolated, reusing the decoded points.
+ *
+ * The cofactored form makes the result independent of how signatures
+ * are grouped: a single signature gets the same verdict here as inside
+ * any batch. It can differ from OpenSSL's cofactorless check, but only
+ * for R_i with a small-order component, which no honest signer produces.
+ */
+
+#define VERIFY_CHUNK 64
+
+/* 1P .. 8P, for signed radix-16 digits */
+struct ge_table {
+    ge_cached p[8];
+};
+
+struct verify_ws {
+    struct ge_table a;                      /* A, shared by every chunk */
+    struct ge_table r[VERIFY_CHUNK];
+    int8_t e[VERIFY_CHUNK][64];             /* digits of z_i */
+    uint8_t z[VERIFY_CHUNK][32];            /* 128-bit weights, zero-extended */
+    uint8_t s[VERIFY_CHUNK][32];            /* S_i */
+    uint8_t h[VERIFY_CHUNK][32];            /* h_i */
+    size_t idx[VERIFY_CHUNK];               /* position in the caller's arrays */
+};
+
+/* getrandom() may return short for requests above 256 bytes */
+static int fill_random(void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    while (len) {
+        ssize_t r = getrandom(p, len, 0);
+
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += r;
+        len -= (size_t)r;
+    }
+    return 0;
+}
+
+static void ge_table_init(struct ge_table *t, const ge_p3 *p)
+{
+    ge_p3 q;
+
+    ge_to_cached(&t->p[0], p);
+    ge_dbl(&q, p);
+    ge_to_cached(&t->p[1], &q);
+    for (int j = 2; j < 8; j++) {
+        ge_add_cached(&q, &q, &t->p[0], 0);
+        ge_to_cached(&t->p[j], &q);
+    }
+}
+
+static inline void ge_add_digit(ge_p3 *h, const struct ge_table *t, int8_t d)
+{
+    if (d > 0)
+        ge_add_cached(h, h, &t->p[d - 1], 0);
+    else if (d < 0)
+        ge_add_cached(h, h, &t->p[-d - 1], 1);
+}
+
+/* The combined equation over members [lo, hi) of the chunk */
+static int verify_range(const struct verify_ws *ws, unsigned int lo, unsigned int hi)
+{
+    uint8_t zs[32] = { 0 }, zh[32] = { 0 };
+    int8_t eh[64];
+    ge_p3 acc, sb;
+
+    for (unsigned int k = lo; k < hi; k++) {
+        sc_muladd(zs, ws->z[k], ws->s[k], zs);
+        sc_muladd(zh, ws->z[k], ws->h[k], zh);
+    }
+    sc_digits(eh, zh);
+
+    /* acc = (sum z_i h_i) A + sum z_i R_i; z_i < 2^128 has 33 digits */
+    ge_p3_0(&acc);
+    for (int i = 63; i >= 0; i--) {
+        for (int j = 0; j < 4; j++)
+            ge_dbl(&acc, &acc);
+        ge_add_digit(&acc, &ws->a, eh[i]);
+        if (i > 32)
+            continue;
+        for (unsigned int k = lo; k < hi; k++)
+            ge_add_digit(&acc, &ws->r[k], ws->e[k][i]);
+    }
+
+    fe_neg(&acc.X, &acc.X);
+    fe_neg(&acc.T, &acc.T);
+    ge_scalarmult_base(&sb, zs);
+    ge_add(&acc, &sb, &acc);
+    for (int j = 0; j < 3; j++)
+        ge_dbl(&acc, &acc);
+    return ge_is_identity(&acc);
+}
+
+static void verify_split(const struct verify_ws *ws, unsigned int lo, unsigned int hi,
+                         uint8_t *valid)
+{
+    unsigned int mid;
+
+    if (verify_range(ws, lo, hi)) {
+        for (unsigned int k = lo; k < hi; k++)
+            valid[ws->idx[k]] = 1;
+        return;
+    }
+    if (hi - lo == 1)
+        return;
+
+    mid = lo + (hi - lo) / 2;
+    verify_split(ws, lo, mid, valid);
+    verify_split(ws, mid, hi, valid);
+}
+
+long taas_ed25519_verify_batch(const uint8_t pub[32], const struct taas_ed25519_item *items,
+                               size_t n, uint8_t *valid)
+{
+    struct verify_ws *ws;
+    long good = 0;
+    ge_p3 A, A8;
+
+    pthread_once(&base_once, base_init);
+
+    /* A small-order key would satisfy the equation for any message */
+    if (ge_frombytes(&A, pub) < 0)
+        goto invalid;
+    ge_dbl(&A8, &A);
+    ge_dbl(&A8, &A8);
+    ge_dbl(&A8, &A8);
+    if (ge_is_identity(&A8))
+        goto invalid;
+
+    ws = malloc(sizeof(*ws));
+    if (!ws)
+        return -1;
+    ge_table_init(&ws->a, &A);
+
+    memset(valid, 0, n);
+    for (size_t base = 0; base < n; base += VERIFY_CHUNK) {
+        size_t end = n - base < VERIFY_CHUNK ? n : base + VERIFY_CHUNK;
+        unsigned int m = 0;
+
+        if (fill_random(ws->z, sizeof(ws->z)) < 0) {
+            free(ws);
+            return -1;
+        }
+
+        for (size_t i = base; i < end; i++) {
+            const uint8_t *sig = items[i].sig;
+            struct sha512 hs;
+            uint8_t digest[64];
+            ge_p3 R;
+
+            if (!sc_is_canonical(sig + 32) || ge_frombytes(&R, sig) < 0)
+                continue;
+
+            sha512_init(&hs);
+            sha512_update(&hs, sig, 32);
+            sha512_update(&hs, pub, 32);
+            sha512_update(&hs, items[i].msg, items[i].len);
+            sha512_final(&hs, digest);
+            sc_reduce64(ws->h[m], digest);
+
+            memcpy(ws->s[m], sig + 32, 32);
+            memset(ws->z[m] + 16, 0, 16);
+            sc_digits(ws->e[m], ws->z[m]);
+            ge_table_init(&ws->r[m], &R);
+            ws->idx[m++] = i;
+        }
+        if (m)
+            verify_split(ws, 0, m, valid);
+    }
+    free(ws);
+
+    for (size_t i = 0; i < n; i++)
+        good += valid[i];
+    return good;
+
+invalid:
+    errno = EINVAL;
+    return -1;
+}
+
+int taas_ed25519_verify(const uint8_t pub[32], const uint8_t *msg, size_t len,
+                        const uint8_t sig[TAAS_ED25519_SIG_LEN])
+{
+    struct taas_ed25519_item item = { .msg = msg, .len = len, .sig = sig };
+    uint8_t valid;
+
+    if (taas_ed25519_verify_batch(pub, &item, 1, &valid) < 0)
+        return -1;
+    return valid;
+}
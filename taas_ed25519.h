@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: GPL-2.0
+ *
+ * TaaS Ed25519 signer
+ *
+ * RFC 8032 Ed25519 signing for the TSA hot path. The private key is
+ * expanded once at startup (clamped scalar, nonce prefix, encoded
+ * public key) and the fixed-base table of multiples of the base point
+ * is built once per process. A signature then runs entirely on the
+ * caller's stack: no allocation, no locks, and no per-call re-derivation
+ * of key state as EVP_DigestSignInit() does.
+ *
+ * Signatures are byte-for-byte identical to OpenSSL's (Ed25519 is
+ * deterministic), so certificates verify exactly as before.
+ *
+ * The verifying side, for clients and auditors, checks many
+ * signatures by one key at a time; see taas_ed25519_verify_batch().
+ */
+#ifndef TAAS_ED25519_H
+#define TAAS_ED25519_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TAAS_ED25519_SEED_LEN 32
+#define TAAS_ED25519_SIG_LEN  64
+
+struct taas_ed25519_key {
+    uint8_t scalar[32];     /* clamped secret scalar a */
+    uint8_t prefix[32];     /* nonce derivation key */
+    uint8_t pub[32];        /* encoded A = aB */
+};
+
+/*
+ * taas_ed25519_expand - Derive the signing state from a 32-byte seed
+ * (the raw Ed25519 private key). The first call into this module
+ * builds the base-point table, once per process.
+ */
+void taas_ed25519_expand(struct taas_ed25519_key *k, const uint8_t seed[TAAS_ED25519_SEED_LEN]);
+
+/*
+ * taas_ed25519_sign - Sign msg. Safe to call from several threads at
+ * once with the same key.
+ */
+void taas_ed25519_sign(uint8_t sig[TAAS_ED25519_SIG_LEN], const struct taas_ed25519_key *k,
+                       const uint8_t *msg, size_t len);
+
+/* One signature to check: sig over the len bytes at msg */
+struct taas_ed25519_item {
+    const uint8_t *msg;
+    size_t len;
+    const uint8_t *sig;
+};
+
+/*
+ * taas_ed25519_verify_batch - Check n signatures made with the same
+ * public key, e.g. every certificate of one node, with the batch
+ * equation of RFC 8032 (cofactored) over chunks of 64. valid[i] is set
+ * to 1 or 0 for each item, exactly as checking them one by one would.
+ * Thread-safe; allocates one workspace per call.
+ * Returns the number of valid signatures, or -1 with errno set:
+ * EINVAL if pub is not a usable Ed25519 key.
+ */
+long taas_ed25519_verify_batch(const uint8_t pub[32], const struct taas_ed25519_item *items,
+                               size_t n, uint8_t *valid);
+
+/* taas_ed25519_verify - One signature: 1 if valid, 0 if not, -1 on error */
+int taas_ed25519_verify(const uint8_t pub[32], const uint8_t *msg, size_t len,
+                        const uint8_t sig[TAAS_ED25519_SIG_LEN]);
+
+#endif /* TAAS_ED25519_H */
@@ -0,0 +1,433 @@
+/*
+ * TaaS Exporter - Prometheus metrics from the node's telemetry segment
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Runs as an ordinary process on the housekeeping cores (0-2) and only
+ * ever reads /dev/shm/taas_telemetry, so scraping never costs the
+ * real-time core a cycle. It also takes over the periodic drift log
+ * the node no longer prints while telemetry is active.
+ *
+ * Usage: taas_exporter [-p PORT]   (default 9588), then GET /metrics
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sched.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "taas_telemetry.h"
+
+#define EXPORTER_PORT   9588
+#define HOUSEKEEPING_CPUS 3     /* cores 0-2; core 3 belongs to the node */
+#define DRIFT_POLL_MS   1000
+
+static const char *const mode_name[TAAS_TEL_MODES] = {
+    [TAAS_TEL_RAW]   = "raw",
+    [TAAS_TEL_TSA]   = "tsa",
+    [TAAS_TEL_BATCH] = "batch",
+    [TAAS_TEL_HMAC]  = "hmac",
+};
+
+static const double quantiles[] = { 0.5, 0.99, 0.999 };
+
+/* Recent samples gathered from every segment's ring, per mode */
+static uint32_t recent_residence[TAAS_TEL_MODES][TAAS_TEL_SEGMENTS * TAAS_TEL_RING];
+static uint32_t recent_sign[TAAS_TEL_SEGMENTS * TAAS_TEL_RING];
+static struct taas_tel_record ring_copy[TAAS_TEL_RING];
+
+static inline uint64_t rd(const uint64_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+/*
+ * tel_map - Map the node's current segment read-only.
+ * Re-opened on every use so a restarted node is picked up.
+ */
+static const struct taas_tel_page *tel_map(void)
+{
+    const struct taas_tel_page *t;
+    struct stat st;
+    int fd = shm_open(TAAS_TEL_SHM, O_RDONLY, 0);
+
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*t)) {
+        close(fd);
+        return NULL;
+    }
+
+    t = mmap(NULL, sizeof(*t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (t == MAP_FAILED)
+        return NULL;
+
+    if (__atomic_load_n(&t->magic, __ATOMIC_ACQUIRE) != TAAS_TEL_MAGIC ||
+        t->version != TAAS_TEL_VERSION || t->nr_segments > TAAS_TEL_SEGMENTS) {
+        munmap((void *)t, sizeof(*t));
+        return NULL;
+    }
+    return t;
+}
+
+static void tel_unmap(const struct taas_tel_page *t)
+{
+    munmap((void *)t, sizeof(*t));
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * ring_snapshot - Copy the records of one segment that are guaranteed
+ * intact. Returns how many were copied into ring_copy.
+ */
+static unsigned int ring_snapshot(const struct taas_tel_segment *s)
+{
+    uint64_t head = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > TAAS_TEL_RING ? head - TAAS_TEL_RING : 0;
+    uint64_t after, valid;
+    unsigned int n = 0;
+
+    for (uint64_t i = first; i < head; i++)
+        ring_copy[n++] = s->ring[i & (TAAS_TEL_RING - 1)];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    /* The writer may have lapped the oldest entries (and be mid-way
+     * through the slot of index after - TAAS_TEL_RING) while we copied.
+     */
+    after = __atomic_load_n(&s->head, __ATOMIC_RELAXED);
+    valid = after >= TAAS_TEL_RING ? after - TAAS_TEL_RING + 1 : 0;
+    if (valid > first) {
+        uint64_t drop = valid - first;
+
+        if (drop >= n)
+            return 0;
+        memmove(ring_copy, ring_copy + drop, (n - drop) * sizeof(ring_copy[0]));
+        n -= (unsigned int)drop;
+    }
+    return n;
+}
+
+static void print_quantiles(FILE *out, const char *metric, const char *mode,
+                            uint32_t *v, size_t n, double hz)
+{
+    qsort(v, n, sizeof(*v), cmp_u32);
+
+    for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+        size_t idx = (size_t)(quantiles[q] * (double)n + 0.999999);
+
+        idx = idx ? idx - 1 : 0;
+        if (mode)
+            fprintf(out, "%s{mode=\"%s\",quantile=\"%g\"} %.9f\n",
+                    metric, mode, quantiles[q], (double)v[idx] / hz);
+        else
+            fprintf(out, "%s{quantile=\"%g\"} %.9f\n", metric, quantiles[q], (double)v[idx] / hz);
+    }
+}
+
+/*
+ * print_histogram - Prometheus histogram from summed bucket counts.
+ * Only octave boundaries are emitted, up to the first one holding
+ * every sample, which keeps a scrape to a few dozen lines per mode.
+ */
+static void print_histogram(FILE *out, const char *metric, const char *label,
+                            const uint64_t *buckets, uint64_t count, uint64_t sum, double hz)
+{
+    uint64_t cum = 0;
+
+    for (unsigned int b = 0; b < TAAS_TEL_BUCKETS && cum < count; b++) {
+        cum += buckets[b];
+        if (b % TAAS_TEL_SUB == TAAS_TEL_SUB - 1 || cum >= count)
+            fprintf(out, "%s_bucket{%s%sle=\"%.9g\"} %llu\n", metric, label, *label ? "," : "",
+                    (double)taas_tel_bucket_limit(b) / hz, (unsigned long long)cum);
+    }
+    fprintf(out, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", metric, label, *label ? "," : "",
+            (unsigned long long)count);
+    fprintf(out, "%s_sum%s%s%s %.9f\n", metric, *label ? "{" : "", label, *label ? "}" : "",
+            (double)sum / hz);
+    fprintf(out, "%s_count%s%s%s %llu\n", metric, *label ? "{" : "", label, *label ? "}" : "",
+            (unsigned long long)count);
+}
+
+static void render(FILE *out)
+{
+    const struct taas_tel_page *t = tel_map();
+    uint64_t buckets[TAAS_TEL_BUCKETS];
+    size_t n_res[TAAS_TEL_MODES] = { 0 }, n_sign = 0;
+    uint64_t count, sum;
+    double hz;
+    char label[32];
+
+    fprintf(out, "# HELP taas_up Whether a running taas_node publishes telemetry.\n"
+                 "# TYPE taas_up gauge\n");
+    if (!t) {
+        fprintf(out, "taas_up 0\n");
+        return;
+    }
+    fprintf(out, "taas_up %d\n", kill(t->pid, 0) == 0 || errno == EPERM);
+    hz = (double)t->timer_hz;
+
+    for (unsigned int s = 0; s < t->nr_segments; s++) {
+        unsigned int n = ring_snapshot(&t->seg[s]);
+
+        for (unsigned int i = 0; i < n; i++) {
+            if (ring_copy[i].mode >= TAAS_TEL_MODES)
+                continue;
+            recent_residence[ring_copy[i].mode][n_res[ring_copy[i].mode]++] = ring_copy[i].residence;
+            if (ring_copy[i].sign)
+                recent_sign[n_sign++] = ring_copy[i].sign;
+        }
+    }
+
+    fprintf(out, "# HELP taas_requests_total Requests answered, by mode.\n"
+                 "# TYPE taas_requests_total counter\n");
+    for (unsigned int m = 0; m < TAAS_TEL_MODES; m++) {
+        count = 0;
+        for (unsigned int s = 0; s < t->nr_segments; s++)
+            count += rd(&t->seg[s].requests[m]);
+        fprintf(out, "taas_requests_total{mode=\"%s\"} %llu\n", mode_name[m],
+                (unsigned long long)count);
+    }
+
+    fprintf(out, "# HELP taas_shed_total Signed requests dropped because every signer ring was full.\n"
+                 "# TYPE taas_shed_total counter\n"
+                 "taas_shed_total %llu\n", (unsigned long long)rd(&t->shed));
+    count = 0;
+    for (unsigned int s = 0; s < t->nr_segments; s++)
+        count += rd(&t->seg[s].tx_errors);
+    fprintf(out, "# HELP taas_tx_errors_total Replies dropped because the socket refused them.\n"
+                 "# TYPE taas_tx_errors_total counter\n"
+                 "taas_tx_errors_total %llu\n", (unsigned long long)count);
+    fprintf(out, "# HELP taas_rate_limited_total Requests refused over their source's budget.\n"
+                 "# TYPE taas_rate_limited_total counter\n"
+                 "taas_rate_limited_total{class=\"raw\"} %llu\n"
+                 "taas_rate_limited_total{class=\"signed\"} %llu\n",
+            (unsigned long long)rd(&t->limited_raw), (unsigned long long)rd(&t->limited_signed));
+
+    fprintf(out, "# HELP taas_residence_seconds Time from the node picking a request up to its reply being sent.\n"
+                 "# TYPE taas_residence_seconds histogram\n");
+    for (unsigned int m = 0; m < TAAS_TEL_MODES; m++) {
+        memset(buckets, 0, sizeof(buckets));
+        count = sum = 0;
+        for (unsigned int s = 0; s < t->nr_segments; s++) {
+            for (unsigned int b = 0; b < TAAS_TEL_BUCKETS; b++)
+                buckets[b] += rd(&t->seg[s].residence[m][b]);
+            count += rd(&t->seg[s].requests[m]);
+            sum += rd(&t->seg[s].residence_sum[m]);
+        }
+        snprintf(label, sizeof(label), "mode=\"%s\"", mode_name[m]);
+        print_histogram(out, "taas_residence_seconds", label, buckets, count, sum, hz);
+    }
+
+    fprintf(out, "# HELP taas_residence_recent_seconds Residence quantiles over the last requests of each thread.\n"
+                 "# TYPE taas_residence_recent_seconds gauge\n");
+    for (unsigned int m = 0; m < TAAS_TEL_MODES; m++)
+        if (n_res[m])
+            print_quantiles(out, "taas_residence_recent_seconds", mode_name[m],
+                            recent_residence[m], n_res[m], hz);
+
+    fprintf(out, "# HELP taas_sign_seconds Time spent producing one Ed25519 signature.\n"
+                 "# TYPE taas_sign_seconds histogram\n");
+    memset(buckets, 0, sizeof(buckets));
+    count = sum = 0;
+    for (unsigned int s = 0; s < t->nr_segments; s++) {
+        for (unsigned int b = 0; b < TAAS_TEL_BUCKETS; b++)
+            buckets[b] += rd(&t->seg[s].sign[b]);
+        count += rd(&t->seg[s].signatures);
+        sum += rd(&t->seg[s].sign_sum);
+    }
+    print_histogram(out, "taas_sign_seconds", "", buckets, count, sum, hz);
+
+    fprintf(out, "# HELP taas_sign_recent_seconds Signing time quantiles over the last signatures.\n"
+                 "# TYPE taas_sign_recent_seconds gauge\n");
+    if (n_sign)
+        print_quantiles(out, "taas_sign_recent_seconds", NULL, recent_sign, n_sign, hz);
+
+    fprintf(out, "# HELP taas_clock_offset_seconds Offset measured at the last drift check.\n"
+                 "# TYPE taas_clock_offset_seconds gauge\n"
+                 "taas_clock_offset_seconds %.9f\n"
+                 "# HELP taas_clock_frequency_ppb Learned frequency error of the timer.\n"
+                 "# TYPE taas_clock_frequency_ppb gauge\n"
+                 "taas_clock_frequency_ppb %.3f\n"
+                 "# HELP taas_clock_corrections_total Drift checks slewed by the servo.\n"
+                 "# TYPE taas_clock_corrections_total counter\n"
+                 "taas_clock_corrections_total %llu\n"
+                 "# HELP taas_clock_steps_total Drift checks too far off to slew.\n"
+                 "# TYPE taas_clock_steps_total counter\n"
+                 "taas_clock_steps_total %llu\n"
+                 "# HELP taas_clock_pps Whether the anchor is disciplined from PPS.\n"
+                 "# TYPE taas_clock_pps gauge\n"
+                 "taas_clock_pps %llu\n",
+            (double)(int64_t)rd((const uint64_t *)&t->clock_offset_ns) * 1e-9,
+            (double)(int64_t)rd((const uint64_t *)&t->clock_freq_mppb) / 1000.0,
+            (unsigned long long)rd(&t->clock_corrections),
+            (unsigned long long)rd(&t->clock_steps),
+            (unsigned long long)rd(&t->clock_pps));
+
+    if (t->nr_peers && t->nr_peers <= TAAS_TEL_PEERS) {
+        fprintf(out, "# HELP taas_peer_offset_seconds Peer time minus ours, best sample of the last cross-check.\n"
+                     "# TYPE taas_peer_offset_seconds gauge\n");
+        for (unsigned int p = 0; p < t->nr_peers; p++)
+            fprintf(out, "taas_peer_offset_seconds{peer=\"%.*s\"} %.9f\n",
+                    (int)sizeof(t->peer[p].name), t->peer[p].name,
+                    (double)(int64_t)rd((const uint64_t *)&t->peer[p].offset_ns) * 1e-9);
+        fprintf(out, "# HELP taas_peer_delay_seconds Round trip to the peer, its residence excluded.\n"
+                     "# TYPE taas_peer_delay_seconds gauge\n");
+        for (unsigned int p = 0; p < t->nr_peers; p++)
+            fprintf(out, "taas_peer_delay_seconds{peer=\"%.*s\"} %.9f\n",
+                    (int)sizeof(t->peer[p].name), t->peer[p].name,
+                    (double)(int64_t)rd((const uint64_t *)&t->peer[p].delay_ns) * 1e-9);
+        fprintf(out, "# HELP taas_peer_rounds_total Cross-checks by outcome.\n"
+                     "# TYPE taas_peer_rounds_total counter\n");
+        for (unsigned int p = 0; p < t->nr_peers; p++)
+            fprintf(out, "taas_peer_rounds_total{peer=\"%.*s\",result=\"answered\"} %llu\n"
+                         "taas_peer_rounds_total{peer=\"%.*s\",result=\"lost\"} %llu\n",
+                    (int)sizeof(t->peer[p].name), t->peer[p].name,
+                    (unsigned long long)rd(&t->peer[p].rounds),
+                    (int)sizeof(t->peer[p].name), t->peer[p].name,
+                    (unsigned long long)rd(&t->peer[p].lost));
+    }
+
+    tel_unmap(t);
+}
+
+/*
+ * log_drift - The node's drift line, printed here instead of on core 3.
+ */
+static void log_drift(void)
+{
+    static uint64_t last = UINT64_MAX;
+    const struct taas_tel_page *t = tel_map();
+    uint64_t seen;
+
+    if (!t)
+        return;
+
+    seen = rd(&t->clock_corrections);
+    if (last != UINT64_MAX && seen != last)
+        printf("[Drift] Offset %+lld ns, frequency %+.1f ppb\n",
+               (long long)(int64_t)rd((const uint64_t *)&t->clock_offset_ns),
+               (double)(int64_t)rd((const uint64_t *)&t->clock_freq_mppb) / 1000.0);
+    last = seen;
+    tel_unmap(t);
+}
+
+static void serve(int client)
+{
+    char req[1024];
+    char *body = NULL;
+    size_t len = 0;
+    ssize_t got = recv(client, req, sizeof(req) - 1, 0);
+    FILE *out;
+
+    if (got <= 0)
+        return;
+    req[got] = '\0';
+
+    if (strncmp(req, "GET /metrics", 12) != 0 && strncmp(req, "GET / ", 6) != 0) {
+        static const char nf[] = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+
+        send(client, nf, sizeof(nf) - 1, MSG_NOSIGNAL);
+        return;
+    }
+
+    out = open_memstream(&body, &len);
+    if (!out)
+        return;
+    render(out);
+    fclose(out);
+
+    dprintf(client, "HTTP/1.0 200 OK\r\n"
+                    "Content-Type: text/plain; version=0.0.4\r\n"
+                    "Content-Length: %zu\r\n\r\n", len);
+    for (size_t off = 0; off < len; ) {
+        ssize_t w = send(client, body + off, len - off, MSG_NOSIGNAL);
+
+        if (w <= 0)
+            break;
+        off += (size_t)w;
+    }
+    free(body);
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_in addr;
+    struct pollfd pfd;
+    struct timeval tv = { .tv_sec = 2, .tv_usec = 0 };
+    cpu_set_t cpuset;
+    int port = EXPORTER_PORT, one = 1, c, sockfd;
+
+    while ((c = getopt(argc, argv, "p:h")) != -1) {
+        switch (c) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-p PORT]  (default %d)\n", argv[0], EXPORTER_PORT);
+            return EXIT_FAILURE;
+        }
+    }
+
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    /* Stay off the node's core */
+    CPU_ZERO(&cpuset);
+    for (int i = 0; i < HOUSEKEEPING_CPUS; i++)
+        CPU_SET(i, &cpuset);
+    if (sched_setaffinity(0, sizeof(cpuset), &cpuset) < 0)
+        perror("taas_exporter: warning: sched_setaffinity");
+
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        perror("taas_exporter: socket");
+        return EXIT_FAILURE;
+    }
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(sockfd, (const struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sockfd, 8) < 0) {
+        perror("taas_exporter: bind");
+        return EXIT_FAILURE;
+    }
+
+    printf("[TaaS] Exporter serving http://0.0.0.0:%d/metrics\n", port);
+
+    pfd.fd = sockfd;
+    pfd.events = POLLIN;
+    while (1) {
+        int ret = poll(&pfd, 1, DRIFT_POLL_MS);
+
+        log_drift();
+        if (ret <= 0)
+            continue;
+
+        int client = accept(sockfd, NULL, NULL);
+        if (client < 0)
+            continue;
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        serve(client);
+        close(client);
+    }
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-2.0
+ *
+ * TaaS timer device ioctls
+ *
+ * Shared between taas_driver.c and taas_node.c. The node owns clock
+ * discipline; the driver only ever applies the anchor it is given.
+ */
+#ifndef TAAS_IOCTL_H
+#define TAAS_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/*
+ * Tick sources (see taas_timer.h). The node is built for one of them;
+ * its anchors, and every tick value the driver hands back, are in
+ * units of that source.
+ */
+#define TAAS_TIMER_ST       0   /* BCM2837 system timer, 1MHz */
+#define TAAS_TIMER_CNTVCT   1   /* ARMv8 virtual counter, CNTFRQ_EL0 */
+#define TAAS_TIMER_SOURCES  2
+
+/*
+ * Anchor of the time equation, exactly as the node uses it:
+ *
+ *   utc_ns = base_utc_ns + (((ticks - base_hw_ticks) * mult) >> shift)
+ */
+struct taas_anchor {
+    __u64 base_utc_ns;
+    __u64 base_hw_ticks;
+    __u64 mult;
+    __u32 shift;
+    __u32 source;           /* TAAS_TIMER_*, what ticks counts */
+};
+
+/*
+ * mmap layout of /dev/taas_timer, by page offset:
+ * - TAAS_MMAP_TIMER:  system timer registers (uncached)
+ * - TAAS_MMAP_ANCHOR: read-only struct taas_anchor_page
+ * - TAAS_MMAP_PPS:    read-only struct taas_pps_page (pps_gpio set only)
+ */
+#define TAAS_MMAP_TIMER  0
+#define TAAS_MMAP_ANCHOR 1
+#define TAAS_MMAP_PPS    2
+
+/*
+ * The driver republishes every anchor it accepts into this page, so
+ * local processes can compute TaaS time themselves instead of asking
+ * the node over loopback. seq is odd while an update is in progress;
+ * readers retry until they see the same even value before and after
+ * copying. valid drops to 0 when the node goes away.
+ */
+struct taas_anchor_page {
+    __u32 seq;
+    __u32 valid;
+    struct taas_anchor anchor;
+};
+
+/*
+ * PPS edges latched by the driver's GPIO interrupt, read from every
+ * tick source the driver supports. count is the number of edges seen
+ * so far; the newest is ticks[(count - 1) % TAAS_PPS_RING][source].
+ * Readers load count (acquire),
+ * copy the entries they need and check count again: at one edge per
+ * second the writer only laps an entry after TAAS_PPS_RING seconds.
+ */
+#define TAAS_PPS_RING 64
+
+struct taas_pps_page {
+    __u64 count;
+    __u64 ticks[TAAS_PPS_RING][TAAS_TIMER_SOURCES];
+};
+
+#define TAAS_IOC_MAGIC 'T'
+
+/*
+ * TAAS_IOC_SET_ANCHOR - Publish a new anchor to the in-kernel responder
+ * and the shared anchor page.
+ *
+ * The anchor is valid only while the file that set it is open: a node
+ * that exits or crashes takes kernel replies and local readers down
+ * with it instead of leaving an undisciplined clock in service.
+ */
+#define TAAS_IOC_SET_ANCHOR _IOW(TAAS_IOC_MAGIC, 1, struct taas_anchor)
+
+/*
+ * Cross-timestamps, after PTP_SYS_OFFSET_EXTENDED: each sample brackets
+ * one system timer read between two CLOCK_REALTIME reads, all taken in
+ * the kernel with interrupts disabled.
+ *
+ *   ts[i][0] = CLOCK_REALTIME before (ns)
+ *   ts[i][1] = ticks of the requested source
+ *   ts[i][2] = CLOCK_REALTIME after (ns)
+ *
+ * The caller sets n_samples and keeps the sample with the narrowest
+ * bracket.
+ */
+#define TAAS_MAX_SAMPLES 25
+
+struct taas_sys_offset {
+    __u32 n_samples;        /* 1..TAAS_MAX_SAMPLES */
+    __u32 source;           /* TAAS_TIMER_* */
+    __u64 ts[TAAS_MAX_SAMPLES][3];
+};
+
+#define TAAS_IOC_SYS_OFFSET _IOWR(TAAS_IOC_MAGIC, 2, struct taas_sys_offset)
+
+#endif /* TAAS_IOCTL_H */
@@ -0,0 +1,390 @@
+/*
+ * TaaS Microbench - cost of the node's hot-path primitives
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Runs each primitive in a tight loop on the RT core (3 by default,
+ * SCHED_FIFO, memory locked, as the node runs) and reports
+ * nanoseconds, cycles and instructions per operation. Cycles and
+ * instructions come from the PMU through perf_event_open(), counting
+ * kernel time too when perf_event_paranoid allows it (needed for
+ * sendto()), user time only otherwise.
+ *
+ * The TSA signature is measured both through OpenSSL (EVP_DigestSignInit
+ * + EVP_DigestSign per request) and through taas_ed25519, which the node
+ * uses.
+ *
+ * Usage: taas_microbench [-n ITERATIONS] [-C CPU]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/perf_event.h>
+#include <openssl/evp.h>
+
+#include "taas_ioctl.h"
+#include "taas_timer.h"
+#include "taas_ed25519.h"
+
+#define TIMER_DEVICE "/dev/taas_timer"
+#define MAP_SIZE 4096
+
+#define ITERATIONS_DEFAULT 10000000ULL
+#define RT_CPU_DEFAULT     3
+#define SIGN_DIVISOR       1000     /* signatures are ~10^4x dearer */
+#define SENDTO_DIVISOR     100
+
+struct pmu {
+    int leader;                     /* cycles; instructions joins its group */
+    int instr;
+    int kernel;                     /* 1 if kernel time is counted */
+};
+
+struct sample {
+    double ns, cycles, instr;
+};
+
+typedef void (*bench_fn)(uint64_t iters);
+
+static const volatile void *regs;
+static volatile uint64_t sink;
+static uint64_t st_retries;
+
+static EVP_MD_CTX *md_ctx;
+static EVP_PKEY *pkey;
+static struct taas_ed25519_key sign_key;
+
+static int send_fd = -1;
+static struct sockaddr_in send_addr;
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int perf_open(uint64_t config, int group, int exclude_kernel)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group < 0;
+    attr.exclude_kernel = (uint64_t)exclude_kernel;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+/*
+ * pmu_open - Cycles and instructions of this thread, as one group so
+ * both cover exactly the same interval.
+ */
+static void pmu_open(struct pmu *p)
+{
+    p->instr = -1;
+    for (p->kernel = 1; p->kernel >= 0; p->kernel--) {
+        p->leader = perf_open(PERF_COUNT_HW_CPU_CYCLES, -1, !p->kernel);
+        if (p->leader >= 0)
+            break;
+    }
+    if (p->leader < 0) {
+        perror("taas_microbench: warning: perf_event_open (no PMU counters)");
+        return;
+    }
+
+    p->instr = perf_open(PERF_COUNT_HW_INSTRUCTIONS, p->leader, !p->kernel);
+}
+
+static void run(const struct pmu *p, bench_fn fn, uint64_t iters, struct sample *s)
+{
+    struct { uint64_t nr, v[2]; } val = { 0 };
+    uint64_t t0, t1;
+
+    fn(iters / 100 + 1);            /* warm caches and branch predictors */
+
+    if (p->leader >= 0) {
+        ioctl(p->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(p->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    t0 = now_ns();
+    fn(iters);
+    t1 = now_ns();
+    if (p->leader >= 0) {
+        ioctl(p->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        if (read(p->leader, &val, sizeof(val)) < (ssize_t)(2 * sizeof(uint64_t)))
+            val.nr = 0;
+    }
+
+    s->ns = (double)(t1 - t0) / (double)iters;
+    s->cycles = val.nr >= 1 ? (double)val.v[0] / (double)iters : -1.0;
+    s->instr = val.nr >= 2 ? (double)val.v[1] / (double)iters : -1.0;
+}
+
+static void report(const char *name, uint64_t iters, const struct sample *s)
+{
+    printf("%-26s %10llu %10.1f", name, (unsigned long long)iters, s->ns);
+    if (s->cycles >= 0)
+        printf(" %10.1f", s->cycles);
+    else
+        printf(" %10s", "-");
+    if (s->instr >= 0)
+        printf(" %10.1f\n", s->instr);
+    else
+        printf(" %10s\n", "-");
+}
+
+static void bench_loop(uint64_t iters)
+{
+    for (uint64_t i = 0; i < iters; i++)
+        sink = i;
+}
+
+/* get_hardware_ticks() as built (TIMER=st|cntvct) */
+static void bench_timer_read(uint64_t iters)
+{
+    for (uint64_t i = 0; i < iters; i++)
+        sink = taas_timer_read(regs);
+}
+
+/*
+ * bench_st_read - taas_st_read() with its retries counted. A retry
+ * means the high word changed between the two reads around the low
+ * word, i.e. a rollover of the low 32 bits.
+ */
+static void bench_st_read(uint64_t iters)
+{
+    const volatile uint32_t *lo = (const volatile uint32_t *)((const volatile char *)regs + TAAS_ST_LOW);
+    const volatile uint32_t *hi = (const volatile uint32_t *)((const volatile char *)regs + TAAS_ST_HIGH);
+    uint64_t retries = 0;
+
+    for (uint64_t i = 0; i < iters; i++) {
+        uint32_t h1, l, h2;
+
+        for (;;) {
+            h1 = *hi;
+            l  = *lo;
+            h2 = *hi;
+            if (h1 == h2)
+                break;
+            retries++;
+        }
+        sink = ((uint64_t)h1 << 32) | l;
+    }
+    st_retries += retries;
+}
+
+static void bench_anchor(uint64_t iters)
+{
+    struct taas_anchor a = {
+        .base_utc_ns   = 1700000000000000000ULL,
+        .base_hw_ticks = 123456789,
+        .mult          = 1000ULL << 24,
+        .shift         = 24,
+    };
+
+    for (uint64_t i = 0; i < iters; i++)
+        sink = taas_anchor_to_utc(&a, a.base_hw_ticks + i);
+}
+
+static void bench_clock_gettime(uint64_t iters)
+{
+    struct timespec ts;
+
+    for (uint64_t i = 0; i < iters; i++) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        sink = (uint64_t)ts.tv_nsec;
+    }
+}
+
+/* One TSA signature through OpenSSL, re-initialised per request */
+static void bench_sign(uint64_t iters)
+{
+    uint8_t msg[40] = { 0 }, sig[64];
+
+    for (uint64_t i = 0; i < iters; i++) {
+        size_t sig_len = sizeof(sig);
+
+        memcpy(msg + 32, &i, sizeof(i));
+        if (EVP_DigestSignInit(md_ctx, NULL, NULL, NULL, pkey) != 1 ||
+            EVP_DigestSign(md_ctx, sig, &sig_len, msg, sizeof(msg)) != 1)
+            return;
+        sink = sig[0];
+    }
+}
+
+/* The node's signer: same message, key expanded once */
+static void bench_ed25519(uint64_t iters)
+{
+    uint8_t msg[40] = { 0 }, sig[64];
+
+    for (uint64_t i = 0; i < iters; i++) {
+        memcpy(msg + 32, &i, sizeof(i));
+        taas_ed25519_sign(sig, &sign_key, msg, sizeof(msg));
+        sink = sig[0];
+    }
+}
+
+/*
+ * bench_sendto - A raw reply to a loopback socket that is never read:
+ * once its queue is full the kernel drops at delivery, so this is the
+ * cost of the send path itself.
+ */
+static void bench_sendto(uint64_t iters)
+{
+    for (uint64_t i = 0; i < iters; i++)
+        sendto(send_fd, &i, sizeof(i), 0, (const struct sockaddr *)&send_addr, sizeof(send_addr));
+}
+
+static int setup_sign(void)
+{
+    EVP_PKEY_CTX *kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_ED25519, NULL);
+    uint8_t seed[TAAS_ED25519_SEED_LEN];
+    size_t len = sizeof(seed);
+
+    md_ctx = EVP_MD_CTX_new();
+    if (!kctx || !md_ctx || EVP_PKEY_keygen_init(kctx) != 1 || EVP_PKEY_keygen(kctx, &pkey) != 1) {
+        fprintf(stderr, "taas_microbench: Ed25519 key generation failed\n");
+        EVP_PKEY_CTX_free(kctx);
+        return -1;
+    }
+    EVP_PKEY_CTX_free(kctx);
+
+    if (EVP_PKEY_get_raw_private_key(pkey, seed, &len) != 1)
+        return -1;
+    taas_ed25519_expand(&sign_key, seed);
+    return 0;
+}
+
+static int setup_sendto(void)
+{
+    socklen_t len = sizeof(send_addr);
+    int sink_fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    memset(&send_addr, 0, sizeof(send_addr));
+    send_addr.sin_family = AF_INET;
+    send_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    /* Bind the sink to an ephemeral port; it stays open but unread */
+    if (sink_fd < 0 || bind(sink_fd, (const struct sockaddr *)&send_addr, sizeof(send_addr)) < 0 ||
+        getsockname(sink_fd, (struct sockaddr *)&send_addr, &len) < 0) {
+        perror("taas_microbench: sink socket");
+        return -1;
+    }
+
+    send_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (send_fd < 0) {
+        perror("taas_microbench: socket");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    struct sched_param sp = { .sched_priority = 99 };
+    uint64_t iters = ITERATIONS_DEFAULT;
+    int cpu = RT_CPU_DEFAULT, c, fd;
+    struct sample s;
+    struct pmu pmu;
+    cpu_set_t cpuset;
+
+    while ((c = getopt(argc, argv, "n:C:h")) != -1) {
+        switch (c) {
+        case 'n':
+            iters = strtoull(optarg, NULL, 10);
+            break;
+        case 'C':
+            cpu = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n ITERATIONS] [-C CPU]  (default %llu on CPU %d)\n",
+                    argv[0], ITERATIONS_DEFAULT, RT_CPU_DEFAULT);
+            return EXIT_FAILURE;
+        }
+    }
+    if (iters < SIGN_DIVISOR)
+        iters = SIGN_DIVISOR;
+
+    setbuf(stdout, NULL);
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    if (sched_setaffinity(0, sizeof(cpuset), &cpuset) < 0)
+        perror("taas_microbench: warning: sched_setaffinity");
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+        perror("taas_microbench: warning: mlockall failed");
+    if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0)
+        perror("taas_microbench: warning: sched_setscheduler failed");
+
+    fd = open(TIMER_DEVICE, O_RDONLY | O_SYNC);
+    if (fd >= 0) {
+        void *p = mmap(NULL, MAP_SIZE, PROT_READ, MAP_SHARED, fd, (off_t)TAAS_MMAP_TIMER * MAP_SIZE);
+
+        if (p != MAP_FAILED)
+            regs = p;
+    }
+    if (!regs)
+        perror("taas_microbench: warning: " TIMER_DEVICE " (timer reads skipped)");
+
+    pmu_open(&pmu);
+
+    printf("[TaaS] Microbench on CPU %d, PMU counters: %s\n", cpu,
+           pmu.leader < 0 ? "none" : pmu.kernel ? "user+kernel" : "user only");
+    printf("%-26s %10s %10s %10s %10s\n", "primitive", "iters", "ns/op", "cycles/op", "instr/op");
+
+    run(&pmu, bench_loop, iters, &s);
+    report("loop overhead", iters, &s);
+
+    if (regs) {
+        run(&pmu, bench_timer_read, iters, &s);
+        report("get_hardware_ticks", iters, &s);
+
+        st_retries = 0;
+        run(&pmu, bench_st_read, iters, &s);
+        report("st_read hi/lo/hi", iters, &s);
+    }
+
+    run(&pmu, bench_anchor, iters, &s);
+    report("anchor extrapolation", iters, &s);
+
+    run(&pmu, bench_clock_gettime, iters, &s);
+    report("clock_gettime(REALTIME)", iters, &s);
+
+    if (setup_sign() == 0) {
+        run(&pmu, bench_sign, iters / SIGN_DIVISOR, &s);
+        report("EVP_DigestSign(Ed25519)", iters / SIGN_DIVISOR, &s);
+        run(&pmu, bench_ed25519, iters / SIGN_DIVISOR, &s);
+        report("taas_ed25519_sign", iters / SIGN_DIVISOR, &s);
+    }
+
+    if (setup_sendto() == 0) {
+        run(&pmu, bench_sendto, iters / SENDTO_DIVISOR, &s);
+        report("sendto() 8 bytes", iters / SENDTO_DIVISOR, &s);
+    }
+
+    /* The warm-up pass is counted too: it read the same registers */
+    if (regs)
+        printf("\nhi/lo/hi retries: %llu in %llu reads (%.3f per million)\n",
+               (unsigned long long)st_retries, (unsigned long long)(iters + iters / 100 + 1),
+               1e6 * (double)st_retries / (double)(iters + iters / 100 + 1));
+
+    return EXIT_SUCCESS;
+}
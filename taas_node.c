@@ -16,71 +16,567 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <stddef.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <sched.h>
 #include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/random.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 #include <time.h>
 #include <errno.h>
 
 #include <openssl/evp.h>
 #include <openssl/pem.h>
 #include <openssl/err.h>
+#include <openssl/sha.h>
+#include <openssl/core_names.h>
 
-#define PTP_PORT 1588
+#include "taas_proto.h"
+#include "taas_ioctl.h"
+#include "taas_timer.h"
+#include "taas_telemetry.h"
+#include "taas_ed25519.h"
+#include "taas_ratelimit.h"
+#include "taas_ptp.h"
+#ifdef TAAS_XDP
+#include "taas_xsk.h"
+#endif
+
+#define PTP_PORT TAAS_PORT
 #define TIMER_DEVICE "/dev/taas_timer"
 #define MAP_SIZE 4096
 #define KEY_FILE "/etc/taas/private_key.pem"
 
+/* Shared keys for HMAC mode, one "<key_id> <hex key>" per line */
+#define HMAC_KEY_FILE "/etc/taas/hmac_keys"
+#define HMAC_MAX_KEYS 64
+
 #define DRIFT_CHECK_INTERVAL 60
 
-/* BCM2837 System Timer runs at 1MHz.
- * 1 Tick = 1 Microsecond = 1000 Nanoseconds.
+/* Calibration state (--state): the servo and anchor, rewritten in place
+ * at every drift check so a restart resumes the learned frequency.
+ */
+#define STATE_FILE         "/var/lib/taas/state"
+#define STATE_TEMP_FILE    "/sys/class/thermal/thermal_zone0/temp"
+#define STATE_MAGIC        0x54534154U  /* "TAST" on disk */
+#define STATE_VERSION      1
+#define STATE_HISTORY      64           /* drift checks kept: about an hour */
+#define STATE_MAX_AGE_SEC  (7 * 86400)  /* older state is relearned from scratch */
+#define STATE_TEMP_BAND_MC 2000         /* a sample this close counts as the same temperature */
+#define STATE_TEMP_MIN     4            /* samples needed to trust a temperature match */
+#define STATE_TEMP_UNKNOWN INT32_MIN
+
+/* Handover (--takeover): a new instance takes the listeners and the
+ * clock state over a UNIX socket, so a deploy never closes the port.
+ */
+#define HANDOFF_SOCK        "/run/taas/handoff.sock"
+#define HANDOFF_MAGIC       0x4f484154U /* "TAHO" on the wire */
+#define HANDOFF_VERSION     2
+#define HANDOFF_TIMEOUT_SEC 2
+#define HANDOFF_DRAIN_MS    200         /* signer backlog allowed to finish */
+
+/* Listening sockets (--listen); without any, the wildcard IPv4 and
+ * IPv6 addresses are served.
+ */
+#define LISTEN_MAX 8
+
+/* Federation: other nodes cross-checked at every drift check (--peer) */
+#define PEER_MAX     TAAS_TEL_PEERS
+#define PEER_SAMPLES 8              /* per round; the one with the least delay counts */
+#define PEER_WARN_NS 1000000LL      /* disagreement worth a warning */
+
+/* Multicast beacons (off unless --beacon is given) */
+#define BEACON_INTERVAL_DEFAULT_MS 1000
+#define BEACON_INTERVAL_MIN_MS     10
+#define BEACON_HOPS                1        /* TTL / hop limit: the local link */
+#define BEACON_CPU                 0
+#define BEACON_LEAD_NS             2000000  /* signing budget ahead of a beacon */
+#define BEACON_SPIN_NS             500000   /* spin, not sleep, for the last stretch */
+#define BEACON_LATE_NS             20000    /* sent later than this, the stamp would lie */
+
+/* PTPv2 grandmaster (off unless --ptp is given) */
+#define PTP_UTC_OFFSET       37     /* TAI - UTC since 2017-01-01 */
+#define PTP_LOG_SYNC_DEFAULT 0      /* one Sync per second */
+#define PTP_LOG_ANNOUNCE     1      /* one Announce every two seconds */
+#define PTP_LOG_DELAY_REQ_SYNC INT8_MIN /* Delay_Req interval follows --ptp-sync */
+#define PTP_RX_BATCH         16
+
+/* Busy-poll mode: timer and control events are polled whenever the
+ * sockets run dry, and at least once per this many non-idle spins.
+ */
+#define EVENT_POLL_SPINS 64
+
+/* Two-step replies (--two-step): replies awaiting their TX stamp, per
+ * listener, and how long one may wait before it is given up.
+ */
+#define TWOSTEP_RING        256     /* must be a power of two */
+#define TWOSTEP_TIMEOUT_SEC 1
+
+/* Busy-poll mode: budget handed to SO_BUSY_POLL when --busy-poll has no value */
+#define BUSY_POLL_DEFAULT_US 50
+
+/* Self-test (--selftest): seconds per measurement by default, and how
+ * often the timer wakeups and synthetic requests come.
+ */
+#define SELFTEST_SEC_DEFAULT 10
+#define SELFTEST_PERIOD_NS   1000000    /* cyclictest's default interval */
+#define SELFTEST_REQ_GAP_NS  100000
+
+/* p99.9 limits of --selftest-limit, by name */
+enum st_limit {
+    ST_LIMIT_GAP,
+    ST_LIMIT_WAKEUP,
+    ST_LIMIT_REQUEST,
+    ST_LIMIT_SIGN,
+    ST_LIMITS
+};
+
+/* Stages of a synthetic request, then the whole of it */
+enum st_stage {
+    ST_RECV,
+    ST_CLASSIFY,
+    ST_STAMP,
+    ST_SEND,
+    ST_REQUEST,
+    ST_STAGES
+};
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+#ifdef TAAS_XDP
+/* AF_XDP fast path: steering program as installed by make install */
+#define XDP_QUEUE_MAX 63            /* xsks_map has 64 entries (taas_xdp_kern.c) */
+#ifndef XDP_PROG_FILE
+#define XDP_PROG_FILE "/usr/local/lib/taas/taas_xdp_kern.o"
+#endif
+#endif
+
+/* Batched I/O: datagrams drained per recvmmsg() call.
+ * The sockets are non-blocking and only read once epoll reports them
+ * ready, so a deep batch costs nothing at low load and only pays off
+ * under bursts.
+ */
+#define RX_BATCH_DEFAULT 32
+#define RX_BATCH_MAX     64
+#define RX_BUF_SIZE      2048     /* above the MTU, so MSG_TRUNC is never a real request */
+#define RX_CTRL_SIZE     CMSG_SPACE(sizeof(struct scm_timestamping))
+
+/* TSA signing offload: core 3 stamps and enqueues, signer threads
+ * pinned to the housekeeping cores (0-2) sign and reply.
+ */
+#define SIGNER_THREADS_DEFAULT 3
+#define SIGNER_THREADS_MAX     3
+#define SIGN_RING_SIZE         1024     /* must be a power of two */
+#define SIGNER_STACK_SIZE      (256 * 1024)
+
+/* Merkle aggregation (off unless --merkle-window is given) */
+#define MERKLE_LEAVES_DEFAULT  256
+#define MERKLE_WINDOW_MAX_US   1000000  /* a certificate later than that is no timestamp */
+
+/* Tick rate of the build's timer source (taas_timer.h): 1MHz for the
+ * BCM2837 System Timer, CNTFRQ_EL0 for the architected counter.
+ */
+#define TICKS_PER_SEC timer_hz
+
+/* Fixed-point rate: the anchor slope is kept as mult / 2^ANCHOR_SHIFT
+ * nanoseconds per tick. 2^24 gives 0.06 ppb of frequency resolution
+ * at 1MHz (1.2 ppb at 19.2MHz), and (delta_ticks * mult) stays inside
+ * 64 bits for 2^64 / ((1e9 / hz) << 24) ticks, ~18 minutes at either
+ * rate, far longer than DRIFT_CHECK_INTERVAL, since the anchor is
+ * re-based at every check.
+ */
+#define ANCHOR_SHIFT 24
+
+/* Cross-timestamp samples per calibration (TAAS_IOC_SYS_OFFSET) */
+#define CALIB_SAMPLES 9
+
+/* PPS discipline: without an edge for this long, fall back to CLOCK_REALTIME */
+#define PPS_MAX_AGE_TICKS (2 * TICKS_PER_SEC)
+
+/* Clock discipline (PI loop on the measured offset).
+ * Offsets beyond SERVO_STEP_NS are stepped instead of slewed, like ntpd.
+ */
+#define SERVO_KP       0.7
+#define SERVO_KI       0.3
+#define SERVO_STEP_NS  128000000LL
+#define SERVO_MAX_PPB  500000.0
+
+/* Control requests, posted from signal handlers through the eventfd */
+enum node_ctl {
+    CTL_STOP      = 1 << 0,     /* SIGINT, SIGTERM */
+    CTL_CALIBRATE = 1 << 1,     /* SIGUSR1: re-anchor now, e.g. after an NTP step */
+    CTL_RELOAD    = 1 << 2,     /* SIGHUP: reload the signing key */
+    CTL_UPGRADE   = 1 << 3,     /* SIGUSR2: start a successor to take over */
+};
+
+/* A client address as recvmmsg() fills it in, for either family */
+union peer_addr {
+    struct sockaddr     sa;
+    struct sockaddr_in  v4;
+    struct sockaddr_in6 v6;
+};
+
+/* A two-step reply that has left, keyed by its SOF_TIMESTAMPING_OPT_ID */
+struct twostep_slot {
+    uint32_t key;
+    uint32_t request_id;
+    uint64_t sent_ticks;
+    union peer_addr addr;
+    socklen_t addrlen;
+    int done;
+};
+
+/* Keys are handed out by the kernel in send order, so head mirrors the
+ * socket's own counter and [tail, head) are the replies still waiting.
+ */
+struct twostep_ring {
+    uint32_t head;
+    uint32_t tail;
+    struct twostep_slot slot[TWOSTEP_RING];
+};
+
+/* How a datagram is served; see taas_proto.h for the dispatch rules */
+enum req_kind {
+    REQ_RAW,
+    REQ_TSA,
+    REQ_BATCH,
+    REQ_HMAC,
+    REQ_TIME,
+    REQ_EXT_TIME,
+    REQ_EXT_TSA,
+};
+
+/* One CLOCK_REALTIME reading taken together with a tick read, used to
+ * place kernel receive timestamps on the anchor's timeline.
  */
-#define NSEC_PER_TICK 1000
+struct rx_clock {
+    uint64_t utc_ns;        /* anchor time at the tick read */
+    uint64_t realtime_ns;   /* CLOCK_REALTIME right before it */
+};
+
+/*
+ * One slot of the receive slab. A datagram is received straight into
+ * buf and, wherever the reply's layout allows, answered in place: the
+ * 32 bytes of a TSA request are the certificate's client_hash, and
+ * the header of a versioned request is already its reply's header,
+ * with an extended TSA request's hash right where the certificate
+ * wants it. Replies that need the request intact (HMAC, busy, batch)
+ * get room of their own. Every slot starts a cache line.
+ */
+struct rx_slot {
+    _Alignas(64) union {
+        uint8_t buf[RX_BUF_SIZE];
+        uint64_t raw_utc_ns;
+        struct taas_certificate cert;
+        struct taas_time_reply time_reply;
+        struct taas_ext_time_reply ext_reply;
+        struct taas_ext_certificate ext_cert;
+    };
+    union peer_addr addr;
+    union {
+        struct cmsghdr align;
+        uint8_t buf[RX_CTRL_SIZE];
+    } ctrl;
+    struct taas_hmac_reply hmac_reply;
+    struct taas_busy_reply busy;
+    struct taas_batch_certificate bcert;
+};
+
+/* A TSA request that has been timestamped on core 3 but not yet signed.
+ * count is 0 for a legacy 32-byte request (client_hash[0] only) and
+ * 1..TAAS_BATCH_MAX_HASHES for a batch; ext marks a single hash that
+ * wants a taas_ext_certificate. Hashes go last so a legacy job only
+ * touches the first cache lines of its slot.
+ */
+struct sign_job {
+    uint64_t utc_timestamp_ns;
+    union peer_addr cliaddr;
+    socklen_t addrlen;
+    int sockfd;             /* listener the request came in on */
+    uint32_t request_id;
+    uint16_t count;
+    uint8_t  ext;
+    uint64_t rx_ticks;      /* telemetry: when core 3 picked it up */
+    uint8_t  client_hash[TAAS_BATCH_MAX_HASHES][32];
+};
 
-struct __attribute__((packed)) taas_certificate {
+/* What an aggregation window keeps of each legacy request */
+struct merkle_leaf {
     uint8_t  client_hash[32];
     uint64_t utc_timestamp_ns;
-    uint8_t  signature[64];
+    uint64_t rx_ticks;
+    union peer_addr cliaddr;
+    socklen_t addrlen;
+    int sockfd;
+};
+
+/* Lock-free single-producer / single-consumer ring.
+ * head is written only by core 3, tail only by the owning signer.
+ * Each index sits on its own cache line to avoid false sharing.
+ * 'sleeping' doubles as the futex word the signer parks on when idle.
+ */
+struct sign_ring {
+    _Alignas(64) _Atomic uint32_t head;
+    _Alignas(64) _Atomic uint32_t tail;
+    _Alignas(64) _Atomic uint32_t sleeping;
+    struct sign_job jobs[SIGN_RING_SIZE];
+};
+
+/* Per-signer scratch space for one aggregation window */
+struct merkle_batch {
+    struct merkle_leaf *leaves;
+    uint8_t (*tree)[32];
+    struct taas_merkle_certificate *certs;
+    struct iovec *iov;
+    struct mmsghdr *msgs;
+};
+
+struct signer {
+    struct sign_ring ring;
+    pthread_t thread;
+    struct taas_batch_certificate bcert;
+    struct merkle_batch merkle;
+    struct taas_tel_segment *tel;
+    int cpu;
 };
 
 /* Structure to hold the Boot-Time Anchor
- * This acts as the "y-intercept" for our time equation: y = mx + b
+ * This acts as the "y-intercept" for our time equation: y = mx + b,
+ * with the slope m = mult / 2^shift ns per tick.
  */
 struct time_anchor {
     uint64_t base_utc_ns;
     uint64_t base_hw_ticks;
+    uint64_t mult;
+    uint32_t shift;
+};
+
+/* PI servo state. freq_ppb is the integral term: the learned crystal
+ * frequency error relative to the nominal 1MHz.
+ */
+struct clock_servo {
+    double   freq_ppb;
+    uint64_t last_utc_ns;
+    int64_t  offset_ns;     /* last measured offset */
+    int      locked;
+};
+
+/* One drift check as kept in the state file */
+struct state_sample {
+    uint64_t utc_ns;
+    int64_t  offset_ns;
+    int32_t  freq_mppb;     /* 0.001 ppb, after the correction */
+    int32_t  temp_mc;       /* SoC temperature in millidegrees, or STATE_TEMP_UNKNOWN */
+};
+
+/* Layout of the state file. It is only ever read back by the same
+ * build (magic, version and size must match), so it is kept in native
+ * layout. seq is odd while core 3 rewrites it; a file left that way by
+ * a crash is ignored.
+ */
+struct node_state {
+    uint32_t magic;
+    uint32_t version;
+    _Atomic uint32_t seq;
+    uint32_t source;            /* TAAS_TIMER_SOURCE */
+    uint64_t timer_hz;
+    char     boot_id[40];       /* the anchor's ticks mean nothing after a reboot */
+    double   freq_ppb;
+    int32_t  locked;
+    struct time_anchor anchor;
+    uint32_t head;              /* samples ever written */
+    uint32_t reserved;
+    struct state_sample hist[STATE_HISTORY];
+};
+
+/* What a running node hands its successor, next to the listener fds
+ * and, if it runs PTP, the event and general port after them.
+ * Both sides may be different builds: bump HANDOFF_VERSION whenever
+ * this layout (or that of the structures in it) changes.
+ */
+struct handoff_msg {
+    uint32_t magic;
+    uint32_t version;
+    int32_t  pid;
+    uint32_t nr_fds;            /* listeners */
+    uint32_t source;            /* TAAS_TIMER_SOURCE */
+    uint32_t ptp;               /* two PTP fds follow the listeners */
+    uint64_t timer_hz;
+    struct time_anchor anchor;
+    struct clock_servo servo;
+    uint16_t ptp_sync_seq;
+    uint16_t ptp_announce_seq;
+    uint32_t reserved;
 };
 
 static int timer_fd = -1;
+static uint64_t timer_hz = TAAS_ST_HZ;
 static void *map_base = NULL;
 static EVP_PKEY *pkey = NULL;
-static EVP_MD_CTX *md_ctx = NULL;
+
+/* Expanded signing key. SIGHUP loads the spare slot and then flips
+ * sign_key_idx, so signers never see a half-written key. Threads off
+ * core 3 announce the slot they sign with in sign_key_use (slot + 1,
+ * 0 while not signing), and a reload that would overwrite a slot still
+ * announced is refused.
+ */
+static struct taas_ed25519_key sign_key[2];
+static _Atomic unsigned int sign_key_idx;
+static _Atomic unsigned int sign_key_use[SIGNER_THREADS_MAX + 1];  /* signers, then the beacon */
+static _Thread_local _Atomic unsigned int *key_use;                 /* NULL on core 3 */
 static struct time_anchor anchor;
+static struct clock_servo servo;
+static unsigned int rx_batch = RX_BATCH_DEFAULT;
+static int rx_timestamps = 0;
+static unsigned int busy_poll_us = 0;
+static int use_pps = 0;
+static const struct taas_pps_page *pps = NULL;
+#ifdef TAAS_XDP
+static const char *xdp_ifname = NULL;
+static unsigned int xdp_queue = 0;
+static const char *xdp_prog = XDP_PROG_FILE;
+static struct taas_xsk *xsk = NULL;
+#endif
+static const char *listen_spec[LISTEN_MAX];
+static unsigned int nr_listen_specs = 0;
+static int listen_fd[LISTEN_MAX];
+static unsigned int nr_listeners = 0;
+static int two_step = 0;
+static struct twostep_ring twostep[LISTEN_MAX];
+
+/* Self-test: seconds per measurement (0: serve), p99.9 limits in us (0: unchecked) */
+static unsigned int selftest_sec = 0;
+static const char *const st_limit_name[ST_LIMITS] = { "gap", "wakeup", "request", "sign" };
+static uint64_t st_limit_us[ST_LIMITS] = { 10, 50, 50, 0 };
+
+/* Handover: the socket a successor connects to, and how to start one */
+static int takeover = 0;
+static int handoff_fd = -1;
+static char self_exe[PATH_MAX];
+static char **self_argv;
+
+/* Event loop: sockets, the drift timer and the control eventfd */
+static int epoll_fd = -1;
+static int drift_fd = -1;
+static int ctl_fd = -1;
+static _Atomic unsigned int ctl_pending;
+static unsigned int nr_signers = SIGNER_THREADS_DEFAULT;
+static struct signer signers[SIGNER_THREADS_MAX];
+
+/* Anchor copy for threads off core 3, republished by publish_anchor().
+ * seq is odd while core 3 is writing it.
+ */
+static struct {
+    _Atomic uint32_t seq;
+    struct time_anchor anchor;
+} anchor_pub;
+
+/*
+ * One --peer. A round is PEER_SAMPLES extended time requests sent back
+ * to back; request_ids are id_base + sample, so late replies from an
+ * earlier round never match.
+ */
+struct peer {
+    int fd;
+    const char *spec;
+    uint32_t id_base;
+    unsigned int got;
+    int done;
+    unsigned int lost_streak;
+    int64_t offset_ns;          /* peer - this node, best sample so far */
+    int64_t delay_ns;
+    uint64_t t1[PEER_SAMPLES];  /* 0 once answered */
+};
+
+static const char *peer_spec[PEER_MAX];
+static unsigned int nr_peer_specs = 0;
+static struct peer peers[PEER_MAX];
+static unsigned int nr_peers = 0;
+static uint32_t peer_round = 0;
+
+static const char *beacon_spec = NULL;
+static unsigned int beacon_interval_ms = BEACON_INTERVAL_DEFAULT_MS;
+static int beacon_fd = -1;
+static union peer_addr beacon_addr;
+static socklen_t beacon_addrlen;
+static pthread_t beacon_thread;
+
+static const char *ptp_ifname = NULL;
+static unsigned int ptp_domain = 0;
+static int ptp_log_sync = PTP_LOG_SYNC_DEFAULT;
+static int ptp_log_delay_req = PTP_LOG_DELAY_REQ_SYNC;
+static struct taas_ptp *ptp = NULL;
+static struct taas_ptp_handoff ptp_handoff = { .event_fd = -1, .general_fd = -1 };
+
+/* Telemetry for taas_exporter; NULL if the shared segment is unavailable */
+static struct taas_tel_page *tel = NULL;
+_Static_assert(TAAS_TEL_SEGMENTS >= 1 + SIGNER_THREADS_MAX, "one telemetry segment per thread");
+
+/* Calibration state file (NULL if disabled or unavailable) */
+static const char *state_path = STATE_FILE;
+static struct node_state *state = NULL;
+static int temp_fd = -1;
+static struct time_anchor resume_anchor;
+static int have_resume_anchor = 0;
+static unsigned int merkle_window_us = 0;
+static unsigned int merkle_leaves = MERKLE_LEAVES_DEFAULT;
+
+/* Per-source admission control (off unless --raw-limit/--tsa-limit).
+ * The table is static, so mlockall() has it resident before the loop.
+ */
+static uint64_t rl_rate[TAAS_RL_CLASSES], rl_burst[TAAS_RL_CLASSES];
+static struct taas_rl_limit rl_limit[TAAS_RL_CLASSES];
+static _Alignas(64) struct taas_rl_entry rl_table[TAAS_RL_SLOTS];
+static uint64_t rl_seed;
+static int rl_on = 0;
+
+/* HMAC keys: ids are scanned linearly (64 ids fit in four cache lines),
+ * each context already holds the keyed ipad/opad state.
+ */
+static EVP_MAC *hmac_alg = NULL;
+static uint32_t hmac_key_ids[HMAC_MAX_KEYS];
+static EVP_MAC_CTX *hmac_ctx[HMAC_MAX_KEYS];
+static unsigned int nr_hmac_keys = 0;
 
-/* Pointers to memory mapped registers */
-static volatile uint32_t *st_low = NULL;
-static volatile uint32_t *st_high = NULL;
 
 /*
  * shutdown_node - async-signal-safe cleanup handler
  */
 void shutdown_node(int sig)
 {
+#ifdef TAAS_XDP
+    /* Never leave the steering program behind without its socket */
+    taas_xsk_close(xsk);
+#endif
+
     if (map_base != MAP_FAILED && map_base != NULL)
         munmap(map_base, MAP_SIZE);
 
     if (timer_fd >= 0)
         close(timer_fd);
 
-    if (md_ctx)
-        EVP_MD_CTX_free(md_ctx);
-
     if (pkey)
         EVP_PKEY_free(pkey);
 
@@ -90,21 +586,118 @@ void shutdown_node(int sig)
 }
 
 /*
- * get_hardware_ticks - Atomic read of 64-bit BCM2837 timer
- * Uses optimistic concurrency control (lock-free).
- *
- * Since we are reading two 32-bit registers to form a 64-bit value,
- * we must ensure the high bits didn't roll over during the read of low bits.
+ * get_hardware_ticks - One read of the build's tick source.
+ * The BCM2837 timer goes through the register mapping, CNTVCT_EL0
+ * needs none (see taas_timer.h).
  */
 static inline uint64_t get_hardware_ticks(void)
 {
-    uint32_t h1, l, h2;
+    return taas_timer_read(map_base);
+}
+
+/* Tick read for telemetry only: free while telemetry is off */
+static inline uint64_t tel_ticks(const struct taas_tel_segment *seg)
+{
+    return seg ? get_hardware_ticks() : 0;
+}
+
+/*
+ * cpu_relax - Spin-wait hint: lets the core idle its pipeline between
+ * polls without giving it up to the scheduler.
+ */
+static inline void cpu_relax(void)
+{
+#if defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield" ::: "memory");
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/*
+ * anchor_ticks_to_utc - The time equation: one multiply, shift and add.
+ */
+static inline uint64_t anchor_ticks_to_utc(const struct time_anchor *a, uint64_t ticks)
+{
+    return a->base_utc_ns + (((ticks - a->base_hw_ticks) * a->mult) >> a->shift);
+}
+
+/*
+ * anchor_mult - Fixed-point slope for a rate offset of freq_ppb.
+ */
+static uint64_t anchor_mult(double freq_ppb)
+{
+    double nominal = 1e9 * (double)(1ULL << ANCHOR_SHIFT) / (double)timer_hz;
+
+    return (uint64_t)(nominal * (1.0 + freq_ppb * 1e-9) + 0.5);
+}
+
+static double clamp_ppb(double ppb)
+{
+    if (ppb > SERVO_MAX_PPB)
+        return SERVO_MAX_PPB;
+    if (ppb < -SERVO_MAX_PPB)
+        return -SERVO_MAX_PPB;
+    return ppb;
+}
+
+/*
+ * read_cross_timestamp - One (UTC, ticks) pair for the anchor.
+ *
+ * The driver samples CLOCK_REALTIME / timer / CLOCK_REALTIME with
+ * interrupts off; the narrowest bracket wins and its midpoint is the
+ * UTC of the tick read. Drivers without TAAS_IOC_SYS_OFFSET fall back
+ * to two back-to-back reads here, which is deterministic enough only
+ * because Core 3 is isolated with interrupts pinned away.
+ */
+static void read_cross_timestamp(uint64_t *utc_ns, uint64_t *ticks)
+{
+    struct taas_sys_offset so = { .n_samples = CALIB_SAMPLES, .source = TAAS_TIMER_SOURCE };
+    struct timespec ts_kernel;
+    unsigned int best = 0;
+
+    if (ioctl(timer_fd, TAAS_IOC_SYS_OFFSET, &so) == 0) {
+        for (unsigned int i = 1; i < so.n_samples; i++)
+            if (so.ts[i][2] - so.ts[i][0] < so.ts[best][2] - so.ts[best][0])
+                best = i;
+
+        *utc_ns = so.ts[best][0] + (so.ts[best][2] - so.ts[best][0]) / 2;
+        *ticks  = so.ts[best][1];
+        return;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts_kernel);
+    *ticks  = get_hardware_ticks();
+    *utc_ns = ((uint64_t)ts_kernel.tv_sec * 1000000000ULL) + ts_kernel.tv_nsec;
+}
+
+/*
+ * read_pps_reference - (UTC, ticks) of the newest PPS edge.
+ *
+ * An edge marks the start of a UTC second. Which second is taken from
+ * the anchor itself, so only its boot calibration ever needs NTP (and
+ * only to within half a second). Returns -1 if the signal is lost.
+ */
+static int read_pps_reference(uint64_t *utc_ns, uint64_t *ticks)
+{
+    uint64_t count, edge;
+
     do {
-        h1 = *st_high;
-        l  = *st_low;
-        h2 = *st_high;
-    } while (h1 != h2);
-    return ((uint64_t)h1 << 32) | l;
+        count = __atomic_load_n(&pps->count, __ATOMIC_ACQUIRE);
+        if (!count)
+            return -1;
+        edge = pps->ticks[(count - 1) % TAAS_PPS_RING][TAAS_TIMER_SOURCE];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&pps->count, __ATOMIC_RELAXED) != count);
+
+    if (get_hardware_ticks() - edge > PPS_MAX_AGE_TICKS)
+        return -1;
+
+    *ticks  = edge;
+    *utc_ns = (anchor_ticks_to_utc(&anchor, edge) + 500000000ULL) / 1000000000ULL * 1000000000ULL;
+    return 0;
 }
 
 /*
@@ -112,204 +705,3748 @@ static inline uint64_t get_hardware_ticks(void)
  * Hardware Ticks and Real World Time (UTC).
  *
  * This function is critical. It aligns our "fast" hardware clock
- * with the "correct" kernel/NTP clock.
+ * with the "correct" kernel/NTP clock, or with PPS edges once --pps
+ * is given and a signal is present.
+ *
+ * At boot the anchor is set directly at the nominal rate. After that
+ * it is disciplined instead of reset: the measured offset feeds a PI
+ * loop whose integral term learns the crystal's frequency error, and
+ * the anchor is re-based at its own projected time with the corrected
+ * slope. Served time therefore never jumps; only offsets too large to
+ * slew (SERVO_STEP_NS) are stepped.
  *
  * param verbose: 1 to print logs (boot), 0 to just correct (runtime).
  */
 void calibrate_time_anchor(int verbose)
 {
-    struct timespec ts_kernel;
-
-    /* Critical Section: We want these two reads to be as close as possible.
-     * Since we are isolated on Core 3 with interrupts pinned away,
-     * this is highly deterministic.
-     */
-    clock_gettime(CLOCK_REALTIME, &ts_kernel);
-    uint64_t ticks_now = get_hardware_ticks();
+    static int pps_active;
+    uint64_t new_base_utc, ticks_now;
+    int from_pps = !verbose && pps && read_pps_reference(&new_base_utc, &ticks_now) == 0;
 
-    uint64_t new_base_utc = ((uint64_t)ts_kernel.tv_sec * 1000000000ULL) + ts_kernel.tv_nsec;
+    if (!from_pps)
+        read_cross_timestamp(&new_base_utc, &ticks_now);
 
-    if (!verbose) {
-        /* Calculate drift for monitoring before resetting.
-         * This tells us how much the crystal oscillated differently 
-         * due to temperature vs the NTP standard.
-         */
-        uint64_t projected = anchor.base_utc_ns + (ticks_now - anchor.base_hw_ticks) * NSEC_PER_TICK;
-        int64_t drift = (int64_t)new_base_utc - (int64_t)projected;
-        
-        /* Print drift. Since buffering is disabled in main(), this hits journalctl immediately */
-        printf("[Drift] Correction applied: %ld ns\n", drift);
+    if (pps && !verbose && from_pps != pps_active) {
+        printf(from_pps ? "[TaaS] Disciplining from PPS.\n"
+                        : "[TaaS] PPS lost, disciplining from CLOCK_REALTIME.\n");
+        pps_active = from_pps;
+        if (tel)
+            __atomic_store_n(&tel->clock_pps, (uint64_t)from_pps, __ATOMIC_RELAXED);
     }
 
-    anchor.base_utc_ns = new_base_utc;
-    anchor.base_hw_ticks = ticks_now;
-
     if (verbose) {
+        anchor.base_utc_ns = new_base_utc;
+        anchor.base_hw_ticks = ticks_now;
+        anchor.mult = anchor_mult(servo.freq_ppb);
+        anchor.shift = ANCHOR_SHIFT;
+        servo.last_utc_ns = new_base_utc;
+
         printf("[TaaS] Anchor Established:\n");
         printf("       UTC Base: %llu ns\n", anchor.base_utc_ns);
         printf("       HW Base:  %llu ticks\n", anchor.base_hw_ticks);
+        return;
     }
-}
 
-int main(void)
-{
-    /* DISABLE STDOUT BUFFERING
-     * This ensures printf() shows up in journalctl immediately,
-     * crucial for monitoring the drift correction in real-time.
+    /* How far the crystal wandered from the reference since the
+     * last check (temperature, ageing, initial tolerance).
      */
-    setbuf(stdout, NULL);
+    uint64_t projected = anchor_ticks_to_utc(&anchor, ticks_now);
+    int64_t offset = (int64_t)new_base_utc - (int64_t)projected;
+    double dt = (double)(new_base_utc - servo.last_utc_ns) * 1e-9;
 
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    CPU_SET(3, &cpuset);
-    if (sched_setaffinity(0, sizeof(cpu_set_t), &cpuset) < 0) {
-        perror("taas warning: isolcpus is active?");
+    servo.last_utc_ns = new_base_utc;
+    servo.offset_ns = offset;
+
+    if (offset > SERVO_STEP_NS || offset < -SERVO_STEP_NS || dt <= 0.0) {
+        /* Too far off to slew: step and re-acquire frequency */
+        anchor.base_utc_ns = new_base_utc;
+        anchor.base_hw_ticks = ticks_now;
+        servo.locked = 0;
+        printf("[Drift] Step applied: %ld ns\n", offset);
+        if (tel) {
+            taas_tel_set(&tel->clock_offset_ns, offset);
+            taas_tel_add(&tel->clock_steps, 1);
+        }
+        return;
     }
 
-    struct sched_param sp = { .sched_priority = 99 };
-    struct sockaddr_in servaddr, cliaddr;
-    int sockfd;
+    /* offset/dt is ns per second, i.e. ppb. The first interval after
+     * boot or a step measures the frequency error outright; after that
+     * the integral only absorbs a fraction of each residual.
+     */
+    double err_ppb = (double)offset / dt;
 
-    signal(SIGINT, shutdown_node);
-    signal(SIGTERM, shutdown_node);
+    servo.freq_ppb = clamp_ppb(servo.freq_ppb + (servo.locked ? SERVO_KI * err_ppb : err_ppb));
+    servo.locked = 1;
 
-    OpenSSL_add_all_algorithms();
+    anchor.base_utc_ns = projected;
+    anchor.base_hw_ticks = ticks_now;
+    anchor.mult = anchor_mult(clamp_ppb(servo.freq_ppb + SERVO_KP * err_ppb));
 
-    md_ctx = EVP_MD_CTX_new();
-    if (!md_ctx) {
-        fprintf(stderr, "Fatal: Failed to allocate crypto context\n");
-        return EXIT_FAILURE;
+    /* With telemetry, taas_exporter reports (and logs) the servo state
+     * from cores 0-2, keeping this write off the RT core. Otherwise
+     * print drift; since buffering is disabled in main(), this hits
+     * journalctl immediately.
+     */
+    if (tel) {
+        taas_tel_set(&tel->clock_offset_ns, offset);
+        taas_tel_set(&tel->clock_freq_mppb, (int64_t)(servo.freq_ppb * 1000.0));
+        taas_tel_add(&tel->clock_corrections, 1);
+    } else {
+        printf("[Drift] Offset %+ld ns, frequency %+.1f ppb\n", offset, servo.freq_ppb);
     }
+}
 
-    FILE *fp = fopen(KEY_FILE, "r");
+/*
+ * telemetry_open - Create the shared segment taas_exporter reads.
+ *
+ * Any previous segment is unlinked, not truncated, so an exporter
+ * still mapping it keeps valid (stale) pages. Failure only costs
+ * visibility, never service.
+ */
+static void telemetry_open(void)
+{
+    void *p;
+    int fd;
+
+    shm_unlink(TAAS_TEL_SHM);
+    fd = shm_open(TAAS_TEL_SHM, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(*tel)) < 0) {
+        perror("taas: warning: telemetry disabled");
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+
+    p = mmap(NULL, sizeof(*tel), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("taas: warning: telemetry disabled");
+        return;
+    }
+
+    tel = p;
+    tel->version = TAAS_TEL_VERSION;
+    tel->timer_hz = timer_hz;
+    tel->pid = (int32_t)getpid();
+    tel->nr_segments = 1 + SIGNER_THREADS_MAX;
+    __atomic_store_n(&tel->magic, TAAS_TEL_MAGIC, __ATOMIC_RELEASE);
+}
+
+/*
+ * read_boot_id - This boot's random id, as the kernel reports it.
+ */
+static void read_boot_id(char id[40])
+{
+    FILE *fp = fopen("/proc/sys/kernel/random/boot_id", "r");
+
+    memset(id, 0, 40);
     if (fp) {
-        pkey = PEM_read_PrivateKey(fp, NULL, NULL, NULL);
+        if (!fgets(id, 40, fp))
+            id[0] = '\0';
+        id[strcspn(id, "\n")] = '\0';
         fclose(fp);
-    } else {
-        fprintf(stderr, "Fatal: Key file not found. Generate Ed25519 key first.\n");
     }
+}
 
-    /* Lock memory to prevent paging latency.
-     * Paging would introduce non-deterministic delays (jitter).
-     */
-    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
-        perror("taas: warning: mlockall failed");
+/*
+ * read_temp_mc - SoC temperature in millidegrees, or STATE_TEMP_UNKNOWN.
+ * One pread() of an fd opened at startup: cheap enough for a drift check.
+ */
+static int32_t read_temp_mc(void)
+{
+    char buf[16];
+    ssize_t n;
 
-    /* Elevate to Real-Time FIFO.
-     * This preempts almost everything else on the system.
-     */
-    if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0)
-        perror("taas: warning: sched_setscheduler failed");
+    if (temp_fd < 0)
+        return STATE_TEMP_UNKNOWN;
+    n = pread(temp_fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0)
+        return STATE_TEMP_UNKNOWN;
+    buf[n] = '\0';
+    return (int32_t)strtol(buf, NULL, 10);
+}
 
-    /* Open Timer Driver */
-    timer_fd = open(TIMER_DEVICE, O_RDWR | O_SYNC);
-    if (timer_fd < 0) {
-        perror("taas: open timer device");
-        return EXIT_FAILURE;
-    }
+/*
+ * state_frequency - Best starting frequency from a saved state: the
+ * mean of the samples taken near the current temperature, since that
+ * is what the crystal's error mostly follows, else the last value.
+ */
+static double state_frequency(const struct node_state *st, int32_t temp_mc, int *matched)
+{
+    unsigned int n = st->head < STATE_HISTORY ? st->head : STATE_HISTORY;
+    unsigned int hits = 0;
+    double sum = 0.0;
 
-    /* MMIO Map */
-    map_base = mmap(NULL, MAP_SIZE, PROT_READ, MAP_SHARED, timer_fd, 0);
-    if (map_base == MAP_FAILED) {
-        perror("taas: mmap failed");
-        close(timer_fd);
-        return EXIT_FAILURE;
+    *matched = 0;
+    if (temp_mc == STATE_TEMP_UNKNOWN)
+        return st->freq_ppb;
+
+    for (unsigned int i = 0; i < n; i++) {
+        const struct state_sample *sm = &st->hist[i];
+
+        if (sm->temp_mc == STATE_TEMP_UNKNOWN ||
+            sm->temp_mc - temp_mc > STATE_TEMP_BAND_MC || temp_mc - sm->temp_mc > STATE_TEMP_BAND_MC)
+            continue;
+        sum += sm->freq_mppb / 1000.0;
+        hits++;
     }
+    if (hits < STATE_TEMP_MIN)
+        return st->freq_ppb;
 
-    /* BCM2837 Offsets */
-    st_low  = (volatile uint32_t *)((char *)map_base + 0x04);
-    st_high = (volatile uint32_t *)((char *)map_base + 0x08);
+    *matched = 1;
+    return clamp_ppb(sum / hits);
+}
 
-    calibrate_time_anchor(1);
+/*
+ * state_restore - Seed the servo from a previous run's state.
+ *
+ * The frequency survives anything but a change of board or a long
+ * downtime. The anchor is only kept as a candidate when the host has
+ * not rebooted since; state_resume() decides whether to use it.
+ */
+static void state_restore(const struct node_state *st, const char *boot_id)
+{
+    struct timespec now;
+    uint64_t now_ns, age_s;
+    int32_t temp_mc = read_temp_mc();
+    int matched;
 
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0) {
-        perror("taas: socket creation");
-        return EXIT_FAILURE;
+    if (st->magic != STATE_MAGIC || st->version != STATE_VERSION ||
+        st->source != TAAS_TIMER_SOURCE || st->timer_hz != timer_hz)
+        return;
+    if (atomic_load_explicit(&st->seq, memory_order_acquire) & 1) {
+        fprintf(stderr, "taas: warning: %s was left half-written, ignored\n", state_path);
+        return;
     }
 
-    /* SET SOCKET TIMEOUT
-     * We need the recvfrom() loop to wake up periodically (every 1 sec)
-     * even if no packets arrive, so we can check if drift correction is needed.
-     */
-    struct timeval tv;
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
-        perror("taas: setsockopt failed");
-    }
+    clock_gettime(CLOCK_REALTIME, &now);
+    now_ns = (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+    if (st->anchor.base_utc_ns > now_ns || !(st->freq_ppb >= -SERVO_MAX_PPB && st->freq_ppb <= SERVO_MAX_PPB))
+        return;
+    age_s = (now_ns - st->anchor.base_utc_ns) / 1000000000ULL;
+    if (age_s > STATE_MAX_AGE_SEC)
+        return;
 
-    memset(&servaddr, 0, sizeof(servaddr));
-    servaddr.sin_family = AF_INET;
-    servaddr.sin_addr.s_addr = INADDR_ANY;
-    servaddr.sin_port = htons(PTP_PORT);
+    servo.freq_ppb = state_frequency(st, temp_mc, &matched);
+    servo.locked = st->locked;
 
-    if (bind(sockfd, (const struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
-        perror("taas: bind failed");
-        close(sockfd);
-        return EXIT_FAILURE;
+    if (st->locked && boot_id[0] && !strcmp(st->boot_id, boot_id)) {
+        resume_anchor = st->anchor;
+        have_resume_anchor = 1;
     }
 
-    struct taas_certificate cert;
-    uint8_t data_to_sign[40];
-    uint8_t buffer[64];
-    socklen_t len = sizeof(cliaddr);
-    size_t req_len;
-    time_t last_check = time(NULL);
+    printf("[TaaS] Calibration state from %s (%llu s old): %+.1f ppb%s.\n",
+           state_path, (unsigned long long)age_s, servo.freq_ppb,
+           matched ? ", matched to the current temperature" : "");
+}
+
+/*
+ * state_claim - From here on the file describes this run, and this
+ * process is its only writer.
+ */
+static void state_claim(void)
+{
+    char boot_id[40];
 
-    printf("[TaaS] Unified Ed25519 Node Ready. Serving UTC Nanoseconds.\n");
+    if (!state)
+        return;
 
-    /*
-     * Main event loop:
-     * - Wait for UDP trigger (with 1s timeout)
-     * - Perform atomic hardware read
-     * - Extrapolate UTC time from Anchor
-     * - Send UTC timestamp back
-     * - Periodically check for Thermal Drift
-     */
-    while (1) {
-        ssize_t rec = recvfrom(sockfd, buffer, sizeof(buffer), 0,
-                               (struct sockaddr *)&cliaddr, &len);
+    read_boot_id(boot_id);
+    atomic_store_explicit(&state->seq, atomic_load_explicit(&state->seq, memory_order_relaxed) | 1,
+                          memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    state->magic    = STATE_MAGIC;
+    state->version  = STATE_VERSION;
+    state->source   = TAAS_TIMER_SOURCE;
+    state->timer_hz = timer_hz;
+    memcpy(state->boot_id, boot_id, sizeof(state->boot_id));
+    atomic_store_explicit(&state->seq, atomic_load_explicit(&state->seq, memory_order_relaxed) + 1,
+                          memory_order_release);
+}
 
-        if (rec > 0) {
-            /* 1. Get Hardware Ticks (Atomic) */
-            uint64_t current_hw = get_hardware_ticks();
+/*
+ * state_open - Map the state file and load what it holds.
+ *
+ * The mapping is shared, so state_save() costs core 3 a few stores and
+ * no syscall: the kernel writes the page back on its own, and it
+ * survives the process dying at any point. Failure only costs the
+ * faster start.
+ */
+static void state_open(void)
+{
+    struct stat sb;
+    char boot_id[40];
+    void *p;
+    int fd, fresh;
 
-            /* 2. Calculate Delta from Anchor */
-            uint64_t delta_ticks = current_hw - anchor.base_hw_ticks;
+    if (!state_path)
+        return;
 
-            /* 3. Convert to Nanoseconds (1MHz timer -> x1000) */
-            uint64_t delta_ns = delta_ticks * NSEC_PER_TICK;
+    fd = open(state_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0 || fstat(fd, &sb) < 0) {
+        perror("taas: warning: calibration state disabled");
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
 
-            /* 4. Calculate Absolute UTC Time */
-            uint64_t current_utc_ns = anchor.base_utc_ns + delta_ns;
+    /* Wrong size: another build's layout, or a new file. Start over */
+    fresh = sb.st_size != (off_t)sizeof(*state);
+    if (fresh && (ftruncate(fd, 0) < 0 || ftruncate(fd, sizeof(*state)) < 0)) {
+        perror("taas: warning: calibration state disabled");
+        close(fd);
+        return;
+    }
 
-            if (rec == 32 && pkey) {
-                /* TSA MODE (Certificate with UTC) */
-                memcpy(cert.client_hash, buffer, 32);
-                cert.utc_timestamp_ns = current_utc_ns;
+    p = mmap(NULL, sizeof(*state), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("taas: warning: calibration state disabled");
+        return;
+    }
 
-                memcpy(data_to_sign, cert.client_hash, 32);
-                memcpy(data_to_sign + 32, &cert.utc_timestamp_ns, 8);
+    state = p;
+    temp_fd = open(STATE_TEMP_FILE, O_RDONLY | O_CLOEXEC);
+    read_boot_id(boot_id);
+    if (!fresh)
+        state_restore(state, boot_id);
 
-                if (EVP_DigestSignInit(md_ctx, NULL, NULL, NULL, pkey) == 1) {
-                    req_len = 64;
-                    EVP_DigestSign(md_ctx, cert.signature, &req_len, data_to_sign, 40);
-                }
+    /* A successor leaves the file to the running node until it takes over */
+    if (!takeover)
+        state_claim();
+}
 
-                sendto(sockfd, &cert, sizeof(cert), 0, (struct sockaddr *)&cliaddr, len);
-            } else {
-                /* RAW MODE (Just the UTC uint64) */
-                sendto(sockfd, &current_utc_ns, sizeof(current_utc_ns), 0, (struct sockaddr *)&cliaddr, len);
-            }
-        }
+/*
+ * state_resume - Continue the previous run's timeline at boot.
+ *
+ * If the host has not rebooted and the saved anchor still agrees with
+ * the fresh calibration to within SERVO_STEP_NS, keep its projection:
+ * served time continues across the restart instead of jumping to the
+ * reference, and a PPS-disciplined phase is not thrown away for an
+ * NTP one. The servo then slews out whatever is left.
+ */
+static void state_resume(void)
+{
+    uint64_t projected;
+    int64_t diff;
+
+    if (!have_resume_anchor)
+        return;
+
+    projected = anchor_ticks_to_utc(&resume_anchor, anchor.base_hw_ticks);
+    diff = (int64_t)anchor.base_utc_ns - (int64_t)projected;
+    if (anchor.base_hw_ticks < resume_anchor.base_hw_ticks || diff > SERVO_STEP_NS || diff < -SERVO_STEP_NS)
+        return;
+
+    anchor.base_utc_ns = projected;
+    printf("[TaaS] Resumed the previous anchor, %+ld ns from the reference.\n", diff);
+}
+
+/*
+ * state_save - Record the servo and anchor (core 3). sample adds the
+ * drift check just made to the history.
+ */
+static void state_save(int sample)
+{
+    uint32_t seq;
+
+    if (!state)
+        return;
+
+    seq = atomic_load_explicit(&state->seq, memory_order_relaxed);
+    atomic_store_explicit(&state->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    state->freq_ppb = servo.freq_ppb;
+    state->locked   = servo.locked;
+    state->anchor   = anchor;
+    if (sample && servo.locked) {
+        struct state_sample *sm = &state->hist[state->head % STATE_HISTORY];
+
+        sm->utc_ns    = anchor.base_utc_ns;
+        sm->offset_ns = servo.offset_ns;
+        sm->freq_mppb = (int32_t)(servo.freq_ppb * 1000.0);
+        sm->temp_mc   = read_temp_mc();
+        state->head++;
+    }
+
+    atomic_store_explicit(&state->seq, seq + 2, memory_order_release);
+}
+
+/*
+ * publish_anchor - Hand the anchor to the driver's in-kernel responder
+ * and to the threads that read it off core 3 (see anchor_snapshot()).
+ *
+ * With taas_driver loaded as responder=1, raw requests are answered in
+ * the kernel from this anchor and never reach the socket. Older drivers
+ * reject the ioctl (ENOTTY), which simply leaves raw mode here.
+ */
+static void publish_anchor(void)
+{
+    static int warned;
+    uint32_t seq = atomic_load_explicit(&anchor_pub.seq, memory_order_relaxed);
+
+    atomic_store_explicit(&anchor_pub.seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    anchor_pub.anchor = anchor;
+    atomic_store_explicit(&anchor_pub.seq, seq + 2, memory_order_release);
+
+    struct taas_anchor a = {
+        .base_utc_ns   = anchor.base_utc_ns,
+        .base_hw_ticks = anchor.base_hw_ticks,
+        .mult          = anchor.mult,
+        .shift         = anchor.shift,
+        .source        = TAAS_TIMER_SOURCE,
+    };
+
+    if (ioctl(timer_fd, TAAS_IOC_SET_ANCHOR, &a) < 0 && errno != ENOTTY && !warned) {
+        perror("taas: warning: TAAS_IOC_SET_ANCHOR");
+        warned = 1;
+    }
+}
+
+/*
+ * anchor_snapshot - Consistent copy of the published anchor, for
+ * threads other than core 3. Retries while an update is in flight.
+ */
+static void anchor_snapshot(struct time_anchor *a)
+{
+    uint32_t seq;
+
+    do {
+        while ((seq = atomic_load_explicit(&anchor_pub.seq, memory_order_acquire)) & 1)
+            cpu_relax();
+        *a = anchor_pub.anchor;
+        atomic_thread_fence(memory_order_acquire);
+    } while (atomic_load_explicit(&anchor_pub.seq, memory_order_relaxed) != seq);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -b, --batch=N   datagrams drained per recvmmsg() (1-%d, default %d)\n"
+            "  -s, --signers=N TSA signer threads on cores 0-2 (0-%d, default %d;\n"
+            "                  0 signs inline on core 3)\n"
+            "  -w, --merkle-window=US\n"
+            "                  aggregate TSA requests for up to US microseconds\n"
+            "                  and sign one Merkle root (0-%d, default 0: off)\n"
+            "  -l, --merkle-leaves=N\n"
+            "                  seal a window early at N leaves (2-%u, default %d)\n"
+            "  -L, --listen=ADDR[%%IFACE]\n"
+            "                  serve on ADDR (IPv4 or IPv6), bound to IFACE if\n"
+            "                  given; repeat for up to %d sockets (default:\n"
+            "                  0.0.0.0 and ::)\n"
+            "  -B, --beacon=GROUP[%%IFACE]\n"
+            "                  multicast signed time beacons to GROUP (IPv4 or\n"
+            "                  IPv6) on port %d, out of IFACE if given\n"
+            "  -I, --beacon-interval=MS\n"
+            "                  time between beacons (%d-60000, default %d)\n"
+            "  -G, --ptp=IFACE act as PTPv2 grandmaster on IFACE (UDP ports 319/320)\n"
+            "  -D, --ptp-domain=N\n"
+            "                  PTP domainNumber (0-127, default 0)\n"
+            "  -S, --ptp-sync=LOG2\n"
+            "                  Sync interval as log2 seconds (-7 to 4, default %d)\n"
+            "  -E, --ptp-delay-req=LOG2\n"
+            "                  minimum Delay_Req interval slaves are told to\n"
+            "                  keep, as log2 seconds (-7 to 9, default --ptp-sync)\n"
+            "  -r, --rx-timestamp\n"
+            "                  serve the kernel receive time (SO_TIMESTAMPING)\n"
+            "                  instead of the time the loop got to the packet\n"
+            "  -t, --two-step  follow each versioned time reply with its kernel\n"
+            "                  TX timestamp (SO_TIMESTAMPING, error queue)\n"
+            "  -p, --busy-poll[=US]\n"
+            "                  spin on a non-blocking socket instead of sleeping,\n"
+            "                  with SO_BUSY_POLL budget US (default %d)\n"
+            "  -P, --pps       discipline the anchor from the driver's PPS input\n"
+            "                  (taas_driver pps_gpio=N) instead of CLOCK_REALTIME\n"
+            "  -C, --state=FILE\n"
+            "                  keep the learned clock calibration in FILE across\n"
+            "                  restarts (default %s, \"none\" to disable)\n"
+            "  -F, --peer=ADDR[%%IFACE]\n"
+            "                  cross-check this node against the node at ADDR\n"
+            "                  at every drift check; repeat for up to %d peers\n"
+            "  -O, --takeover  take the sockets, anchor and servo over from the\n"
+            "                  running node (%s) once ready, then let it exit\n"
+            "  -Y, --selftest[=SECONDS]\n"
+            "                  certify core 3 instead of serving: timer read\n"
+            "                  gaps, timer wakeup latency and the cost of each\n"
+            "                  request stage, SECONDS each (default %d); stop\n"
+            "                  the node first\n"
+            "  -M, --selftest-limit=NAME:US[,NAME:US...]\n"
+            "                  p99.9 limits that fail the self-test, NAME one of\n"
+            "                  gap, wakeup, request, sign (defaults %llu, %llu,\n"
+            "                  %llu, %llu; 0 reports only)\n"
+            "  -R, --raw-limit=RATE[:BURST]\n"
+            "                  per-source budget for raw and HMAC requests, in\n"
+            "                  requests/s (BURST defaults to RATE); excess is dropped\n"
+            "  -T, --tsa-limit=RATE[:BURST]\n"
+            "                  per-source budget for TSA and batch signatures;\n"
+            "                  excess gets an unsigned busy reply\n"
+#ifdef TAAS_XDP
+            "  -x, --xdp=IFACE answer raw requests on IFACE through AF_XDP\n"
+            "                  (implies --busy-poll)\n"
+            "  -q, --xdp-queue=N\n"
+            "                  RX queue the AF_XDP socket binds to (default 0)\n"
+            "  -X, --xdp-prog=FILE\n"
+            "                  steering program to attach\n"
+            "                  (default " XDP_PROG_FILE ")\n"
+#endif
+            "  -h, --help      show this help\n",
+            prog, RX_BATCH_MAX, RX_BATCH_DEFAULT,
+            SIGNER_THREADS_MAX, SIGNER_THREADS_DEFAULT,
+            MERKLE_WINDOW_MAX_US, TAAS_MERKLE_MAX_LEAVES, MERKLE_LEAVES_DEFAULT,
+            LISTEN_MAX, TAAS_BEACON_PORT, BEACON_INTERVAL_MIN_MS,
+            BEACON_INTERVAL_DEFAULT_MS, PTP_LOG_SYNC_DEFAULT, BUSY_POLL_DEFAULT_US, STATE_FILE,
+            PEER_MAX, HANDOFF_SOCK, SELFTEST_SEC_DEFAULT,
+            (unsigned long long)st_limit_us[ST_LIMIT_GAP],
+            (unsigned long long)st_limit_us[ST_LIMIT_WAKEUP],
+            (unsigned long long)st_limit_us[ST_LIMIT_REQUEST],
+            (unsigned long long)st_limit_us[ST_LIMIT_SIGN]);
+}
+
+/*
+ * parse_number - A decimal number in [min, max] that makes up all of
+ * arg. Returns 0, or -1 (leaving *val undefined) if arg is anything else.
+ */
+static int parse_number(const char *arg, long min, long max, long *val)
+{
+    char *end;
+
+    errno = 0;
+    *val = strtol(arg, &end, 10);
+    return end == arg || *end || errno || *val < min || *val > max ? -1 : 0;
+}
+
+/* RATE[:BURST] for one admission budget */
+static int parse_limit(const char *arg, unsigned int cls)
+{
+    char *end;
+
+    rl_rate[cls] = strtoull(arg, &end, 10);
+    rl_burst[cls] = rl_rate[cls];
+    if (*end == ':')
+        rl_burst[cls] = strtoull(end + 1, &end, 10);
+    return rl_rate[cls] && rl_burst[cls] && !*end ? 0 : -1;
+}
+
+/* NAME:US[,NAME:US...] for --selftest-limit */
+static int parse_selftest_limit(const char *arg)
+{
+    for (;;) {
+        size_t len = strcspn(arg, ":");
+        unsigned int i;
+        char *end;
+
+        for (i = 0; i < ST_LIMITS; i++)
+            if (strlen(st_limit_name[i]) == len && !strncmp(arg, st_limit_name[i], len))
+                break;
+        if (i == ST_LIMITS || arg[len] != ':')
+            return -1;
+        st_limit_us[i] = strtoull(arg + len + 1, &end, 10);
+        if (end == arg + len + 1)
+            return -1;
+        if (!*end)
+            return 0;
+        if (*end != ',')
+            return -1;
+        arg = end + 1;
+    }
+}
+
+static int parse_args(int argc, char **argv)
+{
+    static const struct option opts[] = {
+        { "batch",         required_argument, NULL, 'b' },
+        { "signers",       required_argument, NULL, 's' },
+        { "merkle-window", required_argument, NULL, 'w' },
+        { "merkle-leaves", required_argument, NULL, 'l' },
+        { "listen",        required_argument, NULL, 'L' },
+        { "beacon",        required_argument, NULL, 'B' },
+        { "beacon-interval", required_argument, NULL, 'I' },
+        { "ptp",           required_argument, NULL, 'G' },
+        { "ptp-domain",    required_argument, NULL, 'D' },
+        { "ptp-sync",      required_argument, NULL, 'S' },
+        { "ptp-delay-req", required_argument, NULL, 'E' },
+        { "rx-timestamp",  no_argument,       NULL, 'r' },
+        { "two-step",      no_argument,       NULL, 't' },
+        { "busy-poll",     optional_argument, NULL, 'p' },
+        { "pps",           no_argument,       NULL, 'P' },
+        { "state",         required_argument, NULL, 'C' },
+        { "peer",          required_argument, NULL, 'F' },
+        { "takeover",      no_argument,       NULL, 'O' },
+        { "selftest",      optional_argument, NULL, 'Y' },
+        { "selftest-limit", required_argument, NULL, 'M' },
+        { "raw-limit",     required_argument, NULL, 'R' },
+        { "tsa-limit",     required_argument, NULL, 'T' },
+#ifdef TAAS_XDP
+        { "xdp",           required_argument, NULL, 'x' },
+        { "xdp-queue",     required_argument, NULL, 'q' },
+        { "xdp-prog",      required_argument, NULL, 'X' },
+#endif
+        { "help",          no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    long num;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "b:s:w:l:L:B:I:G:D:S:E:rtp::PC:F:OY::M:R:T:x:q:X:h", opts, NULL)) != -1) {
+        switch (c) {
+        case 'b':
+            if (parse_number(optarg, 1, RX_BATCH_MAX, &num) < 0) {
+                fprintf(stderr, "taas: --batch must be 1-%d\n", RX_BATCH_MAX);
+                return -1;
+            }
+            rx_batch = (unsigned int)num;
+            break;
+        case 's':
+            if (parse_number(optarg, 0, SIGNER_THREADS_MAX, &num) < 0) {
+                fprintf(stderr, "taas: --signers must be 0-%d\n", SIGNER_THREADS_MAX);
+                return -1;
+            }
+            nr_signers = (unsigned int)num;
+            break;
+        case 'w':
+            if (parse_number(optarg, 0, MERKLE_WINDOW_MAX_US, &num) < 0) {
+                fprintf(stderr, "taas: --merkle-window must be 0-%d\n", MERKLE_WINDOW_MAX_US);
+                return -1;
+            }
+            merkle_window_us = (unsigned int)num;
+            break;
+        case 'l':
+            if (parse_number(optarg, 2, TAAS_MERKLE_MAX_LEAVES, &num) < 0) {
+                fprintf(stderr, "taas: --merkle-leaves must be 2-%u\n", TAAS_MERKLE_MAX_LEAVES);
+                return -1;
+            }
+            merkle_leaves = (unsigned int)num;
+            break;
+        case 'L':
+            if (nr_listen_specs == LISTEN_MAX) {
+                fprintf(stderr, "taas: at most %d --listen sockets\n", LISTEN_MAX);
+                return -1;
+            }
+            listen_spec[nr_listen_specs++] = optarg;
+            break;
+        case 'B':
+            beacon_spec = optarg;
+            break;
+        case 'I':
+            if (parse_number(optarg, BEACON_INTERVAL_MIN_MS, 60000, &num) < 0) {
+                fprintf(stderr, "taas: --beacon-interval must be %d-60000\n",
+                        BEACON_INTERVAL_MIN_MS);
+                return -1;
+            }
+            beacon_interval_ms = (unsigned int)num;
+            break;
+        case 'G':
+            ptp_ifname = optarg;
+            break;
+        case 'D':
+            if (parse_number(optarg, 0, 127, &num) < 0) {
+                fprintf(stderr, "taas: --ptp-domain must be 0-127\n");
+                return -1;
+            }
+            ptp_domain = (unsigned int)num;
+            break;
+        case 'S':
+            if (parse_number(optarg, -7, 4, &num) < 0) {
+                fprintf(stderr, "taas: --ptp-sync must be -7 to 4\n");
+                return -1;
+            }
+            ptp_log_sync = (int)num;
+            break;
+        case 'E':
+            if (parse_number(optarg, -7, 9, &num) < 0) {
+                fprintf(stderr, "taas: --ptp-delay-req must be -7 to 9\n");
+                return -1;
+            }
+            ptp_log_delay_req = (int)num;
+            break;
+        case 'r':
+            rx_timestamps = 1;
+            break;
+        case 't':
+            two_step = 1;
+            break;
+        case 'p':
+            num = BUSY_POLL_DEFAULT_US;
+            if (optarg && parse_number(optarg, 1, INT_MAX, &num) < 0) {
+                fprintf(stderr, "taas: --busy-poll budget must be at least 1us\n");
+                return -1;
+            }
+            busy_poll_us = (unsigned int)num;
+            break;
+#ifdef TAAS_XDP
+        case 'x':
+            xdp_ifname = optarg;
+            break;
+        case 'q':
+            if (parse_number(optarg, 0, XDP_QUEUE_MAX, &num) < 0) {
+                fprintf(stderr, "taas: --xdp-queue must be 0-%d\n", XDP_QUEUE_MAX);
+                return -1;
+            }
+            xdp_queue = (unsigned int)num;
+            break;
+        case 'X':
+            xdp_prog = optarg;
+            break;
+#endif
+        case 'P':
+            use_pps = 1;
+            break;
+        case 'C':
+            state_path = strcmp(optarg, "none") ? optarg : NULL;
+            break;
+        case 'F':
+            if (nr_peer_specs == PEER_MAX) {
+                fprintf(stderr, "taas: at most %d --peer nodes\n", PEER_MAX);
+                return -1;
+            }
+            peer_spec[nr_peer_specs++] = optarg;
+            break;
+        case 'O':
+            takeover = 1;
+            break;
+        case 'Y':
+            num = SELFTEST_SEC_DEFAULT;
+            if (optarg && parse_number(optarg, 1, INT_MAX, &num) < 0) {
+                fprintf(stderr, "taas: --selftest must run for at least 1s\n");
+                return -1;
+            }
+            selftest_sec = (unsigned int)num;
+            break;
+        case 'M':
+            if (parse_selftest_limit(optarg) < 0) {
+                fprintf(stderr, "taas: --selftest-limit must be NAME:US[,NAME:US...] with NAME one of "
+                        "gap, wakeup, request, sign\n");
+                return -1;
+            }
+            break;
+        case 'R':
+        case 'T':
+            if (parse_limit(optarg, c == 'R' ? TAAS_RL_RAW : TAAS_RL_SIGNED) < 0) {
+                fprintf(stderr, "taas: --%s must be RATE[:BURST] with RATE >= 1\n",
+                        c == 'R' ? "raw-limit" : "tsa-limit");
+                return -1;
+            }
+            break;
+        case 'h':
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (selftest_sec && takeover) {
+        fprintf(stderr, "taas: --selftest cannot be combined with --takeover\n");
+        return -1;
+    }
+
+#ifdef TAAS_XDP
+    /* The AF_XDP rings are only ever polled, so the loop must not sleep */
+    if (xdp_ifname && !busy_poll_us)
+        busy_poll_us = BUSY_POLL_DEFAULT_US;
+
+    /* The steering program belongs to one socket: both instances
+     * would fight over it on the way in and out.
+     */
+    if (xdp_ifname && takeover) {
+        fprintf(stderr, "taas: --takeover does not support --xdp\n");
+        return -1;
+    }
+#endif
+
+    /* How spawn_successor() starts the next instance: from the path
+     * this one was started from, once the binary there is replaced.
+     */
+    ssize_t len = readlink("/proc/self/exe", self_exe, sizeof(self_exe) - 1);
+
+    self_exe[len > 0 ? len : 0] = '\0';
+    self_argv = calloc((size_t)argc + 2, sizeof(*self_argv));
+    if (self_argv) {
+        memcpy(self_argv, argv, (size_t)argc * sizeof(*argv));
+        if (!takeover)
+            self_argv[argc] = "--takeover";
+    }
+    return 0;
+}
+
+/*
+ * utc_now_ns - Extrapolate UTC from the anchor using one hardware read.
+ */
+static inline uint64_t utc_now_ns(void)
+{
+    /* 1. Get Hardware Ticks (Atomic) */
+    uint64_t current_hw = get_hardware_ticks();
+
+    /* 2. Scale the delta from the anchor by the disciplined rate */
+    return anchor_ticks_to_utc(&anchor, current_hw);
+}
+
+/*
+ * rx_clock_read - Pair CLOCK_REALTIME with the anchor once per batch.
+ * Same read order as calibrate_time_anchor(), through the vDSO.
+ */
+static inline void rx_clock_read(struct rx_clock *ref)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ref->utc_ns = utc_now_ns();
+    ref->realtime_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * kernel_stamp - The kernel's software stamp of a datagram, on the
+ * tick timeline, or 0 if it has none that is usable. That is the
+ * receive time of a received datagram, or the transmit time of a
+ * report from the error queue.
+ *
+ * Its distance to the batch's rx_clock pair is measured in the kernel
+ * clock (microseconds at most, so its rate error is negligible) and
+ * subtracted from the anchor time of that pair. Interrupt, softirq and
+ * wake-up latency thus drop out of the result.
+ */
+static inline uint64_t kernel_stamp(const struct msghdr *mh, const struct rx_clock *ref)
+{
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR((struct msghdr *)mh); cm;
+         cm = CMSG_NXTHDR((struct msghdr *)mh, cm)) {
+        struct scm_timestamping tss;
+        uint64_t rx_ns;
+
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SO_TIMESTAMPING)
+            continue;
+
+        memcpy(&tss, CMSG_DATA(cm), sizeof(tss));
+        rx_ns = (uint64_t)tss.ts[0].tv_sec * 1000000000ULL + tss.ts[0].tv_nsec;
+        if (rx_ns && rx_ns <= ref->realtime_ns &&
+            ref->realtime_ns - rx_ns < 1000000000ULL)
+            return ref->utc_ns - (ref->realtime_ns - rx_ns);
+    }
+    return 0;
+}
+
+/*
+ * stamp_request - UTC timestamp to serve for one received datagram:
+ * its kernel receive stamp with --rx-timestamp, otherwise (or without
+ * a usable stamp) the time now.
+ */
+static inline uint64_t stamp_request(const struct msghdr *mh, const struct rx_clock *ref)
+{
+    if (rx_timestamps) {
+        uint64_t t = kernel_stamp(mh, ref);
+
+        if (t)
+            return t;
+    }
+    return utc_now_ns();
+}
+
+/*
+ * send_batch - Flush prepared replies with as few sendmmsg() calls as possible.
+ *
+ * sendmmsg() stops at the first entry it cannot send (socket buffer
+ * full, no route to that one client, a netfilter drop) and fails with
+ * its error on the next call. That entry is skipped and the rest still
+ * go out, so one bad destination never holds up the replies queued
+ * behind it. err, if not NULL, gets 0 for every entry sent and the
+ * errno of every entry dropped.
+ * Returns the number of replies sent.
+ */
+static unsigned int send_batch(int sockfd, struct mmsghdr *msgs, unsigned int count, int *err)
+{
+    unsigned int next = 0, sent = 0;
+
+    while (next < count) {
+        int n = sendmmsg(sockfd, msgs + next, count - next, 0);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (err)
+                err[next] = errno;
+            next++;
+            continue;
+        }
+        if (err)
+            memset(err + next, 0, (size_t)n * sizeof(*err));
+        next += (unsigned int)n;
+        sent += (unsigned int)n;
+    }
+    return sent;
+}
+
+/*
+ * ratelimit_init - Derive the budgets once the timer rate is known.
+ * The hash is seeded so sources can't be picked to collide.
+ */
+static void ratelimit_init(void)
+{
+    for (unsigned int c = 0; c < TAAS_RL_CLASSES; c++) {
+        taas_rl_limit_set(&rl_limit[c], timer_hz, rl_rate[c], rl_burst[c]);
+        rl_on |= rl_limit[c].interval != 0;
+    }
+    if (!rl_on)
+        return;
+
+    if (getrandom(&rl_seed, sizeof(rl_seed), 0) != sizeof(rl_seed))
+        rl_seed = (uint32_t)get_hardware_ticks();
+
+    printf("[TaaS] Per-source limits: raw %llu/s (burst %llu), signed %llu/s (burst %llu).\n",
+           (unsigned long long)rl_rate[TAAS_RL_RAW], (unsigned long long)rl_burst[TAAS_RL_RAW],
+           (unsigned long long)rl_rate[TAAS_RL_SIGNED], (unsigned long long)rl_burst[TAAS_RL_SIGNED]);
+}
+
+/*
+ * admit - Charge one request to its source's budget.
+ * Returns 0 to serve it, otherwise the ticks until the source conforms.
+ */
+static inline uint64_t admit(const union peer_addr *src, unsigned int cls, uint64_t now)
+{
+    struct taas_rl_entry *e;
+    uint64_t key;
+
+    if (!rl_limit[cls].interval)
+        return 0;
+
+    key = src->sa.sa_family == AF_INET6 ? taas_rl_key_v6(src->v6.sin6_addr.s6_addr)
+                                        : taas_rl_key_v4(src->v4.sin_addr.s_addr);
+    e = taas_rl_lookup(rl_table, rl_seed, key, now);
+    return taas_rl_admit(e, cls, &rl_limit[cls], now);
+}
+
+/*
+ * fill_busy - Unsigned refusal for a signed-mode request over budget.
+ */
+static void fill_busy(struct taas_busy_reply *b, const uint8_t *req, enum req_kind kind,
+                      uint64_t wait_ticks)
+{
+    const struct taas_hdr *hdr = (const struct taas_hdr *)req;
+    uint64_t us = wait_ticks * 1000000ULL / timer_hz + 1;
+    int versioned = kind != REQ_TSA;
+
+    b->hdr.magic      = TAAS_MAGIC;
+    b->hdr.version    = TAAS_VERSION;
+    b->hdr.type       = TAAS_MSG_BUSY;
+    b->hdr.flags      = 0;
+    b->hdr.request_id = versioned ? hdr->request_id : 0;
+    b->retry_after_us = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+    memcpy(b->hash_prefix, versioned ? req + sizeof(*hdr) : req, sizeof(b->hash_prefix));
+}
+
+/*
+ * classify_request - Map a received datagram to its reply mode.
+ * Authenticated modes degrade to raw when no key is loaded.
+ */
+static inline enum req_kind classify_request(const uint8_t *buf, unsigned int len, int flags)
+{
+    const struct taas_hdr *hdr = (const struct taas_hdr *)buf;
+
+    if (flags & MSG_TRUNC)
+        return REQ_RAW;
+
+    if (len == 32)
+        return pkey ? REQ_TSA : REQ_RAW;
+
+    if (len < sizeof(*hdr) || hdr->magic != TAAS_MAGIC ||
+        hdr->version != TAAS_VERSION || hdr->flags != 0)
+        return REQ_RAW;
+
+    switch (hdr->type) {
+    case TAAS_MSG_BATCH_REQ:
+        if (pkey && len > sizeof(*hdr) && len <= TAAS_BATCH_REQ_SIZE(TAAS_BATCH_MAX_HASHES) &&
+            (len - sizeof(*hdr)) % 32 == 0)
+            return REQ_BATCH;
+        break;
+    case TAAS_MSG_HMAC_REQ:
+        if (nr_hmac_keys && len == sizeof(struct taas_hmac_request))
+            return REQ_HMAC;
+        break;
+    case TAAS_MSG_TIME_REQ:
+        if (len == sizeof(struct taas_time_request))
+            return REQ_TIME;
+        break;
+    case TAAS_MSG_EXT_TIME_REQ:
+        if (len == sizeof(struct taas_ext_time_request))
+            return REQ_EXT_TIME;
+        break;
+    case TAAS_MSG_EXT_TSA_REQ:
+        if (pkey && len == sizeof(struct taas_ext_tsa_request))
+            return REQ_EXT_TSA;
+        break;
+    }
+    return REQ_RAW;
+}
+
+/* Kinds that cost a signature: charged to the signed budget, sent to a signer */
+static inline int signed_kind(enum req_kind k)
+{
+    return k == REQ_TSA || k == REQ_BATCH || k == REQ_EXT_TSA;
+}
+
+/*
+ * hmac_lookup - Index of a shared key by id, or -1.
+ */
+static inline int hmac_lookup(uint32_t key_id)
+{
+    for (unsigned int i = 0; i < nr_hmac_keys; i++)
+        if (hmac_key_ids[i] == key_id)
+            return (int)i;
+    return -1;
+}
+
+/*
+ * serve_hmac - Build an HMAC-authenticated time reply on core 3.
+ *
+ * EVP_MAC_init() with a NULL key rewinds to the precomputed keyed
+ * state, so each tag is two SHA-256 passes over ~44 bytes. OpenSSL
+ * dispatches those to the ARMv8 SHA-256 instructions at runtime.
+ * Returns 0, or -1 for an unknown key (the caller falls back to raw).
+ */
+static int serve_hmac(struct taas_hmac_reply *rep, const struct taas_hmac_request *req,
+                      uint64_t utc_ns)
+{
+    int idx = hmac_lookup(req->key_id);
+    EVP_MAC_CTX *ctx;
+    size_t tag_len;
+
+    if (idx < 0)
+        return -1;
+    ctx = hmac_ctx[idx];
+
+    rep->hdr.magic      = TAAS_MAGIC;
+    rep->hdr.version    = TAAS_VERSION;
+    rep->hdr.type       = TAAS_MSG_HMAC_REPLY;
+    rep->hdr.flags      = 0;
+    rep->hdr.request_id = req->hdr.request_id;
+    rep->key_id         = req->key_id;
+    rep->reserved       = 0;
+    memcpy(rep->nonce, req->nonce, sizeof(rep->nonce));
+    rep->utc_timestamp_ns = utc_ns;
+
+    if (EVP_MAC_init(ctx, NULL, 0, NULL) != 1 ||
+        EVP_MAC_update(ctx, (const uint8_t *)rep, offsetof(struct taas_hmac_reply, tag)) != 1 ||
+        EVP_MAC_final(ctx, rep->tag, &tag_len, sizeof(rep->tag)) != 1)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * load_hmac_keys - Read shared keys for HMAC mode at startup.
+ *
+ * Format: one "<key_id> <hex key>" per line, '#' starts a comment.
+ * Keys must be 16-64 bytes. A missing file simply disables the mode.
+ */
+static void load_hmac_keys(const char *path)
+{
+    OSSL_PARAM params[2];
+    char line[256];
+    FILE *fp = fopen(path, "r");
+
+    if (!fp)
+        return;
+
+    hmac_alg = EVP_MAC_fetch(NULL, "HMAC", NULL);
+    if (!hmac_alg) {
+        fprintf(stderr, "taas: warning: HMAC unavailable, shared keys ignored\n");
+        fclose(fp);
+        return;
+    }
+    params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0);
+    params[1] = OSSL_PARAM_construct_end();
+
+    while (fgets(line, sizeof(line), fp) && nr_hmac_keys < HMAC_MAX_KEYS) {
+        unsigned int key_id;
+        char hex[160];
+        unsigned char *key;
+        long key_len;
+
+        if (line[0] == '#' || sscanf(line, "%u %159s", &key_id, hex) != 2)
+            continue;
+
+        key = OPENSSL_hexstr2buf(hex, &key_len);
+        if (!key || key_len < 16 || key_len > 64 || hmac_lookup(key_id) >= 0) {
+            fprintf(stderr, "taas: warning: bad HMAC key %u skipped\n", key_id);
+            OPENSSL_clear_free(key, key ? (size_t)key_len : 0);
+            continue;
+        }
+
+        EVP_MAC_CTX *ctx = EVP_MAC_CTX_new(hmac_alg);
+        if (!ctx || EVP_MAC_init(ctx, key, (size_t)key_len, params) != 1) {
+            EVP_MAC_CTX_free(ctx);
+            OPENSSL_clear_free(key, (size_t)key_len);
+            continue;
+        }
+        OPENSSL_clear_free(key, (size_t)key_len);
+
+        hmac_key_ids[nr_hmac_keys] = key_id;
+        hmac_ctx[nr_hmac_keys] = ctx;
+        nr_hmac_keys++;
+    }
+    fclose(fp);
+
+    printf("[TaaS] Loaded %u HMAC key(s).\n", nr_hmac_keys);
+}
+
+/*
+ * sign_message - Ed25519 signature of an arbitrary message, with the
+ * key expanded at startup: no allocation, safe from any thread.
+ */
+static inline void sign_message(uint8_t sig[64], const uint8_t *msg, size_t len)
+{
+    _Atomic unsigned int *use = key_use;
+    unsigned int idx;
+
+    if (!use) {
+        /* Core 3 is where reloads run: the slot cannot change under it */
+        taas_ed25519_sign(sig, &sign_key[atomic_load_explicit(&sign_key_idx,
+                                                              memory_order_acquire)], msg, len);
+        return;
+    }
+
+    /* Announce the slot, then make sure it is still the current one:
+     * either reload_sign_key() sees the announcement, or this sees its
+     * flip and moves on to the new slot.
+     */
+    do {
+        idx = atomic_load_explicit(&sign_key_idx, memory_order_acquire);
+        atomic_store(use, idx + 1);
+    } while (atomic_load(&sign_key_idx) != idx);
+
+    taas_ed25519_sign(sig, &sign_key[idx], msg, len);
+    atomic_store_explicit(use, 0, memory_order_release);
+}
+
+static inline uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * expand_sign_key - Expand a PEM key for taas_ed25519_sign() into k
+ * and check one signature against OpenSSL before trusting it.
+ * Returns 0 if the key is usable.
+ */
+static int expand_sign_key(EVP_PKEY *key, struct taas_ed25519_key *k)
+{
+    static const uint8_t probe[40] = "taas signing self-check";
+    uint8_t seed[TAAS_ED25519_SEED_LEN], ours[64], ref[64];
+    size_t seed_len = sizeof(seed), ref_len = sizeof(ref);
+    EVP_MD_CTX *ctx;
+    int ok = 0;
+
+    if (EVP_PKEY_get_raw_private_key(key, seed, &seed_len) == 1 && seed_len == sizeof(seed)) {
+        taas_ed25519_expand(k, seed);
+        taas_ed25519_sign(ours, k, probe, sizeof(probe));
+
+        ctx = EVP_MD_CTX_new();
+        ok = ctx && EVP_DigestSignInit(ctx, NULL, NULL, NULL, key) == 1 &&
+             EVP_DigestSign(ctx, ref, &ref_len, probe, sizeof(probe)) == 1 &&
+             memcmp(ours, ref, sizeof(ref)) == 0;
+        EVP_MD_CTX_free(ctx);
+    }
+    explicit_bzero(seed, sizeof(seed));
+
+    return ok ? 0 : -1;
+}
+
+/*
+ * load_sign_key - Make the PEM key the signing key at startup. On any
+ * failure TSA stays off (pkey NULL) rather than serving certificates
+ * that would not verify.
+ */
+static void load_sign_key(void)
+{
+    if (!pkey)
+        return;
+
+    if (expand_sign_key(pkey, &sign_key[0]) < 0) {
+        fprintf(stderr, "taas: signing key is not a usable Ed25519 key, TSA disabled\n");
+        EVP_PKEY_free(pkey);
+        pkey = NULL;
+    }
+}
+
+/*
+ * reload_sign_key - SIGHUP: swap in the key now in KEY_FILE (core 3).
+ *
+ * The new key is expanded into the spare slot and checked like at
+ * startup before signers switch to it; anything wrong with it keeps
+ * the current key. A node started without a key has no signers and
+ * classifies TSA requests as raw, so it needs a restart instead.
+ */
+static void reload_sign_key(void)
+{
+    unsigned int next = 1 - atomic_load_explicit(&sign_key_idx, memory_order_relaxed);
+    char pub[2 * sizeof(sign_key[0].pub) + 1];
+    EVP_PKEY *key = NULL;
+    FILE *fp;
+
+    if (!pkey) {
+        fprintf(stderr, "taas: warning: started without a signing key, restart to enable TSA\n");
+        return;
+    }
+    for (unsigned int i = 0; i < SIGNER_THREADS_MAX + 1; i++) {
+        if (atomic_load(&sign_key_use[i]) == next + 1) {
+            fprintf(stderr, "taas: warning: a signer is still using the previous key, "
+                    "reload ignored, try again\n");
+            return;
+        }
+    }
+
+    fp = fopen(KEY_FILE, "r");
+    if (fp) {
+        key = PEM_read_PrivateKey(fp, NULL, NULL, NULL);
+        fclose(fp);
+    }
+    if (!key || expand_sign_key(key, &sign_key[next]) < 0) {
+        fprintf(stderr, "taas: warning: %s is not a usable Ed25519 key, keeping the current one\n",
+                KEY_FILE);
+        EVP_PKEY_free(key);
+        return;
+    }
+
+    atomic_store_explicit(&sign_key_idx, next, memory_order_release);
+    EVP_PKEY_free(pkey);
+    pkey = key;
+
+    for (unsigned int i = 0; i < sizeof(sign_key[next].pub); i++)
+        snprintf(pub + 2 * i, 3, "%02x", sign_key[next].pub[i]);
+    printf("[TaaS] Signing key reloaded from %s, public key %s.\n", KEY_FILE, pub);
+}
+
+/*
+ * sign_certificate - Ed25519 over client_hash || utc_timestamp_ns.
+ */
+static void sign_certificate(struct taas_certificate *cert)
+{
+    /* The certificate is packed: the 40 signed bytes are its first 40 */
+    sign_message(cert->signature, cert->client_hash, 40);
+}
+
+/*
+ * sign_ext_certificate - Stamp and sign an extended certificate whose
+ * request_id and client_hash are already in place, as they are in a
+ * request answered in its own slot. The signed 40 bytes are the same
+ * as in a taas_certificate and lie back to back in the reply;
+ * tx_timestamp_ns is left to the sender.
+ */
+static void sign_ext_certificate(struct taas_ext_certificate *ec, uint64_t utc_ns)
+{
+    ec->hdr.magic      = TAAS_MAGIC;
+    ec->hdr.version    = TAAS_VERSION;
+    ec->hdr.type       = TAAS_MSG_EXT_CERT;
+    ec->hdr.flags      = 0;
+    ec->utc_timestamp_ns = utc_ns;
+
+    sign_message(ec->signature, ec->client_hash, 40);
+}
+
+/*
+ * sign_batch - Fill and sign a batch reply for a stamped batch job.
+ * Returns the number of bytes to send.
+ */
+static size_t sign_batch(struct taas_batch_certificate *bc, const struct sign_job *job)
+{
+    uint8_t data_to_sign[TAAS_BATCH_MAX_HASHES * 32 + 8];
+    size_t hashes_len = (size_t)job->count * 32;
+
+    bc->hdr.magic      = TAAS_MAGIC;
+    bc->hdr.version    = TAAS_VERSION;
+    bc->hdr.type       = TAAS_MSG_BATCH_CERT;
+    bc->hdr.flags      = 0;
+    bc->hdr.request_id = job->request_id;
+    bc->count          = job->count;
+    bc->reserved       = 0;
+    bc->utc_timestamp_ns = job->utc_timestamp_ns;
+    memcpy(bc->client_hash, job->client_hash, hashes_len);
+
+    memcpy(data_to_sign, job->client_hash, hashes_len);
+    memcpy(data_to_sign + hashes_len, &job->utc_timestamp_ns, 8);
+    sign_message(bc->signature, data_to_sign, hashes_len + 8);
+
+    return TAAS_BATCH_CERT_SIZE(job->count);
+}
+
+/*
+ * fill_job - Copy a stamped signed-mode request into a job on core 3.
+ */
+static inline void fill_job(struct sign_job *job, enum req_kind kind, int sockfd,
+                            const struct mmsghdr *msg, uint64_t utc_ns, uint64_t rx_ticks)
+{
+    const uint8_t *buf = msg->msg_hdr.msg_iov->iov_base;
+    unsigned int len = msg->msg_len;
+
+    if (kind == REQ_BATCH) {
+        const struct taas_hdr *hdr = (const struct taas_hdr *)buf;
+
+        job->count = (uint16_t)((len - sizeof(*hdr)) / 32);
+        job->ext = 0;
+        job->request_id = hdr->request_id;
+        memcpy(job->client_hash, buf + sizeof(*hdr), (size_t)job->count * 32);
+    } else if (kind == REQ_EXT_TSA) {
+        const struct taas_hdr *hdr = (const struct taas_hdr *)buf;
+
+        job->count = 0;
+        job->ext = 1;
+        job->request_id = hdr->request_id;
+        memcpy(job->client_hash[0], buf + sizeof(*hdr), 32);
+    } else {
+        job->count = 0;
+        job->ext = 0;
+        job->request_id = 0;
+        memcpy(job->client_hash[0], buf, 32);
+    }
+    memcpy(&job->cliaddr, msg->msg_hdr.msg_name, msg->msg_hdr.msg_namelen);
+    job->addrlen = msg->msg_hdr.msg_namelen;
+    job->sockfd = sockfd;
+    job->utc_timestamp_ns = utc_ns;
+    job->rx_ticks = rx_ticks;
+}
+
+static long futex(_Atomic uint32_t *uaddr, int op, uint32_t val,
+                  const struct timespec *timeout)
+{
+    return syscall(SYS_futex, uaddr, op, val, timeout, NULL, 0);
+}
+
+/*
+ * ring_reserve - Claim the next free slot on core 3. Never blocks.
+ * The job is written in place and published with ring_commit().
+ * Returns NULL if the ring is full.
+ */
+static inline struct sign_job *ring_reserve(struct sign_ring *r)
+{
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+    if (head - tail == SIGN_RING_SIZE)
+        return NULL;
+
+    return &r->jobs[head & (SIGN_RING_SIZE - 1)];
+}
+
+static inline void ring_commit(struct sign_ring *r)
+{
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+/*
+ * ring_kick - Wake the consumer if it parked on an empty ring.
+ *
+ * Called once per batch, not per job. The futex syscall is only paid
+ * when the signer is actually asleep, so a busy pipeline costs core 3
+ * nothing beyond a shared cache line load.
+ */
+static inline void ring_kick(struct sign_ring *r)
+{
+    /* Order the head store above against the sleeping load (Dekker) */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&r->sleeping, memory_order_relaxed) &&
+        atomic_exchange(&r->sleeping, 0))
+        futex(&r->sleeping, FUTEX_WAKE_PRIVATE, 1, NULL);
+}
+
+/*
+ * offload_tsa - Stamp a request straight into the next signer with room.
+ * Round-robin spreads load across cores; a full ring is skipped.
+ * Returns the ring index used, or -1 if every ring is full and the
+ * request must be shed (core 3 never waits for a signer).
+ */
+static int offload_tsa(enum req_kind kind, int sockfd, const struct mmsghdr *msg,
+                       uint64_t utc_ns, uint64_t rx_ticks)
+{
+    static unsigned int next;
+
+    for (unsigned int i = 0; i < nr_signers; i++) {
+        unsigned int idx = next;
+        struct sign_job *job;
+
+        next = (next + 1 == nr_signers) ? 0 : next + 1;
+        job = ring_reserve(&signers[idx].ring);
+        if (job) {
+            fill_job(job, kind, sockfd, msg, utc_ns, rx_ticks);
+            ring_commit(&signers[idx].ring);
+            return (int)idx;
+        }
+    }
+    return -1;
+}
+
+/*
+ * ring_peek - Oldest unconsumed job on the signer side, or NULL.
+ * The slot stays owned by the signer until ring_release().
+ */
+static inline const struct sign_job *ring_peek(struct sign_ring *r)
+{
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+    if (tail == head)
+        return NULL;
+
+    return &r->jobs[tail & (SIGN_RING_SIZE - 1)];
+}
+
+static inline void ring_release(struct sign_ring *r)
+{
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+/*
+ * ring_park - Sleep until core 3 kicks the ring or the timeout expires.
+ * timeout is relative; NULL waits forever.
+ */
+static void ring_park(struct sign_ring *r, const struct timespec *timeout)
+{
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    /* Announce we are parking, then re-check to close the race
+     * with a push that happened before the flag became visible.
+     */
+    atomic_store(&r->sleeping, 1);
+    if (atomic_load(&r->head) == tail)
+        futex(&r->sleeping, FUTEX_WAIT_PRIVATE, 1, timeout);
+    atomic_store_explicit(&r->sleeping, 0, memory_order_relaxed);
+}
+
+static void merkle_hash_node(uint8_t out[32], const uint8_t left[32], const uint8_t right[32])
+{
+    uint8_t buf[65];
+
+    buf[0] = TAAS_MERKLE_NODE_PREFIX;
+    memcpy(buf + 1, left, 32);
+    memcpy(buf + 33, right, 32);
+    SHA256(buf, sizeof(buf), out);
+}
+
+/*
+ * merkle_seal - Build the tree over one window, sign its root once,
+ * and send every client its leaf with the audit path.
+ *
+ * All levels are kept in mb->tree back to back (leaves first) so the
+ * audit paths can be read straight out of it after the root is known.
+ */
+static void merkle_seal(struct signer *s, unsigned int n)
+{
+    struct merkle_batch *mb = &s->merkle;
+    unsigned int level_off[TAAS_MERKLE_MAX_DEPTH + 1];
+    unsigned int depth = 0, off = 0, cnt = n;
+    uint8_t signature[64];
+    uint64_t t_sign, t_signed;
+
+    for (unsigned int i = 0; i < n; i++) {
+        uint8_t leaf[41];
+
+        leaf[0] = TAAS_MERKLE_LEAF_PREFIX;
+        memcpy(leaf + 1, mb->leaves[i].client_hash, 32);
+        memcpy(leaf + 33, &mb->leaves[i].utc_timestamp_ns, 8);
+        SHA256(leaf, sizeof(leaf), mb->tree[i]);
+    }
+
+    level_off[0] = 0;
+    while (cnt > 1) {
+        unsigned int next = off + cnt;
+
+        for (unsigned int i = 0; i < cnt / 2; i++)
+            merkle_hash_node(mb->tree[next + i], mb->tree[off + 2 * i], mb->tree[off + 2 * i + 1]);
+        if (cnt & 1)
+            memcpy(mb->tree[next + cnt / 2], mb->tree[off + cnt - 1], 32);
+
+        off = next;
+        cnt = (cnt + 1) / 2;
+        level_off[++depth] = off;
+    }
+
+    /* One signature for the whole window */
+    t_sign = tel_ticks(s->tel);
+    sign_message(signature, mb->tree[off], 32);
+    t_signed = tel_ticks(s->tel);
+
+    for (unsigned int i = 0; i < n; i++) {
+        struct taas_merkle_certificate *mc = &mb->certs[i];
+        unsigned int idx = i, width = n, p = 0;
+
+        memcpy(mc->client_hash, mb->leaves[i].client_hash, 32);
+        mc->utc_timestamp_ns = mb->leaves[i].utc_timestamp_ns;
+        memcpy(mc->signature, signature, sizeof(signature));
+        mc->leaf_index = (uint16_t)i;
+        mc->leaf_count = (uint16_t)n;
+
+        for (unsigned int l = 0; l < depth; l++) {
+            unsigned int sib = idx ^ 1;
+
+            if (sib < width)
+                memcpy(mc->path[p++], mb->tree[level_off[l] + sib], 32);
+            idx >>= 1;
+            width = (width + 1) / 2;
+        }
+        mc->path_len = (uint8_t)p;
+
+        mb->iov[i].iov_base = mc;
+        mb->iov[i].iov_len  = TAAS_MERKLE_CERT_SIZE(p);
+        mb->msgs[i].msg_hdr.msg_iov     = &mb->iov[i];
+        mb->msgs[i].msg_hdr.msg_iovlen  = 1;
+        mb->msgs[i].msg_hdr.msg_name    = &mb->leaves[i].cliaddr;
+        mb->msgs[i].msg_hdr.msg_namelen = mb->leaves[i].addrlen;
+    }
+
+    /* One sendmmsg() per run of leaves that came in on the same listener */
+    for (unsigned int i = 0, run; i < n; i += run) {
+        for (run = 1; i + run < n && mb->leaves[i + run].sockfd == mb->leaves[i].sockfd; run++)
+            ;
+        unsigned int sent = send_batch(mb->leaves[i].sockfd, mb->msgs + i, run, NULL);
+
+        if (s->tel && sent < run)
+            taas_tel_add(&s->tel->tx_errors, run - sent);
+    }
+
+    if (s->tel) {
+        uint64_t now = get_hardware_ticks();
+
+        /* The window's single signature is accounted once */
+        for (unsigned int i = 0; i < n; i++)
+            taas_tel_record(s->tel, TAAS_TEL_TSA, now - mb->leaves[i].rx_ticks,
+                            i ? 0 : t_signed - t_sign);
+    }
+}
+
+/*
+ * serve_job - Sign one job and send its reply (non-aggregated path).
+ */
+static void serve_job(struct signer *s, const struct sign_job *job)
+{
+    uint64_t t_sign = tel_ticks(s->tel), t_signed;
+
+    if (job->count) {
+        size_t len = sign_batch(&s->bcert, job);
+
+        t_signed = tel_ticks(s->tel);
+        sendto(job->sockfd, &s->bcert, len, 0,
+               (const struct sockaddr *)&job->cliaddr, job->addrlen);
+    } else if (job->ext) {
+        struct taas_ext_certificate ec;
+        struct time_anchor a;
+
+        ec.hdr.request_id = job->request_id;
+        memcpy(ec.client_hash, job->client_hash[0], 32);
+        sign_ext_certificate(&ec, job->utc_timestamp_ns);
+        t_signed = tel_ticks(s->tel);
+        anchor_snapshot(&a);
+        ec.tx_timestamp_ns = anchor_ticks_to_utc(&a, get_hardware_ticks());
+        sendto(job->sockfd, &ec, sizeof(ec), 0,
+               (const struct sockaddr *)&job->cliaddr, job->addrlen);
+    } else {
+        struct taas_certificate cert;
+
+        memcpy(cert.client_hash, job->client_hash[0], 32);
+        cert.utc_timestamp_ns = job->utc_timestamp_ns;
+        sign_certificate(&cert);
+        t_signed = tel_ticks(s->tel);
+        sendto(job->sockfd, &cert, sizeof(cert), 0,
+               (const struct sockaddr *)&job->cliaddr, job->addrlen);
+    }
+
+    if (s->tel)
+        taas_tel_record(s->tel, job->count ? TAAS_TEL_BATCH : TAAS_TEL_TSA,
+                        get_hardware_ticks() - job->rx_ticks, t_signed - t_sign);
+}
+
+/*
+ * merkle_take - Consume one job into the open aggregation window.
+ * Batch jobs already amortize their signature and are served directly,
+ * and so are extended ones: their reply has no room for a path.
+ * Returns 1 if a leaf was added, 0 otherwise, -1 if the ring is empty.
+ */
+static int merkle_take(struct signer *s, unsigned int n)
+{
+    const struct sign_job *job = ring_peek(&s->ring);
+    int added = 0;
+
+    if (!job)
+        return -1;
+
+    if (job->count || job->ext) {
+        serve_job(s, job);
+    } else {
+        struct merkle_leaf *leaf = &s->merkle.leaves[n];
+
+        memcpy(leaf->client_hash, job->client_hash[0], 32);
+        leaf->utc_timestamp_ns = job->utc_timestamp_ns;
+        leaf->rx_ticks = job->rx_ticks;
+        leaf->cliaddr = job->cliaddr;
+        leaf->addrlen = job->addrlen;
+        leaf->sockfd = job->sockfd;
+        added = 1;
+    }
+    ring_release(&s->ring);
+    return added;
+}
+
+/*
+ * signer_aggregate - Aggregating consumer loop.
+ *
+ * A window opens with the first leaf and is sealed when it reaches
+ * merkle_leaves entries or merkle_window_us has elapsed, whichever
+ * comes first. Leaves keep the timestamps core 3 gave them.
+ */
+static void signer_aggregate(struct signer *s)
+{
+    struct sign_ring *r = &s->ring;
+    const uint64_t window_ns = (uint64_t)merkle_window_us * 1000;
+
+    while (1) {
+        unsigned int n = 0;
+        uint64_t deadline;
+        int ret;
+
+        while ((ret = merkle_take(s, 0)) <= 0)
+            if (ret < 0)
+                ring_park(r, NULL);
+        n = 1;
+        deadline = monotonic_ns() + window_ns;
+
+        while (n < merkle_leaves) {
+            ret = merkle_take(s, n);
+            if (ret >= 0) {
+                n += (unsigned int)ret;
+                continue;
+            }
+
+            uint64_t now = monotonic_ns();
+            if (now >= deadline)
+                break;
+
+            struct timespec left = {
+                .tv_sec  = (deadline - now) / 1000000000ULL,
+                .tv_nsec = (deadline - now) % 1000000000ULL,
+            };
+            ring_park(r, &left);
+        }
+
+        merkle_seal(s, n);
+    }
+}
+
+/*
+ * signer_main - Consumer side of one signing ring (cores 0-2).
+ */
+static void *signer_main(void *arg)
+{
+    struct signer *s = arg;
+    struct sign_ring *r = &s->ring;
+    cpu_set_t cpuset;
+
+    key_use = &sign_key_use[s - signers];
+    CPU_ZERO(&cpuset);
+    CPU_SET(s->cpu, &cpuset);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+        fprintf(stderr, "taas: warning: signer affinity to core %d failed\n", s->cpu);
+
+    if (merkle_window_us) {
+        signer_aggregate(s);
+        return NULL;
+    }
+
+    while (1) {
+        const struct sign_job *job = ring_peek(r);
+
+        if (!job) {
+            ring_park(r, NULL);
+            continue;
+        }
+
+        serve_job(s, job);
+        ring_release(r);
+    }
+
+    return NULL;
+}
+
+static void merkle_free(struct merkle_batch *mb)
+{
+    free(mb->leaves);
+    free(mb->tree);
+    free(mb->certs);
+    free(mb->iov);
+    free(mb->msgs);
+    memset(mb, 0, sizeof(*mb));
+}
+
+/*
+ * merkle_alloc - Preallocate one window's worth of scratch space.
+ * Done before the real-time loop so mlockall() pins it up front.
+ */
+static int merkle_alloc(struct merkle_batch *mb, unsigned int leaves)
+{
+    mb->leaves = calloc(leaves, sizeof(*mb->leaves));
+    mb->tree   = calloc(2 * leaves + TAAS_MERKLE_MAX_DEPTH, sizeof(*mb->tree));
+    mb->certs  = calloc(leaves, sizeof(*mb->certs));
+    mb->iov    = calloc(leaves, sizeof(*mb->iov));
+    mb->msgs   = calloc(leaves, sizeof(*mb->msgs));
+
+    if (!mb->leaves || !mb->tree || !mb->certs || !mb->iov || !mb->msgs) {
+        merkle_free(mb);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * start_signers - Spawn the signing pipeline on the housekeeping cores.
+ *
+ * Signers run SCHED_OTHER: they must never starve the OS on cores 0-2,
+ * and their latency is dominated by the signature itself anyway.
+ * Returns the number of threads started; 0 means sign inline.
+ */
+static unsigned int start_signers(unsigned int count)
+{
+    struct sched_param sp = { .sched_priority = 0 };
+    pthread_attr_t attr;
+    unsigned int started = 0;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, SIGNER_STACK_SIZE);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    pthread_attr_setschedparam(&attr, &sp);
+
+    for (unsigned int i = 0; i < count; i++) {
+        struct signer *s = &signers[started];
+
+        if (merkle_window_us && merkle_alloc(&s->merkle, merkle_leaves) < 0)
+            break;
+        s->cpu = (int)i;
+        s->tel = tel ? &tel->seg[1 + started] : NULL;
+
+        if (pthread_create(&s->thread, &attr, signer_main, s) != 0) {
+            perror("taas: warning: signer thread");
+            merkle_free(&s->merkle);
+            break;
+        }
+        started++;
+    }
+
+    pthread_attr_destroy(&attr);
+    return started;
+}
+
+/*
+ * parse_addr - ADDR[%IFACE] to a socket address on port.
+ *
+ * ADDR is an IPv4 or IPv6 literal. The interface name, if any, is
+ * copied to ifname (IF_NAMESIZE bytes, "" without one) and scopes a
+ * link-local IPv6 address. Returns the address length, or 0.
+ */
+static socklen_t parse_addr(const char *spec, uint16_t port, union peer_addr *addr, char *ifname)
+{
+    char host[INET6_ADDRSTRLEN + IF_NAMESIZE + 1];
+    char *pct;
+
+    snprintf(host, sizeof(host), "%s", spec);
+    ifname[0] = '\0';
+    pct = strchr(host, '%');
+    if (pct) {
+        *pct = '\0';
+        snprintf(ifname, IF_NAMESIZE, "%s", pct + 1);
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    if (inet_pton(AF_INET, host, &addr->v4.sin_addr) == 1) {
+        addr->v4.sin_family = AF_INET;
+        addr->v4.sin_port = htons(port);
+        return sizeof(addr->v4);
+    }
+    if (inet_pton(AF_INET6, host, &addr->v6.sin6_addr) == 1) {
+        addr->v6.sin6_family = AF_INET6;
+        addr->v6.sin6_port = htons(port);
+        if (ifname[0] && (IN6_IS_ADDR_LINKLOCAL(&addr->v6.sin6_addr) ||
+                          IN6_IS_ADDR_MC_LINKLOCAL(&addr->v6.sin6_addr)))
+            addr->v6.sin6_scope_id = if_nametoindex(ifname);
+        return sizeof(addr->v6);
+    }
+    return 0;
+}
+
+/*
+ * listener_options - Socket options that follow the command line, set
+ * on every listener whether opened here or taken over from a previous
+ * instance.
+ */
+static void listener_options(int fd)
+{
+    int one = 1;
+
+    if (busy_poll_us) {
+        /* SPIN MODE
+         * Core 3 is ours: never sleep in the kernel. Where the driver
+         * supports it every receive also polls the NIC queue directly
+         * (SO_BUSY_POLL), preferring that over interrupts
+         * (SO_PREFER_BUSY_POLL).
+         */
+        if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us, sizeof(busy_poll_us)) < 0)
+            perror("taas: warning: SO_BUSY_POLL unsupported");
+        if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one)) < 0)
+            perror("taas: warning: SO_PREFER_BUSY_POLL unsupported");
+    }
+
+    if (two_step) {
+        /* TX stamps are requested per reply (see serve_socket()); the
+         * socket only numbers them (OPT_ID, from 0) and keeps the
+         * payload out of the error queue (OPT_TSONLY).
+         */
+        int flags = SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY |
+                    SOF_TIMESTAMPING_SOFTWARE |
+                    (rx_timestamps ? SOF_TIMESTAMPING_RX_SOFTWARE : 0);
+
+        if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+            perror("taas: warning: TX timestamps unavailable, --two-step off");
+            two_step = 0;
+        }
+    }
+
+    if (rx_timestamps && !two_step) {
+        int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+
+        if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+            perror("taas: warning: SO_TIMESTAMPING unavailable, stamping on arrival in loop");
+            rx_timestamps = 0;
+        }
+    }
+}
+
+/*
+ * open_listener - Create and bind one UDP socket from ADDR[%IFACE].
+ *
+ * %IFACE binds the socket to that interface with SO_BINDTODEVICE.
+ * IPv6 sockets are IPv6-only, so "0.0.0.0" and "::" can be served
+ * side by side. Returns the socket, or -1.
+ */
+static int open_listener(const char *spec)
+{
+    char ifname[IF_NAMESIZE];
+    union peer_addr addr;
+    socklen_t addrlen;
+    int fd, one = 1;
+
+    addrlen = parse_addr(spec, PTP_PORT, &addr, ifname);
+    if (!addrlen) {
+        fprintf(stderr, "taas: --listen %s: not an IPv4 or IPv6 address\n", spec);
+        return -1;
+    }
+
+    fd = socket(addr.sa.sa_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("taas: socket creation");
+        return -1;
+    }
+
+    if (addr.sa.sa_family == AF_INET6 &&
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &one, sizeof(one)) < 0)
+        perror("taas: warning: IPV6_V6ONLY failed");
+
+    if (ifname[0] && setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, ifname,
+                             (socklen_t)strlen(ifname)) < 0) {
+        fprintf(stderr, "taas: --listen %s: SO_BINDTODEVICE: %s\n", spec, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    listener_options(fd);
+
+    if (bind(fd, &addr.sa, addrlen) < 0) {
+        fprintf(stderr, "taas: bind %s: %s\n", spec, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    printf("[TaaS] Listening on %s port %d.\n", spec, PTP_PORT);
+    return fd;
+}
+
+/*
+ * open_listeners - Open every --listen socket, or the wildcard pair.
+ * An explicit address that fails is fatal; of the default pair, one
+ * is enough (IPv6 may well be disabled on the host).
+ */
+static int open_listeners(void)
+{
+    static const char *const wildcard[] = { "0.0.0.0", "::" };
+    int fd;
+
+    if (!nr_listen_specs) {
+        for (unsigned int i = 0; i < 2; i++) {
+            fd = open_listener(wildcard[i]);
+            if (fd >= 0)
+                listen_fd[nr_listeners++] = fd;
+        }
+        return nr_listeners ? 0 : -1;
+    }
+
+    for (unsigned int i = 0; i < nr_listen_specs; i++) {
+        fd = open_listener(listen_spec[i]);
+        if (fd < 0)
+            return -1;
+        listen_fd[nr_listeners++] = fd;
+    }
+    return 0;
+}
+
+/*
+ * sd_notify - Tell systemd about a state change (Type=notify), without
+ * linking libsystemd. Does nothing outside a service.
+ */
+static void sd_notify(const char *msg)
+{
+    const char *path = getenv("NOTIFY_SOCKET");
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    size_t len;
+    int fd;
+
+    if (!path || (path[0] != '/' && path[0] != '@'))
+        return;
+    len = strlen(path);
+    if (len >= sizeof(sun.sun_path))
+        return;
+    memcpy(sun.sun_path, path, len);
+    if (sun.sun_path[0] == '@')
+        sun.sun_path[0] = '\0';     /* abstract namespace */
+
+    fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return;
+    if (sendto(fd, msg, strlen(msg), MSG_NOSIGNAL, (const struct sockaddr *)&sun,
+               (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len)) < 0)
+        perror("taas: warning: sd_notify");
+    close(fd);
+}
+
+/*
+ * handoff_listen - Open the socket a successor takes over through.
+ * Whatever is at the path belongs to an instance that is gone or on
+ * its way out, so it is replaced. Failure only rules out handover.
+ */
+static void handoff_listen(void)
+{
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    mode_t mask;
+
+    snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", HANDOFF_SOCK);
+    handoff_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (handoff_fd < 0) {
+        perror("taas: warning: handover socket");
+        return;
+    }
+
+    unlink(sun.sun_path);
+    mask = umask(077);
+    if (bind(handoff_fd, (const struct sockaddr *)&sun, sizeof(sun)) < 0 ||
+        listen(handoff_fd, 1) < 0) {
+        fprintf(stderr, "taas: warning: %s: %s, handover disabled\n", HANDOFF_SOCK, strerror(errno));
+        close(handoff_fd);
+        handoff_fd = -1;
+    }
+    umask(mask);
+}
+
+/*
+ * signers_drain - Let the signers answer what core 3 already gave
+ * them, for up to HANDOFF_DRAIN_MS. An open Merkle window is sealed
+ * at most merkle_window_us after its ring runs empty.
+ */
+static void signers_drain(void)
+{
+    const struct timespec nap = { .tv_nsec = 100000 };
+    uint64_t deadline = monotonic_ns() + HANDOFF_DRAIN_MS * 1000000ULL;
+
+    for (unsigned int i = 0; i < nr_signers; i++) {
+        struct sign_ring *r = &signers[i].ring;
+
+        while (atomic_load_explicit(&r->tail, memory_order_acquire) !=
+               atomic_load_explicit(&r->head, memory_order_relaxed) && monotonic_ns() < deadline)
+            nanosleep(&nap, NULL);
+    }
+    if (merkle_window_us) {
+        struct timespec window = {
+            .tv_sec  = merkle_window_us / 1000000,
+            .tv_nsec = (long)(merkle_window_us % 1000000) * 1000 + nap.tv_nsec,
+        };
+
+        nanosleep(&window, NULL);
+    }
+}
+
+/*
+ * handoff_serve - A successor connected: hand it the listeners and the
+ * clock state (core 3).
+ *
+ * The loop stops serving for the duration, so requests wait in the
+ * socket buffers rather than being lost, and the state sent is final.
+ * The successor acknowledges once it owns the service (MAINPID under
+ * systemd). Returns 0 when this instance should exit, 1 if the
+ * handover failed and it keeps serving.
+ */
+static int handoff_serve(void)
+{
+    const struct timeval tv = { .tv_sec = HANDOFF_TIMEOUT_SEC };
+    union {
+        struct cmsghdr align;
+        uint8_t buf[CMSG_SPACE(sizeof(int) * (LISTEN_MAX + 2))];
+    } ctrl;
+    unsigned int nfds = nr_listeners + (ptp ? 2 : 0);
+    int fds[LISTEN_MAX + 2];
+    struct taas_ptp_handoff ph;
+    struct handoff_msg m;
+    struct iovec iov = { .iov_base = &m, .iov_len = sizeof(m) };
+    struct msghdr mh = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = ctrl.buf, .msg_controllen = CMSG_SPACE(sizeof(int) * nfds),
+    };
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+    struct ucred peer;
+    socklen_t peer_len = sizeof(peer);
+    char ack;
+    int conn;
+
+    conn = accept4(handoff_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (conn < 0)
+        return 1;
+
+    /* The socket is 0600 already; a successor must also run as us or root */
+    if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) < 0 ||
+        (peer.uid != 0 && peer.uid != geteuid())) {
+        fprintf(stderr, "taas: warning: handover refused to an unprivileged peer\n");
+        close(conn);
+        return 1;
+    }
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    printf("[TaaS] Handing over to pid %d.\n", (int)peer.pid);
+    signers_drain();
+
+    memset(&m, 0, sizeof(m));
+    m.magic    = HANDOFF_MAGIC;
+    m.version  = HANDOFF_VERSION;
+    m.pid      = (int32_t)getpid();
+    m.nr_fds   = nr_listeners;
+    m.source   = TAAS_TIMER_SOURCE;
+    m.timer_hz = timer_hz;
+    m.anchor   = anchor;
+    m.servo    = servo;
+
+    /* The PTP port goes along: the successor continues its sequence
+     * instead of a second grandmaster appearing next to this one.
+     */
+    memcpy(fds, listen_fd, sizeof(int) * nr_listeners);
+    if (ptp) {
+        taas_ptp_handoff(ptp, &ph);
+        fds[nr_listeners]     = ph.event_fd;
+        fds[nr_listeners + 1] = ph.general_fd;
+        m.ptp              = 1;
+        m.ptp_sync_seq     = ph.sync_seq;
+        m.ptp_announce_seq = ph.announce_seq;
+    }
+
+    memset(ctrl.buf, 0, sizeof(ctrl.buf));
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type  = SCM_RIGHTS;
+    cm->cmsg_len   = CMSG_LEN(sizeof(int) * nfds);
+    memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
+
+    if (sendmsg(conn, &mh, MSG_NOSIGNAL) != (ssize_t)sizeof(m) || recv(conn, &ack, 1, 0) != 1) {
+        fprintf(stderr, "taas: warning: handover to pid %d failed, still serving\n", (int)peer.pid);
+        close(conn);
+        return 1;
+    }
+
+    close(conn);
+    printf("[TaaS] Pid %d has taken over.\n", (int)peer.pid);
+    return 0;
+}
+
+/*
+ * adopt_listener - Make a listener taken over from the previous
+ * instance ours: options follow this command line, and the TX stamp
+ * counter and error queue start afresh for the two-step ring.
+ */
+static void adopt_listener(int fd, int prev_pid)
+{
+    char host[INET6_ADDRSTRLEN] = "?";
+    union peer_addr addr;
+    socklen_t addrlen = sizeof(addr);
+    const int zero = 0;
+    uint8_t junk[1];
+
+    /* Clearing OPT_ID first makes the kernel number stamps from 0 again */
+    setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &zero, sizeof(zero));
+    if (!busy_poll_us) {
+        setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &zero, sizeof(zero));
+        setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &zero, sizeof(zero));
+    }
+    listener_options(fd);
+    while (recv(fd, junk, sizeof(junk), MSG_ERRQUEUE | MSG_DONTWAIT) >= 0)
+        ;
+
+    if (getsockname(fd, &addr.sa, &addrlen) == 0) {
+        if (addr.sa.sa_family == AF_INET6)
+            inet_ntop(AF_INET6, &addr.v6.sin6_addr, host, sizeof(host));
+        else
+            inet_ntop(AF_INET, &addr.v4.sin_addr, host, sizeof(host));
+    }
+    printf("[TaaS] Listening on %s port %d (from pid %d).\n", host, PTP_PORT, prev_pid);
+}
+
+/*
+ * takeover_receive - --takeover: connect to the running instance and
+ * take its listeners, anchor and servo. Returns 0 once this instance
+ * owns the sockets, -1 if there was nothing to take over.
+ */
+static int takeover_receive(void)
+{
+    const struct timeval tv = { .tv_sec = HANDOFF_TIMEOUT_SEC };
+    struct sockaddr_un sun = { .sun_family = AF_UNIX };
+    union {
+        struct cmsghdr align;
+        uint8_t buf[CMSG_SPACE(sizeof(int) * (LISTEN_MAX + 2))];
+    } ctrl;
+    int fds[LISTEN_MAX + 2];
+    struct handoff_msg m;
+    struct iovec iov = { .iov_base = &m, .iov_len = sizeof(m) };
+    struct msghdr mh = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf),
+    };
+    char notify[64];
+    unsigned int nfds = 0;
+    ssize_t n;
+    int conn;
+
+    snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", HANDOFF_SOCK);
+    conn = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (conn < 0 || setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0 ||
+        connect(conn, (const struct sockaddr *)&sun, sizeof(sun)) < 0) {
+        fprintf(stderr, "taas: --takeover: no running node at %s (%s), starting fresh\n",
+                HANDOFF_SOCK, strerror(errno));
+        if (conn >= 0)
+            close(conn);
+        return -1;
+    }
+
+    n = recvmsg(conn, &mh, MSG_CMSG_CLOEXEC);
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); n > 0 && cm; cm = CMSG_NXTHDR(&mh, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+            continue;
+        nfds = (unsigned int)((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        memcpy(fds, CMSG_DATA(cm), sizeof(int) * nfds);
+    }
+
+    if (n != (ssize_t)sizeof(m) || m.magic != HANDOFF_MAGIC || m.version != HANDOFF_VERSION ||
+        !m.nr_fds || m.nr_fds > LISTEN_MAX || nfds != m.nr_fds + (m.ptp ? 2 : 0) ||
+        (mh.msg_flags & MSG_CTRUNC)) {
+        fprintf(stderr, "taas: --takeover: the running node sent no usable handover, starting fresh\n");
+        for (unsigned int i = 0; i < nfds; i++)
+            close(fds[i]);
+        close(conn);
+        return -1;
+    }
+    memcpy(listen_fd, fds, sizeof(int) * m.nr_fds);
+    if (m.ptp) {
+        ptp_handoff.event_fd     = fds[m.nr_fds];
+        ptp_handoff.general_fd   = fds[m.nr_fds + 1];
+        ptp_handoff.sync_seq     = m.ptp_sync_seq;
+        ptp_handoff.announce_seq = m.ptp_announce_seq;
+    }
+
+    /* The time base carries over unless the timer itself changed */
+    if (m.source == TAAS_TIMER_SOURCE && m.timer_hz == timer_hz) {
+        anchor = m.anchor;
+        servo = m.servo;
+    } else {
+        fprintf(stderr, "taas: warning: previous node ran another timer, keeping a fresh anchor\n");
+    }
+
+    /* The previous node has stopped serving and waits for our ack */
+    state_claim();
+    publish_anchor();
+    state_save(0);
+
+    /* Own the service before the previous instance exits */
+    snprintf(notify, sizeof(notify), "MAINPID=%d\nREADY=1", (int)getpid());
+    sd_notify(notify);
+    if (send(conn, "", 1, MSG_NOSIGNAL) != 1)
+        perror("taas: warning: handover acknowledgement");
+    close(conn);
+
+    nr_listeners = m.nr_fds;
+    for (unsigned int i = 0; i < nr_listeners; i++)
+        adopt_listener(listen_fd[i], m.pid);
+    return 0;
+}
+
+/*
+ * spawn_successor - SIGUSR2: start whatever binary is now installed
+ * where this one was started from, with the same arguments plus
+ * --takeover. It starts up off core 3 and as SCHED_OTHER, so it never
+ * competes with this loop, and connects back once it is ready.
+ */
+static void spawn_successor(void)
+{
+    pid_t pid;
+
+    if (!self_exe[0] || handoff_fd < 0) {
+        fprintf(stderr, "taas: warning: cannot start a successor (no binary path or handover socket)\n");
+        return;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        perror("taas: warning: fork");
+        return;
+    }
+    if (pid == 0) {
+        struct sched_param sp = { .sched_priority = 0 };
+        cpu_set_t cpuset;
+
+        sched_setscheduler(0, SCHED_OTHER, &sp);
+        CPU_ZERO(&cpuset);
+        for (int cpu = 0; cpu < 3; cpu++)
+            CPU_SET(cpu, &cpuset);
+        sched_setaffinity(0, sizeof(cpuset), &cpuset);
+        closefrom(STDERR_FILENO + 1);
+        execv(self_exe, self_argv);
+        perror("taas: exec successor");
+        _exit(127);
+    }
+    printf("[TaaS] Started pid %d to take over.\n", (int)pid);
+}
+
+/*
+ * open_beacon - Sending socket for --beacon=GROUP[%IFACE].
+ * %IFACE picks the outgoing interface, otherwise the routing table does.
+ */
+static int open_beacon(const char *spec)
+{
+    char ifname[IF_NAMESIZE];
+    unsigned int ifindex;
+    int hops = BEACON_HOPS;
+    int fd, rc;
+
+    beacon_addrlen = parse_addr(spec, TAAS_BEACON_PORT, &beacon_addr, ifname);
+    if (!beacon_addrlen ||
+        (beacon_addr.sa.sa_family == AF_INET ?
+         !IN_MULTICAST(ntohl(beacon_addr.v4.sin_addr.s_addr)) :
+         !IN6_IS_ADDR_MULTICAST(&beacon_addr.v6.sin6_addr))) {
+        fprintf(stderr, "taas: --beacon %s: not a multicast group\n", spec);
+        return -1;
+    }
+
+    ifindex = ifname[0] ? if_nametoindex(ifname) : 0;
+    if (ifname[0] && !ifindex) {
+        fprintf(stderr, "taas: --beacon %s: no interface %s\n", spec, ifname);
+        return -1;
+    }
+
+    fd = socket(beacon_addr.sa.sa_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("taas: beacon socket");
+        return -1;
+    }
+
+    if (beacon_addr.sa.sa_family == AF_INET) {
+        struct ip_mreqn mreq = { .imr_ifindex = (int)ifindex };
+        unsigned char ttl = BEACON_HOPS;
+
+        rc = setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+        if (rc == 0 && ifindex)
+            rc = setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq));
+    } else {
+        rc = setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops));
+        if (rc == 0 && ifindex)
+            rc = setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex, sizeof(ifindex));
+    }
+    if (rc < 0) {
+        perror("taas: beacon multicast options");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * beacon_main - Multicast sender (core BEACON_CPU, SCHED_OTHER).
+ *
+ * Each beacon is stamped with the next multiple of the interval and
+ * signed ahead of it, while the thread still has BEACON_LEAD_NS to
+ * spare. It then sleeps until just before that instant and spins on
+ * the tick counter for the rest, so the signature never delays the
+ * packet and utc_timestamp_ns is the time it actually left.
+ */
+static void *beacon_main(void *arg)
+{
+    const uint64_t period = (uint64_t)beacon_interval_ms * 1000000ULL;
+    const double nominal = (double)anchor_mult(0.0);
+    struct taas_beacon b;
+    uint64_t seq = 0;
+    int warned = 0;
+    cpu_set_t cpuset;
+
+    (void)arg;
+    key_use = &sign_key_use[SIGNER_THREADS_MAX];
+    CPU_ZERO(&cpuset);
+    CPU_SET(BEACON_CPU, &cpuset);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+        fprintf(stderr, "taas: warning: beacon affinity to core %d failed\n", BEACON_CPU);
+
+    memset(&b, 0, sizeof(b));
+    b.hdr.magic   = TAAS_MAGIC;
+    b.hdr.version = TAAS_VERSION;
+    b.hdr.type    = TAAS_MSG_BEACON;
+    b.interval_ms = beacon_interval_ms;
+    b.flags       = pps ? TAAS_BEACON_PPS : 0;
+
+    while (1) {
+        struct time_anchor a;
+        uint64_t now, stamp;
+
+        anchor_snapshot(&a);
+        now = anchor_ticks_to_utc(&a, get_hardware_ticks());
+        stamp = (now + BEACON_LEAD_NS) / period * period + period;
+
+        b.seq = seq++;
+        b.utc_timestamp_ns = stamp;
+        b.anchor_utc_ns = a.base_utc_ns;
+        b.freq_mppb = (int32_t)(((double)a.mult / nominal - 1.0) * 1e12);
+        sign_message(b.signature, (const uint8_t *)&b, TAAS_BEACON_SIGNED_LEN);
+
+        now = anchor_ticks_to_utc(&a, get_hardware_ticks());
+        if (now + BEACON_SPIN_NS < stamp) {
+            uint64_t left = stamp - BEACON_SPIN_NS - now;
+            struct timespec ts = {
+                .tv_sec  = left / 1000000000ULL,
+                .tv_nsec = left % 1000000000ULL,
+            };
+
+            while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR)
+                ;
+        }
+
+        /* The anchor may have moved while asleep: after a step back,
+         * or a wake-up too late to honour the stamp, start over.
+         */
+        anchor_snapshot(&a);
+        now = anchor_ticks_to_utc(&a, get_hardware_ticks());
+        if (now < stamp && stamp - now > 2 * BEACON_SPIN_NS)
+            continue;
+        while (now < stamp) {
+            cpu_relax();
+            now = anchor_ticks_to_utc(&a, get_hardware_ticks());
+        }
+        if (now - stamp > BEACON_LATE_NS)
+            continue;
+
+        if (sendto(beacon_fd, &b, sizeof(b), 0, &beacon_addr.sa, beacon_addrlen) < 0 && !warned) {
+            perror("taas: warning: beacon sendto");
+            warned = 1;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * start_beacon - Open the beacon socket and start its sender.
+ * Beacons are signed, so they need the TSA key.
+ */
+static void start_beacon(void)
+{
+    struct sched_param sp = { .sched_priority = 0 };
+    pthread_attr_t attr;
+
+    if (!beacon_spec)
+        return;
+    if (!pkey) {
+        fprintf(stderr, "taas: warning: --beacon needs the signing key, no beacons\n");
+        return;
+    }
+
+    beacon_fd = open_beacon(beacon_spec);
+    if (beacon_fd < 0)
+        return;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, SIGNER_STACK_SIZE);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    pthread_attr_setschedparam(&attr, &sp);
+
+    if (pthread_create(&beacon_thread, &attr, beacon_main, NULL) != 0) {
+        perror("taas: warning: beacon thread");
+        close(beacon_fd);
+        beacon_fd = -1;
+    } else {
+        printf("[TaaS] Beacons to %s port %d every %u ms.\n",
+               beacon_spec, TAAS_BEACON_PORT, beacon_interval_ms);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/*
+ * open_peer - Connected socket to the node at ADDR[%IFACE], port 1588.
+ * Replies are stamped by the kernel on arrival, like --rx-timestamp.
+ */
+static int open_peer(const char *spec)
+{
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    char ifname[IF_NAMESIZE];
+    union peer_addr addr;
+    socklen_t addrlen;
+    int fd;
+
+    addrlen = parse_addr(spec, TAAS_PORT, &addr, ifname);
+    if (!addrlen) {
+        fprintf(stderr, "taas: warning: --peer %s: not an IPv4 or IPv6 address\n", spec);
+        return -1;
+    }
+
+    fd = socket(addr.sa.sa_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("taas: warning: peer socket");
+        return -1;
+    }
+    if (ifname[0] && setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, ifname,
+                             (socklen_t)strlen(ifname)) < 0)
+        fprintf(stderr, "taas: warning: --peer %s: SO_BINDTODEVICE: %s\n", spec, strerror(errno));
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0)
+        perror("taas: warning: peer replies stamped in the loop");
+
+    if (connect(fd, &addr.sa, addrlen) < 0) {
+        fprintf(stderr, "taas: warning: --peer %s: %s\n", spec, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void open_peers(void)
+{
+    for (unsigned int i = 0; i < nr_peer_specs; i++) {
+        struct peer *p = &peers[nr_peers];
+
+        p->fd = open_peer(peer_spec[i]);
+        if (p->fd < 0)
+            continue;
+        p->spec = peer_spec[i];
+        p->done = 1;
+        if (tel)
+            snprintf(tel->peer[nr_peers].name, sizeof(tel->peer[nr_peers].name), "%s", p->spec);
+        nr_peers++;
+    }
+    if (tel)
+        tel->nr_peers = nr_peers;
+    if (nr_peers)
+        printf("[TaaS] Cross-checking %u peer%s every %d s.\n",
+               nr_peers, nr_peers == 1 ? "" : "s", DRIFT_CHECK_INTERVAL);
+}
+
+/*
+ * peer_finish - Close one peer's round: its best sample becomes the
+ * peer's offset. Only disagreement and silence are worth a line on
+ * core 3; with telemetry, the rest goes to the exporter.
+ */
+static void peer_finish(struct peer *p)
+{
+    struct taas_tel_peer *tp = tel ? &tel->peer[p - peers] : NULL;
+
+    p->done = 1;
+    if (!p->got) {
+        if (++p->lost_streak == 1)
+            fprintf(stderr, "taas: warning: peer %s did not answer\n", p->spec);
+        if (tp)
+            taas_tel_add(&tp->lost, 1);
+        return;
+    }
+
+    p->lost_streak = 0;
+    if (tp) {
+        taas_tel_set(&tp->offset_ns, p->offset_ns);
+        taas_tel_set(&tp->delay_ns, p->delay_ns);
+        taas_tel_add(&tp->rounds, 1);
+    }
+    if (p->offset_ns > PEER_WARN_NS || p->offset_ns < -PEER_WARN_NS)
+        fprintf(stderr, "taas: warning: peer %s is %+lld us off (delay %lld us)\n", p->spec,
+                (long long)(p->offset_ns / 1000), (long long)(p->delay_ns / 1000));
+    else if (!tel)
+        printf("[Peer] %s: offset %+lld ns, delay %lld ns\n", p->spec,
+               (long long)p->offset_ns, (long long)p->delay_ns);
+}
+
+/*
+ * peers_round - Conclude the last cross-check round and start the next.
+ *
+ * One peer off is that peer's problem. When most of the federation
+ * puts this node off in the same direction, it is more likely ours:
+ * the reference (NTP, PPS) or the crystal. The node only warns; it
+ * never steers by its peers, whose errors would then compound.
+ */
+static void peers_round(void)
+{
+    unsigned int ahead = 0, behind = 0;
+
+    if (!nr_peers)
+        return;
+
+    for (unsigned int i = 0; i < nr_peers; i++) {
+        struct peer *p = &peers[i];
+
+        if (!p->done)
+            peer_finish(p);
+        if (p->got && p->offset_ns > PEER_WARN_NS)
+            ahead++;
+        else if (p->got && p->offset_ns < -PEER_WARN_NS)
+            behind++;
+    }
+    if (nr_peers > 1 && (2 * ahead > nr_peers || 2 * behind > nr_peers))
+        fprintf(stderr, "taas: warning: %u of %u peers put this node %s by over %lld us\n",
+                ahead > behind ? ahead : behind, nr_peers,
+                ahead > behind ? "behind" : "ahead", PEER_WARN_NS / 1000);
+
+    peer_round++;
+    for (unsigned int i = 0; i < nr_peers; i++) {
+        struct peer *p = &peers[i];
+        struct taas_ext_time_request req = {
+            .hdr = { .magic = TAAS_MAGIC, .version = TAAS_VERSION,
+                     .type = TAAS_MSG_EXT_TIME_REQ },
+        };
+
+        p->id_base = peer_round * PEER_SAMPLES;
+        p->got = 0;
+        p->done = 0;
+        for (unsigned int k = 0; k < PEER_SAMPLES; k++) {
+            req.hdr.request_id = p->id_base + k;
+            p->t1[k] = utc_now_ns();
+            if (send(p->fd, &req, sizeof(req), 0) < 0)
+                p->t1[k] = 0;
+        }
+    }
+}
+
+/*
+ * peer_reply - Take the replies waiting on one peer's socket.
+ *
+ * T1 is the anchor time right before send(), T4 the kernel receive
+ * stamp on the anchor timeline, so the offset is against exactly the
+ * time this node serves.
+ */
+static void peer_reply(unsigned int i)
+{
+    struct peer *p = &peers[i];
+    struct taas_ext_time_reply rep;
+    uint8_t ctrl[RX_CTRL_SIZE];
+    struct iovec iov = { .iov_base = &rep, .iov_len = sizeof(rep) };
+    struct msghdr mh;
+    struct rx_clock ref;
+
+    for (;;) {
+        uint64_t t1, t4;
+        uint32_t k;
+        ssize_t n;
+
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = ctrl;
+        mh.msg_controllen = sizeof(ctrl);
+        n = recvmsg(p->fd, &mh, MSG_DONTWAIT);
+        if (n < 0)
+            return;     /* drained, or an ICMP error from a peer that is down */
+
+        rx_clock_read(&ref);
+        t4 = kernel_stamp(&mh, &ref);
+        if (!t4)
+            t4 = ref.utc_ns;
+
+        if (n != sizeof(rep) || (mh.msg_flags & MSG_TRUNC) || rep.hdr.magic != TAAS_MAGIC ||
+            rep.hdr.type != TAAS_MSG_EXT_TIME_REPLY || p->done)
+            continue;
+        k = rep.hdr.request_id - p->id_base;
+        if (k >= PEER_SAMPLES || !p->t1[k])
+            continue;
+
+        t1 = p->t1[k];
+        p->t1[k] = 0;
+
+        int64_t offset = ((int64_t)(rep.rx_timestamp_ns - t1) +
+                          (int64_t)(rep.tx_timestamp_ns - t4)) / 2;
+        int64_t delay = (int64_t)(t4 - t1) - (int64_t)(rep.tx_timestamp_ns - rep.rx_timestamp_ns);
+
+        if (!p->got++ || delay < p->delay_ns) {
+            p->offset_ns = offset;
+            p->delay_ns = delay;
+        }
+        if (p->got == PEER_SAMPLES)
+            peer_finish(p);
+    }
+}
+
+/* epoll data of the non-socket event sources */
+#define EV_DRIFT       LISTEN_MAX
+#define EV_CTL         (LISTEN_MAX + 1)
+#define EV_HANDOFF     (LISTEN_MAX + 2)
+#define EV_PTP_TIMER   (LISTEN_MAX + 3)
+#define EV_PTP_EVENT   (LISTEN_MAX + 4)
+#define EV_PTP_GENERAL (LISTEN_MAX + 5)
+#define EV_PEER        (LISTEN_MAX + 6)     /* one per peer */
+#define EV_MAX         (LISTEN_MAX + 6 + PEER_MAX)
+
+/*
+ * event_loop_init - One epoll instance for the whole loop.
+ *
+ * The drift timer fires every DRIFT_CHECK_INTERVAL seconds on its own,
+ * whether or not traffic wakes the loop, and the control eventfd lets
+ * signal handlers hand work to it. Sockets are registered only when
+ * the loop sleeps; in busy-poll mode they are spun on directly and
+ * epoll is polled just for the timer and control events.
+ */
+static int event_loop_init(void)
+{
+    struct itimerspec its = {
+        .it_interval = { .tv_sec = DRIFT_CHECK_INTERVAL },
+        .it_value    = { .tv_sec = DRIFT_CHECK_INTERVAL },
+    };
+    struct epoll_event ev = { .events = EPOLLIN };
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    drift_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    ctl_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || drift_fd < 0 || ctl_fd < 0) {
+        perror("taas: event loop");
+        return -1;
+    }
+
+    if (timerfd_settime(drift_fd, 0, &its, NULL) < 0) {
+        perror("taas: timerfd_settime");
+        return -1;
+    }
+
+    ev.data.u32 = EV_DRIFT;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, drift_fd, &ev) < 0)
+        goto fail;
+    ev.data.u32 = EV_CTL;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ctl_fd, &ev) < 0)
+        goto fail;
+    ev.data.u32 = EV_HANDOFF;
+    if (handoff_fd >= 0 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, handoff_fd, &ev) < 0)
+        goto fail;
+
+    /* PTP traffic is a few messages per second: always event driven */
+    if (ptp) {
+        ev.data.u32 = EV_PTP_TIMER;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, taas_ptp_timer_fd(ptp), &ev) < 0)
+            goto fail;
+        ev.data.u32 = EV_PTP_EVENT;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, taas_ptp_event_fd(ptp), &ev) < 0)
+            goto fail;
+        ev.data.u32 = EV_PTP_GENERAL;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, taas_ptp_general_fd(ptp), &ev) < 0)
+            goto fail;
+    }
+
+    /* So are peers: PEER_SAMPLES replies per drift check */
+    for (unsigned int i = 0; i < nr_peers; i++) {
+        ev.data.u32 = EV_PEER + i;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, peers[i].fd, &ev) < 0)
+            goto fail;
+    }
+
+    for (unsigned int i = 0; i < nr_listeners && !busy_poll_us; i++) {
+        ev.data.u32 = i;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd[i], &ev) < 0)
+            goto fail;
+    }
+    return 0;
+
+fail:
+    perror("taas: epoll_ctl");
+    return -1;
+}
+
+/*
+ * post_control - Hand control requests to the event loop.
+ * Async-signal-safe: one atomic OR and one write().
+ */
+static void post_control(unsigned int bits)
+{
+    const uint64_t one = 1;
+
+    atomic_fetch_or(&ctl_pending, bits);
+    if (write(ctl_fd, &one, sizeof(one)) < 0)
+        return;
+}
+
+static void control_signal(int sig)
+{
+    switch (sig) {
+    case SIGUSR1:
+        post_control(CTL_CALIBRATE);
+        break;
+    case SIGHUP:
+        post_control(CTL_RELOAD);
+        break;
+    case SIGUSR2:
+        post_control(CTL_UPGRADE);
+        break;
+    default:
+        post_control(CTL_STOP);
+    }
+}
+
+/*
+ * drift_check - Timer expiry: re-align the anchor with the reference.
+ */
+static void drift_check(void)
+{
+    uint64_t expirations;
+
+    if (read(drift_fd, &expirations, sizeof(expirations)) < 0)
+        return;
+
+    calibrate_time_anchor(0);
+    publish_anchor();
+    state_save(1);
+    peers_round();
+}
+
+/*
+ * ptp_delay_req - Answer queued Delay_Req messages, each with its
+ * kernel receive stamp (t4) when there is one.
+ */
+static void ptp_delay_req(void)
+{
+    static struct taas_ptp_req req[PTP_RX_BATCH];
+    unsigned int n = taas_ptp_recv(ptp, req, PTP_RX_BATCH);
+    struct rx_clock ref;
+
+    if (!n)
+        return;
+
+    rx_clock_read(&ref);
+    for (unsigned int i = 0; i < n; i++) {
+        uint64_t t4 = kernel_stamp(&req[i].mh, &ref);
+
+        taas_ptp_delay_resp(ptp, &req[i], t4 ? t4 : utc_now_ns());
+    }
+}
+
+/*
+ * ptp_sync_stamp - Send the Follow_Up of the last Sync with its kernel
+ * transmit stamp (t1). Without a usable stamp there is no Follow_Up:
+ * a slave skips that Sync rather than take a wrong t1.
+ */
+static void ptp_sync_stamp(void)
+{
+    static struct taas_ptp_req r;
+    struct rx_clock ref;
+    uint64_t t1;
+
+    if (!taas_ptp_tx_stamp(ptp, &r))
+        return;
+
+    rx_clock_read(&ref);
+    t1 = kernel_stamp(&r.mh, &ref);
+    if (t1)
+        taas_ptp_follow_up(ptp, t1);
+}
+
+/*
+ * ptp_event - One PTP event source became ready. Sync transmit stamps
+ * show up on the event socket as EPOLLERR.
+ */
+static void ptp_event(uint32_t id, uint32_t events)
+{
+    if (id == EV_PTP_TIMER) {
+        if (taas_ptp_timer(ptp))
+            taas_ptp_sync(ptp, utc_now_ns());
+    } else if (id == EV_PTP_EVENT) {
+        if (events & EPOLLERR)
+            ptp_sync_stamp();
+        if (events & EPOLLIN)
+            ptp_delay_req();
+    } else {
+        taas_ptp_general(ptp);
+    }
+}
+
+/*
+ * run_control - Act on pending control requests.
+ * Returns 0 once the loop should stop.
+ */
+static int run_control(void)
+{
+    uint64_t count;
+    unsigned int bits;
+
+    if (read(ctl_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        perror("taas: warning: control eventfd");
+    bits = atomic_exchange(&ctl_pending, 0);
+
+    if (bits & CTL_CALIBRATE) {
+        printf("[TaaS] Recalibrating on request.\n");
+        calibrate_time_anchor(0);
+        publish_anchor();
+        state_save(1);
+    }
+    if (bits & CTL_RELOAD) {
+        sd_notify("RELOADING=1");
+        reload_sign_key();
+        sd_notify("READY=1");
+    }
+    if (bits & CTL_UPGRADE)
+        spawn_successor();
+    return !(bits & CTL_STOP);
+}
+
+/* Batch state is allocated once, locked with the rest of the process
+ * by mlockall(), and reused by every call of serve_socket(). rx_msgs
+ * are templates wired to their slab slot by batch_init(), so a receive
+ * only resets the lengths the kernel wrote back; tx_msgs/tx_iov reuse
+ * the slot's address and point at its reply. Everything downstream
+ * refers to a request by its slot index.
+ */
+static struct rx_slot rx_slab[RX_BATCH_MAX];
+static struct iovec rx_iov[RX_BATCH_MAX], tx_iov[RX_BATCH_MAX];
+static struct mmsghdr rx_msgs[RX_BATCH_MAX], tx_msgs[RX_BATCH_MAX];
+static struct sign_job inline_job;
+static uint8_t ext_rx[RX_BATCH_MAX];
+static uint8_t twostep_tx[RX_BATCH_MAX], twostep_rx[RX_BATCH_MAX];
+static int tx_err[RX_BATCH_MAX];
+static union {
+    struct cmsghdr align;
+    uint8_t buf[CMSG_SPACE(sizeof(uint32_t))];
+} tx_tstamp_ctrl;
+static enum req_kind kind[RX_BATCH_MAX];
+static uint8_t tel_mode[RX_BATCH_MAX];
+static uint64_t tel_sign[RX_BATCH_MAX];
+#ifdef TAAS_XDP
+static struct taas_xsk_desc xsk_desc[RX_BATCH_MAX];
+#endif
+
+static void batch_init(void)
+{
+    struct cmsghdr *cm = &tx_tstamp_ctrl.align;
+    uint32_t tx_flags = SOF_TIMESTAMPING_TX_SOFTWARE;
+
+    /* Attached to two-step replies only: nothing else is stamped on TX */
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type  = SO_TIMESTAMPING;
+    cm->cmsg_len   = CMSG_LEN(sizeof(tx_flags));
+    memcpy(CMSG_DATA(cm), &tx_flags, sizeof(tx_flags));
+
+    for (unsigned int i = 0; i < RX_BATCH_MAX; i++) {
+        rx_iov[i].iov_base = rx_slab[i].buf;
+        rx_iov[i].iov_len  = RX_BUF_SIZE;
+        rx_msgs[i].msg_hdr.msg_name   = &rx_slab[i].addr;
+        rx_msgs[i].msg_hdr.msg_iov    = &rx_iov[i];
+        rx_msgs[i].msg_hdr.msg_iovlen = 1;
+        if (rx_timestamps)
+            rx_msgs[i].msg_hdr.msg_control = rx_slab[i].ctrl.buf;
+
+        tx_msgs[i].msg_hdr.msg_iov    = &tx_iov[i];
+        tx_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+/*
+ * twostep_push - Record a two-step reply that has left, under the next
+ * OPT_ID key of its socket. When the ring is full, the oldest reply
+ * never got a stamp and is dropped.
+ */
+static void twostep_push(struct twostep_ring *r, const union peer_addr *addr, socklen_t addrlen,
+                         uint32_t request_id, uint64_t now)
+{
+    struct twostep_slot *sl;
+
+    if (r->head - r->tail == TWOSTEP_RING)
+        r->tail++;
+
+    sl = &r->slot[r->head & (TWOSTEP_RING - 1)];
+    sl->key = r->head++;
+    sl->request_id = request_id;
+    sl->sent_ticks = now;
+    memcpy(&sl->addr, addr, addrlen);
+    sl->addrlen = addrlen;
+    sl->done = 0;
+}
+
+/*
+ * twostep_numbered - Whether a two-step reply that failed to send had
+ * already taken its OPT_ID key: errors past the point where the
+ * datagram is built, a netfilter drop or a full device queue. Routing
+ * and address errors come before it.
+ */
+static inline int twostep_numbered(int err)
+{
+    return err == EPERM || err == ENOBUFS;
+}
+
+/* twostep_skip - Use up the key of a reply that was numbered but never left */
+static void twostep_skip(struct twostep_ring *r)
+{
+    struct twostep_slot *sl;
+
+    if (r->head - r->tail == TWOSTEP_RING)
+        r->tail++;
+
+    sl = &r->slot[r->head & (TWOSTEP_RING - 1)];
+    sl->key = r->head++;
+    sl->done = 1;
+}
+
+/*
+ * twostep_drain - Turn the TX stamps on a listener's error queue into
+ * follow-ups. Never blocks: whatever the kernel has not stamped yet is
+ * picked up on a later pass, and replies whose stamp never comes are
+ * retired after TWOSTEP_TIMEOUT_SEC.
+ */
+static void twostep_drain(unsigned int l)
+{
+    static union {
+        struct cmsghdr align;
+        uint8_t buf[CMSG_SPACE(sizeof(struct scm_timestamping)) +
+                    CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+    } ctrl;
+    struct twostep_ring *r = &twostep[l];
+    struct rx_clock ref = { 0, 0 };
+    int have_ref = 0;
+    uint64_t now;
+
+    while (1) {
+        struct msghdr mh = { .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl.buf) };
+        struct twostep_slot *sl;
+        struct taas_follow_up fu;
+        uint32_t key = 0;
+        int found = 0;
+
+        if (recvmsg(listen_fd[l], &mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            break;
+
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+            struct sock_extended_err serr;
+
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+                continue;
+
+            memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+            if (serr.ee_errno == ENOMSG && serr.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+                key = serr.ee_data;
+                found = 1;
+            }
+        }
+
+        /* Only keys still waiting in [tail, head) */
+        if (!found || key - r->tail >= r->head - r->tail)
+            continue;
+        sl = &r->slot[key & (TWOSTEP_RING - 1)];
+        if (sl->done || sl->key != key)
+            continue;
+
+        if (!have_ref) {
+            rx_clock_read(&ref);
+            have_ref = 1;
+        }
+        fu.tx_timestamp_ns = kernel_stamp(&mh, &ref);
+        if (!fu.tx_timestamp_ns)
+            continue;
+
+        fu.hdr.magic      = TAAS_MAGIC;
+        fu.hdr.version    = TAAS_VERSION;
+        fu.hdr.type       = TAAS_MSG_FOLLOW_UP;
+        fu.hdr.flags      = 0;
+        fu.hdr.request_id = sl->request_id;
+        sendto(listen_fd[l], &fu, sizeof(fu), 0, &sl->addr.sa, sl->addrlen);
+        sl->done = 1;
+    }
+
+    now = get_hardware_ticks();
+    while (r->tail != r->head) {
+        const struct twostep_slot *sl = &r->slot[r->tail & (TWOSTEP_RING - 1)];
+
+        if (!sl->done && now - sl->sent_ticks < TWOSTEP_TIMEOUT_SEC * TICKS_PER_SEC)
+            break;
+        r->tail++;
+    }
+}
+
+/*
+ * serve_socket - Receive, stamp and answer one batch on a listener:
+ * - Drain up to rx_batch UDP triggers in one recvmmsg()
+ * - Perform atomic hardware read per datagram
+ * - Extrapolate UTC time from Anchor
+ * - Queue TSA/batch requests to the signer rings (or sign inline)
+ * - Send all raw and HMAC timestamps back in one sendmmsg()
+ * Returns the number of datagrams received.
+ */
+static unsigned int serve_socket(unsigned int l)
+{
+    struct taas_tel_segment *tseg = tel ? &tel->seg[0] : NULL;
+    int sockfd = listen_fd[l];
+    unsigned int nts = 0, next = 0;
+
+    for (unsigned int i = 0; i < rx_batch; i++) {
+        rx_msgs[i].msg_hdr.msg_namelen = sizeof(rx_slab[i].addr);
+        if (rx_timestamps)
+            rx_msgs[i].msg_hdr.msg_controllen = sizeof(rx_slab[i].ctrl.buf);
+    }
+
+    int rec = recvmmsg(sockfd, rx_msgs, rx_batch, MSG_DONTWAIT, NULL);
+    if (rec <= 0)
+        return 0;
+
+    unsigned int n = (unsigned int)rec;
+    unsigned int ntx = 0;
+    uint32_t kick = 0;
+    struct rx_clock ref = { 0, 0 };
+    uint64_t rx_ticks = tel_ticks(tseg);
+    uint64_t rl_now = rl_on ? get_hardware_ticks() : 0;
+
+    if (rx_timestamps)
+        rx_clock_read(&ref);
+
+    /* TSA requests first: offloading is a cheap ring push, and
+     * inline signing is slow, so raw timestamps are taken
+     * afterwards and leave as fresh as possible.
+     */
+    for (unsigned int i = 0; i < n; i++) {
+        struct rx_slot *sl = &rx_slab[i];
+
+        kind[i] = classify_request(sl->buf, rx_msgs[i].msg_len,
+                                   rx_msgs[i].msg_hdr.msg_flags);
+        tel_mode[i] = TAAS_TEL_MODES;   /* not accounted on core 3 */
+        if (!signed_kind(kind[i]))
+            continue;
+
+        if (rl_on) {
+            uint64_t wait = admit(&sl->addr, TAAS_RL_SIGNED, rl_now);
+
+            if (wait) {
+                /* Over budget: refuse without spending a signature */
+                fill_busy(&sl->busy, sl->buf, kind[i], wait);
+                tx_iov[ntx].iov_base = &sl->busy;
+                tx_iov[ntx].iov_len  = sizeof(sl->busy);
+                tx_msgs[ntx].msg_hdr.msg_name    = &sl->addr;
+                tx_msgs[ntx].msg_hdr.msg_namelen = rx_msgs[i].msg_hdr.msg_namelen;
+                ntx++;
+                if (tel)
+                    taas_tel_add(&tel->limited_signed, 1);
+                continue;
+            }
+        }
+
+        if (nr_signers) {
+            /* TSA/BATCH MODE, offloaded: stamp here, sign on cores 0-2 */
+            int idx = offload_tsa(kind[i], sockfd, &rx_msgs[i],
+                                  stamp_request(&rx_msgs[i].msg_hdr, &ref), rx_ticks);
+            if (idx >= 0)
+                kick |= 1U << idx;
+            else if (tel)
+                taas_tel_add(&tel->shed, 1);
+            continue;
+        }
+
+        uint64_t t_sign = tel_ticks(tseg);
+
+        if (kind[i] == REQ_BATCH) {
+            /* BATCH MODE, inline (one signature for all hashes) */
+            fill_job(&inline_job, kind[i], sockfd, &rx_msgs[i],
+                     stamp_request(&rx_msgs[i].msg_hdr, &ref), rx_ticks);
+            tx_iov[ntx].iov_len  = sign_batch(&sl->bcert, &inline_job);
+            tx_iov[ntx].iov_base = &sl->bcert;
+            tel_mode[i] = TAAS_TEL_BATCH;
+        } else if (kind[i] == REQ_EXT_TSA) {
+            /* EXTENDED TSA MODE, inline (transmit time added at send) */
+            sign_ext_certificate(&sl->ext_cert, stamp_request(&rx_msgs[i].msg_hdr, &ref));
+            ext_rx[next++] = (uint8_t)i;
+            tx_iov[ntx].iov_base = &sl->ext_cert;
+            tx_iov[ntx].iov_len  = sizeof(sl->ext_cert);
+            tel_mode[i] = TAAS_TEL_TSA;
+        } else {
+            /* TSA MODE, inline (Certificate with UTC, the hash already in place) */
+            sl->cert.utc_timestamp_ns = stamp_request(&rx_msgs[i].msg_hdr, &ref);
+            sign_certificate(&sl->cert);
+
+            tx_iov[ntx].iov_base = &sl->cert;
+            tx_iov[ntx].iov_len  = sizeof(sl->cert);
+            tel_mode[i] = TAAS_TEL_TSA;
+        }
+        tel_sign[i] = tel_ticks(tseg) - t_sign;
+        tx_msgs[ntx].msg_hdr.msg_name    = &sl->addr;
+        tx_msgs[ntx].msg_hdr.msg_namelen = rx_msgs[i].msg_hdr.msg_namelen;
+        ntx++;
+    }
+
+    for (unsigned int i = 0; i < n; i++) {
+        struct rx_slot *sl = &rx_slab[i];
+
+        if (signed_kind(kind[i]))
+            continue;
+
+        /* Over budget: dropped, a reply would cost as much as serving it */
+        if (rl_on && admit(&sl->addr, TAAS_RL_RAW, rl_now)) {
+            if (tel)
+                taas_tel_add(&tel->limited_raw, 1);
+            continue;
+        }
+
+        uint64_t utc_ns = stamp_request(&rx_msgs[i].msg_hdr, &ref);
+
+        if (kind[i] == REQ_HMAC &&
+            serve_hmac(&sl->hmac_reply, (const struct taas_hmac_request *)sl->buf,
+                       utc_ns) == 0) {
+            /* HMAC MODE (UTC with shared-key tag) */
+            tx_iov[ntx].iov_base = &sl->hmac_reply;
+            tx_iov[ntx].iov_len  = sizeof(sl->hmac_reply);
+            tel_mode[i] = TAAS_TEL_HMAC;
+        } else if (kind[i] == REQ_TIME) {
+            /* TWO-STEP MODE (UTC now, the TX stamp in a follow-up);
+             * magic, version and request_id stay as received.
+             */
+            sl->time_reply.hdr.type  = TAAS_MSG_TIME_REPLY;
+            sl->time_reply.hdr.flags = two_step ? TAAS_FLAG_TWO_STEP : 0;
+            sl->time_reply.utc_timestamp_ns = utc_ns;
+            tx_iov[ntx].iov_base = &sl->time_reply;
+            tx_iov[ntx].iov_len  = sizeof(sl->time_reply);
+            tel_mode[i] = TAAS_TEL_RAW;
+            if (two_step) {
+                twostep_tx[nts] = (uint8_t)ntx;
+                twostep_rx[nts] = (uint8_t)i;
+                nts++;
+            }
+        } else if (kind[i] == REQ_EXT_TIME) {
+            /* EXTENDED MODE (receive and transmit time), in place */
+            sl->ext_reply.hdr.type = TAAS_MSG_EXT_TIME_REPLY;
+            sl->ext_reply.rx_timestamp_ns = utc_ns;
+            ext_rx[next++] = (uint8_t)i;
+            tx_iov[ntx].iov_base = &sl->ext_reply;
+            tx_iov[ntx].iov_len  = sizeof(sl->ext_reply);
+            tel_mode[i] = TAAS_TEL_RAW;
+        } else {
+            /* RAW MODE (Just the UTC uint64) */
+            sl->raw_utc_ns = utc_ns;
+            tx_iov[ntx].iov_base = &sl->raw_utc_ns;
+            tx_iov[ntx].iov_len  = sizeof(sl->raw_utc_ns);
+            tel_mode[i] = TAAS_TEL_RAW;
+        }
+        tel_sign[i] = 0;
+        tx_msgs[ntx].msg_hdr.msg_name    = &sl->addr;
+        tx_msgs[ntx].msg_hdr.msg_namelen = rx_msgs[i].msg_hdr.msg_namelen;
+        ntx++;
+    }
+
+    for (unsigned int r = 0; r < nr_signers; r++)
+        if (kick & (1U << r))
+            ring_kick(&signers[r].ring);
+
+    for (unsigned int k = 0; k < nts; k++) {
+        tx_msgs[twostep_tx[k]].msg_hdr.msg_control    = tx_tstamp_ctrl.buf;
+        tx_msgs[twostep_tx[k]].msg_hdr.msg_controllen = sizeof(tx_tstamp_ctrl.buf);
+    }
+
+    if (next) {
+        /* One transmit time for the batch: they all leave in this sendmmsg() */
+        uint64_t tx_ns = utc_now_ns();
+
+        for (unsigned int k = 0; k < next; k++) {
+            unsigned int i = ext_rx[k];
+
+            if (kind[i] == REQ_EXT_TIME)
+                rx_slab[i].ext_reply.tx_timestamp_ns = tx_ns;
+            else
+                rx_slab[i].ext_cert.tx_timestamp_ns = tx_ns;
+        }
+    }
+
+    unsigned int sent = send_batch(sockfd, tx_msgs, ntx, tx_err);
+
+    if (tseg && sent < ntx)
+        taas_tel_add(&tseg->tx_errors, ntx - sent);
+
+    if (nts) {
+        /* The kernel numbers stamped replies in the order it builds them,
+         * so keys line up with the replies that left and with those
+         * dropped only after they were built.
+         */
+        uint64_t now = get_hardware_ticks();
+
+        for (unsigned int k = 0; k < nts; k++) {
+            unsigned int i = twostep_rx[k];
+
+            tx_msgs[twostep_tx[k]].msg_hdr.msg_control    = NULL;
+            tx_msgs[twostep_tx[k]].msg_hdr.msg_controllen = 0;
+            if (tx_err[twostep_tx[k]]) {
+                if (twostep_numbered(tx_err[twostep_tx[k]]))
+                    twostep_skip(&twostep[l]);
+                continue;
+            }
+            twostep_push(&twostep[l], &rx_slab[i].addr, rx_msgs[i].msg_hdr.msg_namelen,
+                         ((const struct taas_hdr *)rx_slab[i].buf)->request_id, now);
+        }
+        twostep_drain(l);
+    }
+
+    if (tseg) {
+        /* Residence is per batch: every reply left with this sendmmsg() */
+        uint64_t tx_ticks = get_hardware_ticks();
+
+        for (unsigned int i = 0; i < n; i++)
+            if (tel_mode[i] != TAAS_TEL_MODES)
+                taas_tel_record(tseg, tel_mode[i], tx_ticks - rx_ticks, tel_sign[i]);
+    }
+    return n;
+}
+
+#ifdef TAAS_XDP
+/*
+ * serve_xsk - RAW MODE, AF_XDP: the reply is built in the received frame.
+ * Returns the number of frames answered.
+ */
+static unsigned int serve_xsk(void)
+{
+    struct taas_tel_segment *tseg = tel ? &tel->seg[0] : NULL;
+    unsigned int nx = taas_xsk_recv(xsk, xsk_desc, rx_batch);
+    uint64_t rx_ticks = nx ? tel_ticks(tseg) : 0;
+
+    for (unsigned int i = 0; i < nx; i++)
+        taas_xsk_reply(xsk, &xsk_desc[i], utc_now_ns());
+    taas_xsk_flush(xsk);
+    if (nx && tseg) {
+        uint64_t tx_ticks = get_hardware_ticks();
+
+        for (unsigned int i = 0; i < nx; i++)
+            taas_tel_record(tseg, TAAS_TEL_RAW, tx_ticks - rx_ticks, 0);
+    }
+    return nx;
+}
+#endif
+
+/*
+ * Self-test (--selftest): a cyclictest-style certification of core 3,
+ * run in place of serving. Each measurement lasts selftest_sec and
+ * fills a histogram of the same log-linear buckets as the telemetry
+ * segment, so every percentile is an upper bound at most 25% high.
+ */
+struct st_hist {
+    uint64_t count;
+    uint64_t max;
+    uint64_t bucket[TAAS_TEL_BUCKETS];
+};
+
+static struct st_hist st_gap, st_wakeup, st_stage[ST_STAGES], st_sign;
+static uint64_t st_retries;
+
+static const char *const st_stage_name[ST_STAGES] = {
+    "recv", "classify", "stamp", "send", "request"
+};
+
+static inline void st_add(struct st_hist *h, uint64_t ns)
+{
+    h->count++;
+    h->bucket[taas_tel_bucket(ns)]++;
+    if (ns > h->max)
+        h->max = ns;
+}
+
+/* Upper bound of the q quantile, in ns, capped by the largest sample */
+static uint64_t st_quantile(const struct st_hist *h, double q)
+{
+    uint64_t rank = (uint64_t)(q * (double)h->count + 0.999999999);
+    uint64_t seen = 0;
+
+    if (!rank)
+        rank = 1;
+    for (unsigned int b = 0; b < TAAS_TEL_BUCKETS; b++) {
+        seen += h->bucket[b];
+        if (seen >= rank) {
+            uint64_t limit = taas_tel_bucket_limit(b);
+
+            return limit < h->max ? limit : h->max;
+        }
+    }
+    return h->max;
+}
+
+/*
+ * st_report - Percentiles of one measurement, its histogram if full,
+ * and the verdict against limit_us (0: not checked).
+ * Returns 1 if p99.9 is over the limit.
+ */
+static int st_report(const char *name, const struct st_hist *h, uint64_t limit_us, int full)
+{
+    uint64_t p999 = st_quantile(h, 0.999);
+    int over = limit_us && p999 > limit_us * 1000;
+
+    printf("[TaaS] Self-test %-8s %10llu samples  p50 %9.3f  p99 %9.3f  p99.9 %9.3f  max %9.3f us",
+           name, (unsigned long long)h->count, st_quantile(h, 0.5) / 1e3,
+           st_quantile(h, 0.99) / 1e3, p999 / 1e3, h->max / 1e3);
+    if (limit_us)
+        printf("  (limit %llu us) %s\n", (unsigned long long)limit_us, over ? "FAIL" : "ok");
+    else
+        printf("\n");
+
+    if (!full)
+        return over;
+    for (unsigned int b = 0; b < TAAS_TEL_BUCKETS; b++)
+        if (h->bucket[b])
+            printf("    %10.3f - %10.3f us  %12llu\n",
+                   b ? taas_tel_bucket_limit(b - 1) / 1e3 : 0.0,
+                   taas_tel_bucket_limit(b) / 1e3, (unsigned long long)h->bucket[b]);
+    return over;
+}
+
+/* get_hardware_ticks(), counting the hi/lo/hi retries of the BCM2837 timer */
+static inline uint64_t st_ticks(void)
+{
+#if TAAS_TIMER_SOURCE == TAAS_TIMER_ST
+    const volatile uint32_t *lo = (const volatile uint32_t *)((const volatile char *)map_base + TAAS_ST_LOW);
+    const volatile uint32_t *hi = (const volatile uint32_t *)((const volatile char *)map_base + TAAS_ST_HIGH);
+    uint32_t h1, l, h2;
+
+    for (;;) {
+        h1 = *hi;
+        l  = *lo;
+        h2 = *hi;
+        if (h1 == h2)
+            break;
+        st_retries++;
+    }
+    return ((uint64_t)h1 << 32) | l;
+#else
+    return get_hardware_ticks();
+#endif
+}
+
+/*
+ * selftest_gaps - Spin on the timer and record the time between
+ * consecutive reads. Anything that takes the core away, an interrupt
+ * or a kernel thread, shows up as a gap.
+ */
+static void selftest_gaps(void)
+{
+    uint64_t prev = st_ticks();
+    uint64_t end = prev + selftest_sec * timer_hz;
+    uint64_t now;
+
+    do {
+        now = st_ticks();
+        st_add(&st_gap, (now - prev) * 1000000000ULL / timer_hz);
+        prev = now;
+    } while (now < end);
+}
+
+/*
+ * selftest_wakeups - Sleep to absolute deadlines SELFTEST_PERIOD_NS
+ * apart and record how late each wakeup is, as cyclictest does.
+ */
+static void selftest_wakeups(void)
+{
+    uint64_t n = selftest_sec * (1000000000ULL / SELFTEST_PERIOD_NS);
+    struct timespec next;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t due;
+
+        next.tv_nsec += SELFTEST_PERIOD_NS;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+            ;
+        due = (uint64_t)next.tv_sec * 1000000000ULL + (uint64_t)next.tv_nsec;
+        st_add(&st_wakeup, monotonic_ns() - due);
+    }
+}
+
+/*
+ * selftest_requests - Time each stage of the raw path on synthetic
+ * versioned time requests over loopback: receive, classify, stamp and
+ * send, as serve_socket() does them, and with a key loaded the
+ * signature a TSA request adds. Every stage includes one
+ * clock_gettime() of its own.
+ * Returns 0, or -1 if the sockets cannot be set up.
+ */
+static int selftest_requests(void)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addrlen = sizeof(addr);
+    struct taas_time_request req = {
+        .hdr = { .magic = TAAS_MAGIC, .version = TAAS_VERSION, .type = TAAS_MSG_TIME_REQ },
+    };
+    struct taas_time_reply reply;
+    struct taas_certificate c;
+    union peer_addr src;
+    uint8_t buf[RX_BUF_SIZE], ctrl[RX_CTRL_SIZE];
+    struct iovec riov = { buf, sizeof(buf) }, tiov = { &reply, sizeof(reply) };
+    struct mmsghdr rx = { .msg_hdr = { .msg_iov = &riov, .msg_iovlen = 1 } };
+    struct mmsghdr tx = { .msg_hdr = { .msg_name = &src, .msg_iov = &tiov, .msg_iovlen = 1 } };
+    uint64_t n = selftest_sec * (1000000000ULL / SELFTEST_REQ_GAP_NS);
+    int srv, cli;
+
+    srv = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    cli = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (srv < 0 || cli < 0 ||
+        bind(srv, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        getsockname(srv, (struct sockaddr *)&addr, &addrlen) < 0 ||
+        connect(cli, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("taas: selftest loopback socket");
+        if (srv >= 0)
+            close(srv);
+        if (cli >= 0)
+            close(cli);
+        return -1;
+    }
+    listener_options(srv);
+
+    memset(c.client_hash, 0xa5, sizeof(c.client_hash));
+    for (uint64_t i = 0; i < n; i++) {
+        struct rx_clock ref = { 0, 0 };
+        uint64_t t[5], start = monotonic_ns();
+        enum req_kind k;
+
+        req.hdr.request_id = (uint32_t)i;
+        if (send(cli, &req, sizeof(req), 0) < 0)
+            continue;
+
+        rx.msg_hdr.msg_name       = &src;
+        rx.msg_hdr.msg_namelen    = sizeof(src);
+        rx.msg_hdr.msg_control    = rx_timestamps ? ctrl : NULL;
+        rx.msg_hdr.msg_controllen = rx_timestamps ? sizeof(ctrl) : 0;
+
+        t[0] = monotonic_ns();
+        if (recvmmsg(srv, &rx, 1, MSG_DONTWAIT, NULL) != 1)
+            continue;
+        if (rx_timestamps)
+            rx_clock_read(&ref);
+        t[1] = monotonic_ns();
+        k = classify_request(buf, rx.msg_len, rx.msg_hdr.msg_flags);
+        t[2] = monotonic_ns();
+        if (k != REQ_TIME)
+            continue;
+        reply.hdr = req.hdr;
+        reply.hdr.type = TAAS_MSG_TIME_REPLY;
+        reply.utc_timestamp_ns = stamp_request(&rx.msg_hdr, &ref);
+        t[3] = monotonic_ns();
+        tx.msg_hdr.msg_namelen = rx.msg_hdr.msg_namelen;
+        send_batch(srv, &tx, 1, NULL);
+        t[4] = monotonic_ns();
+
+        for (unsigned int s = 0; s < ST_REQUEST; s++)
+            st_add(&st_stage[s], t[s + 1] - t[s]);
+        st_add(&st_stage[ST_REQUEST], t[4] - t[0]);
+
+        if (pkey) {
+            c.utc_timestamp_ns = reply.utc_timestamp_ns;
+            t[0] = monotonic_ns();
+            sign_certificate(&c);
+            st_add(&st_sign, monotonic_ns() - t[0]);
+        }
+
+        while (recv(cli, buf, sizeof(buf), 0) >= 0)
+            ;
+        while (monotonic_ns() - start < SELFTEST_REQ_GAP_NS)
+            cpu_relax();
+    }
+
+    close(srv);
+    close(cli);
+    return 0;
+}
+
+/*
+ * selftest_run - --selftest: measure, print the report and the verdict.
+ * Runs where the node would serve, so the node itself must be stopped
+ * first, both want core 3.
+ * Returns the process exit status: failure if any p99.9 is over its
+ * --selftest-limit.
+ */
+static int selftest_run(void)
+{
+    int fail = 0;
+
+    printf("[TaaS] Self-test: %u s per measurement on core %d.\n", selftest_sec, sched_getcpu());
+
+    calibrate_time_anchor(1);
+    selftest_gaps();
+    selftest_wakeups();
+    if (selftest_requests() < 0)
+        return EXIT_FAILURE;
+
+#if TAAS_TIMER_SOURCE == TAAS_TIMER_ST
+    printf("[TaaS] Self-test timer reads: %llu, hi/lo retries: %llu.\n",
+           (unsigned long long)st_gap.count, (unsigned long long)st_retries);
+#endif
+    fail |= st_report("gap", &st_gap, st_limit_us[ST_LIMIT_GAP], 1);
+    fail |= st_report("wakeup", &st_wakeup, st_limit_us[ST_LIMIT_WAKEUP], 1);
+    for (unsigned int s = 0; s < ST_REQUEST; s++)
+        st_report(st_stage_name[s], &st_stage[s], 0, 0);
+    fail |= st_report("request", &st_stage[ST_REQUEST], st_limit_us[ST_LIMIT_REQUEST], 1);
+    if (pkey)
+        fail |= st_report("sign", &st_sign, st_limit_us[ST_LIMIT_SIGN], 1);
+
+    printf("[TaaS] Self-test %s.\n", fail ? "FAILED: p99.9 over its limit" : "passed");
+    return fail ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * enter_rt_core - Move onto core 3 and elevate to real-time FIFO, which
+ * preempts almost everything else on the system.
+ */
+static void enter_rt_core(void)
+{
+    struct sched_param sp = { .sched_priority = 99 };
+    cpu_set_t cpuset;
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(3, &cpuset);
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &cpuset) < 0)
+        perror("taas warning: isolcpus is active?");
+
+    if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0)
+        perror("taas: warning: sched_setscheduler failed");
+}
+
+int main(int argc, char **argv)
+{
+    if (parse_args(argc, argv) < 0)
+        return EXIT_FAILURE;
+
+    /* DISABLE STDOUT BUFFERING
+     * This ensures printf() shows up in journalctl immediately,
+     * crucial for monitoring the drift correction in real-time.
+     */
+    setbuf(stdout, NULL);
+
+    signal(SIGINT, shutdown_node);
+    signal(SIGTERM, shutdown_node);
+
+    OpenSSL_add_all_algorithms();
+
+    FILE *fp = fopen(KEY_FILE, "r");
+    if (fp) {
+        pkey = PEM_read_PrivateKey(fp, NULL, NULL, NULL);
+        fclose(fp);
+    } else {
+        fprintf(stderr, "Fatal: Key file not found. Generate Ed25519 key first.\n");
+    }
+    load_sign_key();
+
+    load_hmac_keys(HMAC_KEY_FILE);
+
+    /* Lock memory to prevent paging latency.
+     * Paging would introduce non-deterministic delays (jitter).
+     */
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+        perror("taas: warning: mlockall failed");
+
+    /* A successor starts up beside the running node and only moves
+     * onto its core once that one has let go.
+     */
+    if (!takeover)
+        enter_rt_core();
+
+    /* Open Timer Driver */
+    timer_fd = open(TIMER_DEVICE, O_RDWR | O_SYNC);
+    if (timer_fd < 0) {
+        perror("taas: open timer device");
+        return EXIT_FAILURE;
+    }
+
+    /* MMIO Map */
+    map_base = mmap(NULL, MAP_SIZE, PROT_READ, MAP_SHARED, timer_fd, 0);
+    if (map_base == MAP_FAILED) {
+        perror("taas: mmap failed");
+        close(timer_fd);
+        return EXIT_FAILURE;
+    }
+
+    timer_hz = taas_timer_hz();
+    printf("[TaaS] Timer source: %s, %llu Hz.\n",
+           TAAS_TIMER_SOURCE == TAAS_TIMER_CNTVCT ? "CNTVCT_EL0" : "BCM2837 system timer",
+           (unsigned long long)timer_hz);
+
+    /* Before anything a running node shares: its telemetry and state */
+    if (selftest_sec)
+        return selftest_run();
+
+    telemetry_open();
+    ratelimit_init();
+
+    if (use_pps) {
+        void *p = mmap(NULL, MAP_SIZE, PROT_READ, MAP_SHARED, timer_fd,
+                       (off_t)TAAS_MMAP_PPS * MAP_SIZE);
+        if (p == MAP_FAILED)
+            perror("taas: warning: no PPS ring (driver loaded without pps_gpio?)");
+        else
+            pps = p;
+    }
+
+    state_open();
+    calibrate_time_anchor(1);
+    state_resume();
+    /* A successor must not touch the driver's anchor or the state file
+     * while the previous node still owns them: takeover_receive() does
+     * this once it has the clock.
+     */
+    if (!takeover) {
+        publish_anchor();
+        state_save(0);
+    }
+
+    if (!takeover && open_listeners() < 0)
+        return EXIT_FAILURE;
+
+    if (pkey && nr_signers) {
+        nr_signers = start_signers(nr_signers);
+        if (!nr_signers)
+            fprintf(stderr, "taas: warning: no signer threads, signing inline\n");
+    } else {
+        if (pkey && merkle_window_us)
+            fprintf(stderr, "taas: warning: --merkle-window needs signer threads, ignored\n");
+        nr_signers = 0;
+    }
+
+    /* As late as possible: the previous node serves until here */
+    if (takeover) {
+        if (takeover_receive() < 0) {
+            /* Nothing handed over: the calibrated anchor is ours */
+            state_claim();
+            publish_anchor();
+            state_save(0);
+            if (open_listeners() < 0)
+                return EXIT_FAILURE;
+        }
+        enter_rt_core();
+    }
+    handoff_listen();
+
+    start_beacon();
+    batch_init();
+
+    if (ptp_ifname) {
+        struct taas_ptp_config pc = {
+            .ifname       = ptp_ifname,
+            .domain       = (uint8_t)ptp_domain,
+            .log_sync     = (int8_t)ptp_log_sync,
+            .log_announce = PTP_LOG_ANNOUNCE,
+            .log_min_delay_req = (int8_t)(ptp_log_delay_req == PTP_LOG_DELAY_REQ_SYNC
+                                          ? ptp_log_sync : ptp_log_delay_req),
+            .utc_offset   = PTP_UTC_OFFSET,
+            .pps          = pps != NULL,
+        };
+
+        /* Continue the previous node's port if it handed one over */
+        ptp = taas_ptp_adopt(&pc, ptp_handoff.event_fd >= 0 ? &ptp_handoff : NULL);
+        if (ptp)
+            printf("[TaaS] PTP grandmaster on %s, domain %u, Sync every 2^%d s.\n",
+                   ptp_ifname, ptp_domain, ptp_log_sync);
+        else
+            fprintf(stderr, "taas: warning: PTP unavailable, continuing without it\n");
+    } else if (ptp_handoff.event_fd >= 0) {
+        /* The previous node ran PTP, this one does not: the port ends here */
+        close(ptp_handoff.event_fd);
+        close(ptp_handoff.general_fd);
+    }
+
+#ifdef TAAS_XDP
+    if (xdp_ifname) {
+        xsk = taas_xsk_open(xdp_ifname, xdp_queue, xdp_prog);
+        if (!xsk)
+            fprintf(stderr, "taas: warning: AF_XDP unavailable, raw requests stay on the socket\n");
+    }
+#endif
+
+    open_peers();
+
+    if (event_loop_init() < 0)
+        return EXIT_FAILURE;
+    peers_round();
+
+    /* From here on, signals are handled by the loop itself */
+    signal(SIGINT, control_signal);
+    signal(SIGTERM, control_signal);
+    signal(SIGUSR1, control_signal);
+    signal(SIGUSR2, control_signal);
+    signal(SIGHUP, control_signal);
+    signal(SIGCHLD, SIG_IGN);   /* a successor that fails to start is not waited for */
+
+    printf("[TaaS] Unified Ed25519 Node Ready. Serving UTC Nanoseconds (batch %u, signers %u%s).\n",
+           rx_batch, nr_signers, busy_poll_us ? ", busy-poll" : "");
+    sd_notify("READY=1");
+
+    /*
+     * Main event loop: the packet path is only receive-stamp-send
+     * (serve_socket()). Drift checks and control requests arrive as
+     * events of their own, so neither costs anything per packet.
+     */
+    struct epoll_event ev[EV_MAX];
+    unsigned int spins = 0;
+    int running = 1;
+
+    while (running) {
+        int nev;
+
+        if (busy_poll_us) {
+            unsigned int got = 0;
+
+            for (unsigned int l = 0; l < nr_listeners; l++) {
+                got += serve_socket(l);
+                if (twostep[l].head != twostep[l].tail)
+                    twostep_drain(l);
+            }
+#ifdef TAAS_XDP
+            if (xsk)
+                got += serve_xsk();
+#endif
+            if (got && ++spins < EVENT_POLL_SPINS)
+                continue;
+            if (!got)
+                cpu_relax();
+            spins = 0;
+            nev = epoll_wait(epoll_fd, ev, EV_MAX, 0);
+        } else {
+            nev = epoll_wait(epoll_fd, ev, EV_MAX, -1);
+        }
+
+        for (int e = 0; e < nev && running; e++) {
+            uint32_t id = ev[e].data.u32;
 
-        time_t now = time(NULL);
-        if (now - last_check >= DRIFT_CHECK_INTERVAL) {
-            calibrate_time_anchor(0);
-            last_check = now;
+            if (id == EV_DRIFT)
+                drift_check();
+            else if (id == EV_CTL)
+                running = run_control();
+            else if (id == EV_HANDOFF)
+                running = handoff_serve();
+            else if (id >= EV_PEER)
+                peer_reply(id - EV_PEER);
+            else if (id >= EV_PTP_TIMER)
+                ptp_event(id, ev[e].events);
+            else if (ev[e].events & EPOLLERR)
+                twostep_drain(id);      /* TX stamps came in */
+            else
+                serve_socket(id);
         }
     }
 
+    shutdown_node(0);
     return 0;
 }
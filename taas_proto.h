@@ -0,0 +1,305 @@
+/* SPDX-License-Identifier: GPL-2.0
+ *
+ * TaaS wire formats
+ *
+ * Everything a client needs to talk to a TaaS node on UDP/1588.
+ * All multi-byte fields are little-endian (the node's native order)
+ * and every structure is packed: what you see is what is on the wire.
+ *
+ * Request dispatch:
+ * - exactly 32 bytes:               TSA request (SHA-256 document hash)
+ * - starts with a valid taas_hdr:   versioned request, see below
+ * - anything else:                  raw timestamp request
+ *
+ * Malformed versioned requests fall back to a raw reply, exactly like
+ * any other unrecognised datagram. Because length wins, no versioned
+ * request may ever be exactly 32 bytes long.
+ */
+#ifndef TAAS_PROTO_H
+#define TAAS_PROTO_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/stddef.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif
+
+#define TAAS_PORT 1588
+#define TAAS_BEACON_PORT 1589       /* multicast beacons (taas_node --beacon) */
+
+#define TAAS_MAGIC   0x53414154U    /* "TAAS" on the wire */
+#define TAAS_VERSION 1
+
+enum taas_msg_type {
+    TAAS_MSG_BATCH_REQ  = 1,
+    TAAS_MSG_BATCH_CERT = 2,
+    TAAS_MSG_HMAC_REQ   = 3,
+    TAAS_MSG_HMAC_REPLY = 4,
+    TAAS_MSG_BUSY       = 5,
+    TAAS_MSG_BEACON     = 6,
+    TAAS_MSG_TIME_REQ   = 7,
+    TAAS_MSG_TIME_REPLY = 8,
+    TAAS_MSG_FOLLOW_UP  = 9,
+    TAAS_MSG_EXT_TIME_REQ   = 10,
+    TAAS_MSG_EXT_TIME_REPLY = 11,
+    TAAS_MSG_EXT_TSA_REQ    = 12,
+    TAAS_MSG_EXT_CERT       = 13,
+};
+
+/*
+ * Common header of every versioned message. request_id is chosen by
+ * the client and echoed verbatim in the reply.
+ */
+struct __attribute__((packed)) taas_hdr {
+    uint32_t magic;
+    uint8_t  version;
+    uint8_t  type;
+    uint16_t flags;         /* zero in requests; TAAS_FLAG_* in replies */
+    uint32_t request_id;
+};
+
+/*
+ * Raw reply: a bare uint64_t, UTC nanoseconds since the epoch.
+ */
+
+/*
+ * TSA reply: a signed statement that client_hash existed at
+ * utc_timestamp_ns. The signature is Ed25519 over the first 40 bytes
+ * (client_hash || utc_timestamp_ns) exactly as they appear here.
+ */
+struct __attribute__((packed)) taas_certificate {
+    uint8_t  client_hash[32];
+    uint64_t utc_timestamp_ns;
+    uint8_t  signature[64];
+};
+
+/*
+ * Merkle-aggregated TSA reply (node started with --merkle-window).
+ *
+ * The node collects the requests of one aggregation window into a
+ * SHA-256 tree and signs only the root. Each client receives its own
+ * leaf plus the audit path needed to recompute that root:
+ *
+ *   leaf = SHA256(0x00 || client_hash || utc_timestamp_ns)
+ *   node = SHA256(0x01 || left || right)
+ *
+ * A level with an odd number of nodes promotes its last node
+ * unchanged. To verify, start from the leaf with idx = leaf_index and
+ * n = leaf_count, then while n > 1:
+ *
+ *   if idx is odd:           h = node(path[p++], h)
+ *   else if idx + 1 < n:     h = node(h, path[p++])
+ *   idx >>= 1; n = (n + 1) >> 1
+ *
+ * and check the Ed25519 signature over the resulting 32-byte root.
+ * Only the first path_len path entries are sent.
+ */
+#define TAAS_MERKLE_MAX_DEPTH   10
+#define TAAS_MERKLE_MAX_LEAVES  (1U << TAAS_MERKLE_MAX_DEPTH)
+#define TAAS_MERKLE_LEAF_PREFIX 0x00
+#define TAAS_MERKLE_NODE_PREFIX 0x01
+
+struct __attribute__((packed)) taas_merkle_certificate {
+    uint8_t  client_hash[32];
+    uint64_t utc_timestamp_ns;
+    uint8_t  signature[64];     /* Ed25519 over the tree root */
+    uint16_t leaf_index;
+    uint16_t leaf_count;
+    uint8_t  path_len;
+    uint8_t  reserved[3];
+    uint8_t  path[TAAS_MERKLE_MAX_DEPTH][32];
+};
+
+#define TAAS_MERKLE_CERT_SIZE(path_len) \
+    (sizeof(struct taas_merkle_certificate) - \
+     (TAAS_MERKLE_MAX_DEPTH - (path_len)) * 32)
+
+/*
+ * Batch TSA request: a header followed by 1..TAAS_BATCH_MAX_HASHES
+ * SHA-256 hashes. The count is implied by the datagram length, which
+ * must be exactly sizeof(struct taas_hdr) + 32 * count. 32 hashes keep
+ * both request and reply inside a single unfragmented datagram.
+ */
+#define TAAS_BATCH_MAX_HASHES 32
+
+struct __attribute__((packed)) taas_batch_request {
+    struct taas_hdr hdr;    /* type TAAS_MSG_BATCH_REQ */
+    uint8_t client_hash[TAAS_BATCH_MAX_HASHES][32];
+};
+
+/*
+ * Batch TSA reply: one timestamp and one signature for all hashes.
+ * The signature is Ed25519 over client_hash[0..count) || utc_timestamp_ns,
+ * so a batch of one signs exactly the same 40 bytes as a
+ * taas_certificate. Only the first count hashes are sent.
+ */
+struct __attribute__((packed)) taas_batch_certificate {
+    struct taas_hdr hdr;    /* type TAAS_MSG_BATCH_CERT */
+    uint16_t count;
+    uint16_t reserved;
+    uint64_t utc_timestamp_ns;
+    uint8_t  signature[64];
+    uint8_t  client_hash[TAAS_BATCH_MAX_HASHES][32];
+};
+
+#define TAAS_BATCH_REQ_SIZE(count) \
+    (sizeof(struct taas_hdr) + (count) * 32)
+#define TAAS_BATCH_CERT_SIZE(count) \
+    (sizeof(struct taas_batch_certificate) - \
+     (TAAS_BATCH_MAX_HASHES - (count)) * 32)
+
+/*
+ * Symmetric-key authenticated time, for clients that share a key with
+ * the node. Far cheaper than Ed25519 and answered inline on the timing
+ * core; use TSA certificates when a third party must verify.
+ *
+ * The client picks a fresh nonce and the key_id of its shared key.
+ * The reply echoes both, and tag is HMAC-SHA256 over every byte of the
+ * reply that precedes it.
+ */
+struct __attribute__((packed)) taas_hmac_request {
+    struct taas_hdr hdr;    /* type TAAS_MSG_HMAC_REQ */
+    uint32_t key_id;
+    uint32_t reserved;      /* keeps the request off the 32-byte TSA length */
+    uint8_t  nonce[16];
+};
+
+struct __attribute__((packed)) taas_hmac_reply {
+    struct taas_hdr hdr;    /* type TAAS_MSG_HMAC_REPLY */
+    uint32_t key_id;
+    uint32_t reserved;
+    uint64_t utc_timestamp_ns;
+    uint8_t  nonce[16];
+    uint8_t  tag[32];
+};
+
+/*
+ * Busy reply: the node refused to sign because the source exceeded its
+ * per-client budget (taas_node --tsa-limit). Sent instead of a
+ * certificate or batch certificate, unsigned, and smaller than any
+ * signed request so it can't be used for amplification.
+ *
+ * request_id is echoed from a batch request and 0 for a bare 32-byte
+ * TSA request; hash_prefix holds the first 8 bytes of the (first)
+ * refused hash so either kind can be matched. Retry no sooner than
+ * retry_after_us.
+ */
+struct __attribute__((packed)) taas_busy_reply {
+    struct taas_hdr hdr;    /* type TAAS_MSG_BUSY */
+    uint32_t retry_after_us;
+    uint8_t  hash_prefix[8];
+};
+
+/*
+ * Two-step time. A versioned raw request: the reply carries the time
+ * stamped on receipt (with taas_node --rx-timestamp, the kernel
+ * receive time), exactly what a raw reply would hold.
+ *
+ * If the node runs with --two-step, the reply has TAAS_FLAG_TWO_STEP
+ * set and is followed by a taas_follow_up with the same request_id.
+ * It carries the time the reply was actually handed to the network
+ * device, taken by the kernel (SO_TIMESTAMPING). Queueing and transmit
+ * delay inside the node then no longer count as path delay: use
+ * tx_timestamp_ns as the server's transmit time and utc_timestamp_ns
+ * as its receive time. A follow-up can be lost like any datagram;
+ * without one, fall back to utc_timestamp_ns alone.
+ */
+#define TAAS_FLAG_TWO_STEP 0x0001
+
+struct __attribute__((packed)) taas_time_request {
+    struct taas_hdr hdr;    /* type TAAS_MSG_TIME_REQ */
+};
+
+struct __attribute__((packed)) taas_time_reply {
+    struct taas_hdr hdr;    /* type TAAS_MSG_TIME_REPLY */
+    uint64_t utc_timestamp_ns;
+};
+
+struct __attribute__((packed)) taas_follow_up {
+    struct taas_hdr hdr;    /* type TAAS_MSG_FOLLOW_UP */
+    uint64_t tx_timestamp_ns;
+};
+
+/*
+ * Extended replies: the server's receive and transmit times.
+ *
+ * Both come from the same anchor. rx_timestamp_ns is the receive stamp
+ * every other reply carries (the kernel receive time with
+ * taas_node --rx-timestamp); tx_timestamp_ns is taken right before the
+ * reply is handed to the socket, so the difference is the residence
+ * time inside the node, signing queue included. With the client's own
+ * send and receive times T1 and T4, and T2/T3 the server's, the usual
+ * NTP estimates hold:
+ *
+ *   offset = ((T2 - T1) + (T3 - T4)) / 2
+ *   delay  = (T4 - T1) - (T3 - T2)
+ *
+ * The raw form is answered inline like a raw request. The TSA form
+ * returns a certificate whose signature covers exactly the 40 bytes a
+ * taas_certificate signature covers (client_hash || utc_timestamp_ns,
+ * the receive time); tx_timestamp_ns is known only once signing is
+ * done and is not signed. Extended TSA requests are always signed on
+ * their own, never aggregated into a Merkle window.
+ */
+struct __attribute__((packed)) taas_ext_time_request {
+    struct taas_hdr hdr;    /* type TAAS_MSG_EXT_TIME_REQ */
+};
+
+struct __attribute__((packed)) taas_ext_time_reply {
+    struct taas_hdr hdr;    /* type TAAS_MSG_EXT_TIME_REPLY */
+    uint64_t rx_timestamp_ns;
+    uint64_t tx_timestamp_ns;
+};
+
+struct __attribute__((packed)) taas_ext_tsa_request {
+    struct taas_hdr hdr;    /* type TAAS_MSG_EXT_TSA_REQ */
+    uint8_t client_hash[32];
+};
+
+struct __attribute__((packed)) taas_ext_certificate {
+    struct taas_hdr hdr;    /* type TAAS_MSG_EXT_CERT */
+    uint8_t  client_hash[32];
+    uint64_t utc_timestamp_ns;  /* receive time, signed */
+    uint8_t  signature[64];
+    uint64_t tx_timestamp_ns;   /* transmit time, not signed */
+};
+
+/*
+ * Time beacon: pushed by the node to a multicast group on
+ * TAAS_BEACON_PORT (taas_node --beacon), never sent as a reply.
+ * Consumers just listen, so a fleet costs the node one signature per
+ * beacon instead of one round trip per client.
+ *
+ * Like a taas_certificate, the signed fields come first and the
+ * Ed25519 signature covers exactly the bytes preceding it, with seq in
+ * the place of a client hash. The signed part is 48 bytes, a length no
+ * TSA, batch or Merkle signature ever has, so a certificate can never
+ * pass for a beacon.
+ *
+ * utc_timestamp_ns is the node time at which the beacon left (beacons
+ * are signed ahead of time and released on that instant), aligned to
+ * a multiple of interval_ms. seq grows by one per beacon; a gap means
+ * lost beacons, a step back a restarted node. freq_mppb is the rate
+ * correction the node currently applies to its oscillator, in
+ * 0.001 ppb, and anchor_utc_ns the time of its last calibration, so a
+ * listener can judge how fresh the discipline is before extrapolating
+ * between beacons on its own clock.
+ */
+#define TAAS_BEACON_PPS     (1U << 0)   /* disciplined from a PPS input */
+
+struct __attribute__((packed)) taas_beacon {
+    struct taas_hdr hdr;        /* type TAAS_MSG_BEACON, request_id 0 */
+    uint32_t interval_ms;
+    uint64_t seq;
+    uint64_t utc_timestamp_ns;
+    uint64_t anchor_utc_ns;
+    int32_t  freq_mppb;
+    uint32_t flags;             /* TAAS_BEACON_* */
+    uint8_t  signature[64];
+};
+
+#define TAAS_BEACON_SIGNED_LEN offsetof(struct taas_beacon, signature)
+
+#endif /* TAAS_PROTO_H */
@@ -0,0 +1,556 @@
+/*
+ * TaaS Node - PTPv2 grandmaster port (UDP/IPv4, two-step, E2E)
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * A master-only ordinary clock with one port. Messages are built in
+ * network byte order from a single header template; the per-message
+ * work is a sequence id, a timestamp and one sendto().
+ *
+ * Message flow, seen from a slave:
+ *   Announce  (general, multicast)  who the grandmaster is
+ *   Sync      (event,   multicast)  twoStepFlag set, no timestamp
+ *   Follow_Up (general, multicast)  preciseOriginTimestamp t1, the
+ *                                   kernel's transmit stamp of the Sync
+ *   Delay_Req (event,   from slave) received at t4
+ *   Delay_Resp(general, unicast)    receiveTimestamp t4
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <arpa/inet.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+
+#include "taas_ptp.h"
+
+#define PTP_GROUP "224.0.1.129"
+
+enum ptp_msg {
+    PTP_SYNC       = 0x0,
+    PTP_DELAY_REQ  = 0x1,
+    PTP_FOLLOW_UP  = 0x8,
+    PTP_DELAY_RESP = 0x9,
+    PTP_ANNOUNCE   = 0xb,
+};
+
+/* flagField, first octet */
+#define PTP_FLAG_TWO_STEP       0x0200
+#define PTP_FLAG_UNICAST        0x0400
+/* flagField, second octet */
+#define PTP_FLAG_UTC_OFFSET_OK  0x0004
+#define PTP_FLAG_PTP_TIMESCALE  0x0008
+#define PTP_FLAG_TIME_TRACE     0x0010
+#define PTP_FLAG_FREQ_TRACE     0x0020
+
+/* Announce clock quality (IEEE 1588-2008, 7.6.2) */
+#define PTP_CLASS_PRIMARY       6       /* locked to a primary reference */
+#define PTP_CLASS_DEFAULT       248
+#define PTP_ACCURACY_250NS      0x22
+#define PTP_ACCURACY_UNKNOWN    0xfe
+#define PTP_SOURCE_GPS          0x20
+#define PTP_SOURCE_NTP          0x50
+#define PTP_PRIORITY_DEFAULT    128
+
+/* Delay_Req carries no interval; 0x7f is "not applicable" */
+#define PTP_LOG_INTERVAL_NA     0x7f
+
+struct __attribute__((packed)) ptp_port_id {
+    uint8_t  clock_id[8];
+    uint16_t port;
+};
+
+struct __attribute__((packed)) ptp_timestamp {
+    uint16_t sec_hi;
+    uint32_t sec_lo;
+    uint32_t nsec;
+};
+
+struct __attribute__((packed)) ptp_header {
+    uint8_t  type;              /* transportSpecific << 4 | messageType */
+    uint8_t  version;           /* versionPTP = 2 */
+    uint16_t length;
+    uint8_t  domain;
+    uint8_t  reserved1;
+    uint16_t flags;
+    int64_t  correction;        /* ns << 16 */
+    uint32_t reserved2;
+    struct ptp_port_id source;
+    uint16_t seq;
+    uint8_t  control;
+    int8_t   log_interval;
+};
+
+struct __attribute__((packed)) ptp_sync {
+    struct ptp_header hdr;
+    struct ptp_timestamp origin;
+};
+
+struct __attribute__((packed)) ptp_delay_resp {
+    struct ptp_header hdr;
+    struct ptp_timestamp receive;
+    struct ptp_port_id requesting;
+};
+
+struct __attribute__((packed)) ptp_announce {
+    struct ptp_header hdr;
+    struct ptp_timestamp origin;
+    int16_t  utc_offset;
+    uint8_t  reserved;
+    uint8_t  priority1;
+    uint8_t  clock_class;
+    uint8_t  clock_accuracy;
+    uint16_t variance;
+    uint8_t  priority2;
+    uint8_t  gm_id[8];
+    uint16_t steps_removed;
+    uint8_t  time_source;
+};
+
+_Static_assert(sizeof(struct ptp_header) == 34, "PTP header is 34 octets");
+_Static_assert(sizeof(struct ptp_sync) == 44, "Sync/Follow_Up/Delay_Req are 44 octets");
+_Static_assert(sizeof(struct ptp_delay_resp) == 54, "Delay_Resp is 54 octets");
+_Static_assert(sizeof(struct ptp_announce) == 64, "Announce is 64 octets");
+
+struct taas_ptp {
+    int event_fd;
+    int general_fd;
+    int timer_fd;
+    struct taas_ptp_config cfg;
+    struct sockaddr_in event_dst, general_dst;
+    struct ptp_header tmpl;     /* our port: domain, version, source */
+    int tx_stamps;              /* Sync transmit stamps come on the error queue */
+    uint32_t tx_key;            /* OPT_ID of the next Sync's stamp */
+    int pending;                /* a Sync awaits its stamp and Follow_Up */
+    uint32_t pending_key;
+    uint16_t pending_seq;
+    uint16_t sync_seq;
+    uint16_t announce_seq;
+    unsigned int syncs_per_announce;
+    unsigned int syncs;
+};
+
+/*
+ * put_header - Fill a header from the port template.
+ */
+static void put_header(const struct taas_ptp *p, struct ptp_header *h, enum ptp_msg type,
+                       size_t len, uint16_t flags, uint16_t seq, uint8_t control, int8_t log)
+{
+    *h = p->tmpl;
+    h->type         = type;
+    h->length       = htobe16((uint16_t)len);
+    h->flags        = htobe16(flags);
+    h->seq          = htobe16(seq);
+    h->control      = control;
+    h->log_interval = log;
+}
+
+/*
+ * put_timestamp - UTC nanoseconds to a PTP (TAI) timestamp.
+ */
+static void put_timestamp(const struct taas_ptp *p, struct ptp_timestamp *ts, uint64_t utc_ns)
+{
+    uint64_t sec = utc_ns / 1000000000ULL + (uint64_t)(int64_t)p->cfg.utc_offset;
+
+    ts->sec_hi = htobe16((uint16_t)(sec >> 32));
+    ts->sec_lo = htobe32((uint32_t)sec);
+    ts->nsec   = htobe32((uint32_t)(utc_ns % 1000000000ULL));
+}
+
+/* flagField of everything that describes our time */
+static uint16_t time_flags(const struct taas_ptp *p)
+{
+    uint16_t f = PTP_FLAG_PTP_TIMESCALE | PTP_FLAG_UTC_OFFSET_OK;
+
+    if (p->cfg.pps)
+        f |= PTP_FLAG_TIME_TRACE | PTP_FLAG_FREQ_TRACE;
+    return f;
+}
+
+/*
+ * clock_identity - EUI-64 of the interface's MAC (ff:fe in the middle).
+ */
+static int clock_identity(int fd, const char *ifname, uint8_t id[8])
+{
+    struct ifreq ifr;
+    const uint8_t *mac;
+
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+    if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0)
+        return -1;
+
+    mac = (const uint8_t *)ifr.ifr_hwaddr.sa_data;
+    id[0] = mac[0]; id[1] = mac[1]; id[2] = mac[2];
+    id[3] = 0xff;   id[4] = 0xfe;
+    id[5] = mac[3]; id[6] = mac[4]; id[7] = mac[5];
+    return 0;
+}
+
+/*
+ * open_port - One UDP socket on port, bound to the interface and
+ * joined to the PTP group on it.
+ */
+static int open_port(const struct taas_ptp_config *cfg, unsigned int ifindex, uint16_t port)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port   = htons(port),
+        .sin_addr   = { htonl(INADDR_ANY) },
+    };
+    struct ip_mreqn mreq = { .imr_ifindex = (int)ifindex };
+    unsigned char ttl = 1;
+    int one = 1;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("taas: ptp: socket");
+        return -1;
+    }
+
+    inet_pton(AF_INET, PTP_GROUP, &mreq.imr_multiaddr);
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, cfg->ifname,
+                   (socklen_t)strlen(cfg->ifname)) < 0 ||
+        bind(fd, (const struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 ||
+        setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq)) < 0 ||
+        setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0) {
+        fprintf(stderr, "taas: ptp: port %u on %s: %s\n", port, cfg->ifname, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * bound_to - Whether a handed-over socket is bound to ifname.
+ */
+static int bound_to(int fd, const char *ifname)
+{
+    char dev[IF_NAMESIZE] = "";
+    socklen_t len = sizeof(dev);
+
+    return getsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, dev, &len) == 0 && !strcmp(dev, ifname);
+}
+
+struct taas_ptp *taas_ptp_open(const struct taas_ptp_config *cfg)
+{
+    return taas_ptp_adopt(cfg, NULL);
+}
+
+struct taas_ptp *taas_ptp_adopt(const struct taas_ptp_config *cfg, const struct taas_ptp_handoff *h)
+{
+    struct taas_ptp *p;
+    unsigned int ifindex = if_nametoindex(cfg->ifname);
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+                SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_OPT_ID |
+                SOF_TIMESTAMPING_OPT_TSONLY;
+    int64_t ns = cfg->log_sync >= 0 ? 1000000000LL << cfg->log_sync
+                                    : 1000000000LL >> -cfg->log_sync;
+    struct itimerspec its = {
+        .it_interval = { .tv_sec = ns / 1000000000LL, .tv_nsec = ns % 1000000000LL },
+        .it_value    = { .tv_sec = ns / 1000000000LL, .tv_nsec = ns % 1000000000LL },
+    };
+
+    const int zero = 0;
+    uint8_t junk[1];
+
+    if (h && !(ifindex && bound_to(h->event_fd, cfg->ifname) &&
+               bound_to(h->general_fd, cfg->ifname))) {
+        fprintf(stderr, "taas: ptp: previous node ran the port elsewhere, opening %s afresh\n",
+                cfg->ifname);
+        close(h->event_fd);
+        close(h->general_fd);
+        h = NULL;
+    }
+
+    if (!ifindex) {
+        fprintf(stderr, "taas: ptp: unknown interface %s\n", cfg->ifname);
+        return NULL;
+    }
+
+    p = calloc(1, sizeof(*p));
+    if (!p) {
+        if (h) {
+            close(h->event_fd);
+            close(h->general_fd);
+        }
+        return NULL;
+    }
+    p->cfg = *cfg;
+    p->event_fd = p->general_fd = p->timer_fd = -1;
+
+    if (h) {
+        p->event_fd = h->event_fd;
+        p->general_fd = h->general_fd;
+        p->sync_seq = h->sync_seq;
+        p->announce_seq = h->announce_seq;
+
+        /* Clearing OPT_ID first makes the kernel number stamps from 0
+         * again; stamps of the previous node's Syncs are of no use.
+         */
+        setsockopt(p->event_fd, SOL_SOCKET, SO_TIMESTAMPING, &zero, sizeof(zero));
+        while (recv(p->event_fd, junk, sizeof(junk), MSG_ERRQUEUE | MSG_DONTWAIT) >= 0)
+            ;
+    } else {
+        p->event_fd = open_port(cfg, ifindex, TAAS_PTP_EVENT_PORT);
+        p->general_fd = open_port(cfg, ifindex, TAAS_PTP_GENERAL_PORT);
+        if (p->event_fd < 0 || p->general_fd < 0)
+            goto fail;
+    }
+
+    /* Delay_Req arrival and Sync departure are stamped by the kernel,
+     * not when the caller gets to them. Only Syncs are sent on the
+     * event port, so its transmit stamps are theirs, numbered from 0.
+     */
+    if (setsockopt(p->event_fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0) {
+        p->tx_stamps = 1;
+    } else {
+        perror("taas: ptp: warning: Sync TX timestamps unavailable");
+        flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        if (setsockopt(p->event_fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0)
+            perror("taas: ptp: warning: SO_TIMESTAMPING unavailable");
+    }
+
+    p->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (p->timer_fd < 0 || timerfd_settime(p->timer_fd, 0, &its, NULL) < 0) {
+        perror("taas: ptp: sync timer");
+        goto fail;
+    }
+
+    p->event_dst.sin_family = AF_INET;
+    p->event_dst.sin_port = htons(TAAS_PTP_EVENT_PORT);
+    inet_pton(AF_INET, PTP_GROUP, &p->event_dst.sin_addr);
+    p->general_dst = p->event_dst;
+    p->general_dst.sin_port = htons(TAAS_PTP_GENERAL_PORT);
+
+    memset(&p->tmpl, 0, sizeof(p->tmpl));
+    p->tmpl.version = 2;
+    p->tmpl.domain = cfg->domain;
+    p->tmpl.source.port = htobe16(1);
+    if (clock_identity(p->event_fd, cfg->ifname, p->tmpl.source.clock_id) < 0) {
+        perror("taas: ptp: SIOCGIFHWADDR");
+        goto fail;
+    }
+
+    p->syncs_per_announce = cfg->log_announce >= cfg->log_sync
+                            ? 1U << (cfg->log_announce - cfg->log_sync) : 1;
+    return p;
+
+fail:
+    taas_ptp_close(p);
+    return NULL;
+}
+
+void taas_ptp_handoff(const struct taas_ptp *p, struct taas_ptp_handoff *h)
+{
+    h->event_fd = p->event_fd;
+    h->general_fd = p->general_fd;
+    h->sync_seq = p->sync_seq;
+    h->announce_seq = p->announce_seq;
+}
+
+void taas_ptp_close(struct taas_ptp *p)
+{
+    if (!p)
+        return;
+    if (p->event_fd >= 0)
+        close(p->event_fd);
+    if (p->general_fd >= 0)
+        close(p->general_fd);
+    if (p->timer_fd >= 0)
+        close(p->timer_fd);
+    free(p);
+}
+
+int taas_ptp_timer_fd(const struct taas_ptp *p)
+{
+    return p->timer_fd;
+}
+
+int taas_ptp_event_fd(const struct taas_ptp *p)
+{
+    return p->event_fd;
+}
+
+int taas_ptp_general_fd(const struct taas_ptp *p)
+{
+    return p->general_fd;
+}
+
+int taas_ptp_timer(struct taas_ptp *p)
+{
+    uint64_t expirations;
+
+    return read(p->timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations);
+}
+
+/*
+ * send_announce - Grandmaster dataset of this node, on the general port.
+ * Quality follows the discipline: a PPS-locked node is a primary
+ * reference, an NTP-disciplined one a default-class clock.
+ */
+static void send_announce(struct taas_ptp *p, uint64_t utc_ns)
+{
+    struct ptp_announce a;
+
+    memset(&a, 0, sizeof(a));
+    put_header(p, &a.hdr, PTP_ANNOUNCE, sizeof(a), time_flags(p), p->announce_seq++,
+               5, p->cfg.log_announce);
+    put_timestamp(p, &a.origin, utc_ns);
+    a.utc_offset     = (int16_t)htobe16((uint16_t)p->cfg.utc_offset);
+    a.priority1      = PTP_PRIORITY_DEFAULT;
+    a.clock_class    = p->cfg.pps ? PTP_CLASS_PRIMARY : PTP_CLASS_DEFAULT;
+    a.clock_accuracy = p->cfg.pps ? PTP_ACCURACY_250NS : PTP_ACCURACY_UNKNOWN;
+    a.variance       = 0xffff;
+    a.priority2      = PTP_PRIORITY_DEFAULT;
+    memcpy(a.gm_id, p->tmpl.source.clock_id, sizeof(a.gm_id));
+    a.steps_removed  = 0;
+    a.time_source    = p->cfg.pps ? PTP_SOURCE_GPS : PTP_SOURCE_NTP;
+
+    sendto(p->general_fd, &a, sizeof(a), 0,
+           (const struct sockaddr *)&p->general_dst, sizeof(p->general_dst));
+}
+
+static void send_follow_up(struct taas_ptp *p, uint16_t seq, uint64_t utc_ns)
+{
+    struct ptp_sync m;
+
+    memset(&m, 0, sizeof(m));
+    put_header(p, &m.hdr, PTP_FOLLOW_UP, sizeof(m), time_flags(p), seq, 2, p->cfg.log_sync);
+    put_timestamp(p, &m.origin, utc_ns);
+    sendto(p->general_fd, &m, sizeof(m), 0,
+           (const struct sockaddr *)&p->general_dst, sizeof(p->general_dst));
+}
+
+void taas_ptp_sync(struct taas_ptp *p, uint64_t utc_ns)
+{
+    struct ptp_sync m;
+    uint16_t seq = p->sync_seq++;
+
+    /* Sync: the timestamp lives in the Follow_Up (two-step) */
+    memset(&m, 0, sizeof(m));
+    put_header(p, &m.hdr, PTP_SYNC, sizeof(m), PTP_FLAG_TWO_STEP | time_flags(p), seq,
+               0, p->cfg.log_sync);
+    if (sendto(p->event_fd, &m, sizeof(m), 0,
+               (const struct sockaddr *)&p->event_dst, sizeof(p->event_dst)) == sizeof(m)) {
+        if (p->tx_stamps) {
+            /* A previous Sync still without its stamp goes without Follow_Up */
+            p->pending = 1;
+            p->pending_key = p->tx_key++;
+            p->pending_seq = seq;
+        } else {
+            send_follow_up(p, seq, utc_ns);
+        }
+    }
+
+    if (p->syncs++ % p->syncs_per_announce == 0)
+        send_announce(p, utc_ns);
+}
+
+int taas_ptp_tx_stamp(struct taas_ptp *p, struct taas_ptp_req *r)
+{
+    while (1) {
+        uint32_t key = 0;
+        int found = 0;
+
+        memset(&r->mh, 0, sizeof(r->mh));
+        r->mh.msg_control = r->ctrl;
+        r->mh.msg_controllen = sizeof(r->ctrl);
+        if (recvmsg(p->event_fd, &r->mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            break;
+
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&r->mh); cm; cm = CMSG_NXTHDR(&r->mh, cm)) {
+            struct sock_extended_err serr;
+
+            if (cm->cmsg_level != SOL_IP || cm->cmsg_type != IP_RECVERR)
+                continue;
+
+            memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+            if (serr.ee_errno == ENOMSG && serr.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+                key = serr.ee_data;
+                found = 1;
+            }
+        }
+
+        /* Older keys are Syncs given up on. Newer ones mean the kernel
+         * numbered a send that then failed: catch up with it.
+         */
+        if (!found || !p->pending || (int32_t)(key - p->pending_key) < 0)
+            continue;
+        p->tx_key = key + 1;
+        p->pending = 0;
+        return 1;
+    }
+    return 0;
+}
+
+void taas_ptp_follow_up(struct taas_ptp *p, uint64_t utc_ns)
+{
+    send_follow_up(p, p->pending_seq, utc_ns);
+}
+
+unsigned int taas_ptp_recv(struct taas_ptp *p, struct taas_ptp_req *reqs, unsigned int max)
+{
+    unsigned int n = 0;
+
+    while (n < max) {
+        struct taas_ptp_req *r = &reqs[n];
+        const struct ptp_header *h = (const struct ptp_header *)r->buf;
+        ssize_t len;
+
+        r->iov.iov_base = r->buf;
+        r->iov.iov_len = sizeof(r->buf);
+        memset(&r->mh, 0, sizeof(r->mh));
+        r->mh.msg_name = &r->src;
+        r->mh.msg_namelen = sizeof(r->src);
+        r->mh.msg_iov = &r->iov;
+        r->mh.msg_iovlen = 1;
+        r->mh.msg_control = r->ctrl;
+        r->mh.msg_controllen = sizeof(r->ctrl);
+
+        len = recvmsg(p->event_fd, &r->mh, MSG_DONTWAIT);
+        if (len < 0)
+            break;
+
+        /* Our own multicast Sync loops back here, among other things */
+        if ((size_t)len < sizeof(struct ptp_sync) || (h->type & 0x0f) != PTP_DELAY_REQ ||
+            (h->version & 0x0f) != 2 || h->domain != p->cfg.domain)
+            continue;
+        n++;
+    }
+    return n;
+}
+
+void taas_ptp_delay_resp(struct taas_ptp *p, const struct taas_ptp_req *r, uint64_t rx_utc_ns)
+{
+    const struct ptp_header *req = (const struct ptp_header *)r->buf;
+    struct sockaddr_in dst = r->src;
+    struct ptp_delay_resp m;
+
+    /* correctionField is echoed: t4 has no sub-nanosecond part to subtract */
+    put_header(p, &m.hdr, PTP_DELAY_RESP, sizeof(m), PTP_FLAG_UNICAST | time_flags(p),
+               be16toh(req->seq), 3, p->cfg.log_min_delay_req);
+    m.hdr.correction = req->correction;
+    put_timestamp(p, &m.receive, rx_utc_ns);
+    m.requesting = req->source;
+
+    dst.sin_port = htons(TAAS_PTP_GENERAL_PORT);
+    sendto(p->general_fd, &m, sizeof(m), 0, (const struct sockaddr *)&dst, sizeof(dst));
+}
+
+void taas_ptp_general(struct taas_ptp *p)
+{
+    uint8_t buf[TAAS_PTP_MSG_MAX];
+
+    while (recv(p->general_fd, buf, sizeof(buf), MSG_DONTWAIT) >= 0)
+        ;
+}
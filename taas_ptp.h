@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: GPL-2.0
+ *
+ * TaaS PTP grandmaster
+ *
+ * IEEE 1588-2008 (PTPv2) master port over UDP/IPv4, so stock clients
+ * such as ptp4l can follow the node without any TaaS-specific code:
+ * two-step Sync/Follow_Up and Announce are multicast to 224.0.1.129
+ * on the configured interface, and every Delay_Req gets a unicast
+ * Delay_Resp. The port is always master: there is no BMCA, the node
+ * never follows another clock.
+ *
+ * Like the AF_XDP module, this one knows nothing about time. The
+ * caller stamps each Follow_Up from the kernel's transmit stamp of its
+ * Sync, and each Delay_Req from its receive stamp; times are passed
+ * in UTC and put on the wire in the PTP (TAI) timescale.
+ *
+ * All fds are non-blocking and meant for the caller's epoll loop.
+ */
+#ifndef TAAS_PTP_H
+#define TAAS_PTP_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define TAAS_PTP_EVENT_PORT   319
+#define TAAS_PTP_GENERAL_PORT 320
+#define TAAS_PTP_MSG_MAX      128     /* above any message the port accepts */
+
+struct taas_ptp;
+
+struct taas_ptp_config {
+    const char *ifname;         /* interface the group is joined on */
+    uint8_t  domain;            /* domainNumber */
+    int8_t   log_sync;          /* log2 of the Sync interval, in seconds */
+    int8_t   log_announce;      /* log2 of the Announce interval */
+    int8_t   log_min_delay_req; /* log2 of the Delay_Req interval slaves may use */
+    int16_t  utc_offset;        /* TAI - UTC, in seconds */
+    int      pps;               /* disciplined from PPS: advertise as GPS-traceable */
+};
+
+/*
+ * One received Delay_Req, or the transmit report of a Sync, with its
+ * ancillary data for the caller's stamp
+ */
+struct taas_ptp_req {
+    struct msghdr mh;
+    struct iovec iov;
+    struct sockaddr_in src;
+    uint8_t buf[TAAS_PTP_MSG_MAX];
+    uint8_t ctrl[128];          /* scm_timestamping, and the report's sock_extended_err */
+};
+
+/* A running port as a successor node continues it (taas_ptp_adopt()) */
+struct taas_ptp_handoff {
+    int event_fd;
+    int general_fd;
+    uint16_t sync_seq;
+    uint16_t announce_seq;
+};
+
+/*
+ * taas_ptp_open - Bind the event and general ports on cfg->ifname and
+ * join the PTP group. Returns NULL (with a message on stderr) on failure.
+ */
+struct taas_ptp *taas_ptp_open(const struct taas_ptp_config *cfg);
+
+/*
+ * taas_ptp_adopt - Like taas_ptp_open(), but continue the port another
+ * node handed over: same sockets and group membership, and sequence
+ * ids that go on where it stopped. Takes the fds in h in every case;
+ * if they serve another interface they are closed and fresh ones opened.
+ */
+struct taas_ptp *taas_ptp_adopt(const struct taas_ptp_config *cfg, const struct taas_ptp_handoff *h);
+
+/* What taas_ptp_adopt() needs; the fds stay the caller's to send */
+void taas_ptp_handoff(const struct taas_ptp *p, struct taas_ptp_handoff *h);
+
+void taas_ptp_close(struct taas_ptp *p);
+
+/* Sync timer, event (319) and general (320) sockets */
+int taas_ptp_timer_fd(const struct taas_ptp *p);
+int taas_ptp_event_fd(const struct taas_ptp *p);
+int taas_ptp_general_fd(const struct taas_ptp *p);
+
+/*
+ * taas_ptp_timer - Consume the timer's expirations.
+ * Returns 1 if a Sync is due.
+ */
+int taas_ptp_timer(struct taas_ptp *p);
+
+/*
+ * taas_ptp_sync - Send a Sync now; utc_ns is the time the caller took
+ * right before the call. The Follow_Up waits for the Sync's transmit
+ * stamp (taas_ptp_tx_stamp()), unless the socket cannot report one:
+ * then it goes out at once, carrying utc_ns. Announce goes out along
+ * with every Sync that falls on its interval.
+ */
+void taas_ptp_sync(struct taas_ptp *p, uint64_t utc_ns);
+
+/*
+ * taas_ptp_tx_stamp - Drain the event socket's error queue (EPOLLERR)
+ * into *r, keeping the transmit report of the Sync that still awaits
+ * its Follow_Up. Never blocks.
+ * Returns 1 if that report came: pass its stamp to taas_ptp_follow_up().
+ */
+int taas_ptp_tx_stamp(struct taas_ptp *p, struct taas_ptp_req *r);
+
+/* Send the Follow_Up of the Sync taas_ptp_tx_stamp() returned, sent at utc_ns */
+void taas_ptp_follow_up(struct taas_ptp *p, uint64_t utc_ns);
+
+/*
+ * taas_ptp_recv - Take up to max Delay_Req messages of our domain from
+ * the event socket. Everything else is dropped. Never blocks.
+ */
+unsigned int taas_ptp_recv(struct taas_ptp *p, struct taas_ptp_req *reqs, unsigned int max);
+
+/* Answer one Delay_Req that arrived at rx_utc_ns */
+void taas_ptp_delay_resp(struct taas_ptp *p, const struct taas_ptp_req *r, uint64_t rx_utc_ns);
+
+/* Drain the general port: the master has nothing to act on there */
+void taas_ptp_general(struct taas_ptp *p);
+
+#endif /* TAAS_PTP_H */
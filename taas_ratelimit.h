@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: GPL-2.0
+ *
+ * TaaS admission control
+ *
+ * Per-source rate limiting for core 3. Every source address gets one
+ * token bucket per budget (raw and signed), kept in a fixed-size
+ * open-addressing table that the node allocates statically and locks
+ * with the rest of its memory. A source only ever lives in the
+ * aligned group of TAAS_RL_PROBE slots its hash selects, so a lookup
+ * touches two cache lines and never allocates.
+ *
+ * Buckets are kept as a GCRA "theoretical arrival time" rather than a
+ * token count: one 64-bit timestamp per budget, no division on the
+ * hot path. A request is admitted while the bucket runs at most
+ * burst - 1 intervals ahead of now.
+ *
+ * When every slot of a probe window is taken, the source seen least
+ * recently is evicted. An evicted source starts again with a full
+ * bucket, so a small table can only make limiting more lenient.
+ *
+ * Sources are keyed by 64 bits: an IPv4 address tagged into reserved
+ * IPv6 space, or the /64 prefix of an IPv6 address. A single IPv6 host usually
+ * owns a whole /64, so charging per address would give it 2^64 buckets.
+ */
+#ifndef TAAS_RATELIMIT_H
+#define TAAS_RATELIMIT_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define TAAS_RL_BITS  13
+#define TAAS_RL_SLOTS (1U << TAAS_RL_BITS)
+#define TAAS_RL_PROBE 4             /* aligned group of slots per lookup */
+
+enum taas_rl_class {
+    TAAS_RL_RAW,                    /* raw and HMAC: answered inline */
+    TAAS_RL_SIGNED,                 /* TSA and batch: one signature each */
+    TAAS_RL_CLASSES
+};
+
+struct taas_rl_entry {
+    uint64_t key;                   /* taas_rl_key_v4/v6(), 0 = free */
+    uint64_t last;                  /* ticks, for eviction */
+    uint64_t tat[TAAS_RL_CLASSES];  /* next conforming arrival, in ticks */
+};
+
+/* One budget: interval = ticks per request, tau = burst allowance */
+struct taas_rl_limit {
+    uint64_t interval;
+    uint64_t tau;
+};
+
+/*
+ * taas_rl_limit_set - Budget of rate requests per second with bursts
+ * of up to burst, for a timer running at hz. rate 0 disables it.
+ */
+static inline void taas_rl_limit_set(struct taas_rl_limit *l, uint64_t hz,
+                                     uint64_t rate, uint64_t burst)
+{
+    if (!rate) {
+        l->interval = 0;
+        l->tau = 0;
+        return;
+    }
+
+    l->interval = hz / rate ? hz / rate : 1;
+    l->tau = l->interval * (burst ? burst - 1 : 0);
+}
+
+/*
+ * taas_rl_key_v4 - Key of an IPv4 source (network byte order). It reads
+ * as the prefix 0:ffff::/32, which lies in reserved ::/8 and so never
+ * collides with a real IPv6 source.
+ */
+static inline uint64_t taas_rl_key_v4(uint32_t addr)
+{
+    const uint8_t *b = (const uint8_t *)&addr;
+
+    return 0xffff00000000ULL | (uint64_t)b[0] << 24 | (uint64_t)b[1] << 16 |
+           (uint64_t)b[2] << 8 | b[3];
+}
+
+/*
+ * taas_rl_key_v6 - Key of an IPv6 source: its /64, or the IPv4 key for
+ * a v4-mapped address. ::/64 (loopback) would read as a free slot and
+ * is moved to 1.
+ */
+static inline uint64_t taas_rl_key_v6(const uint8_t addr[16])
+{
+    static const uint8_t mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+    uint64_t key;
+
+    if (!memcmp(addr, mapped, sizeof(mapped))) {
+        uint32_t v4;
+
+        memcpy(&v4, addr + 12, sizeof(v4));
+        return taas_rl_key_v4(v4);
+    }
+    key = 0;
+    for (unsigned int i = 0; i < 8; i++)
+        key = key << 8 | addr[i];
+    return key ? key : 1;
+}
+
+static inline uint32_t taas_rl_hash(uint64_t key, uint64_t seed)
+{
+    return (uint32_t)(((key ^ seed) * 0x9e3779b97f4a7c15ULL) >> (64 - TAAS_RL_BITS));
+}
+
+/*
+ * taas_rl_lookup - The entry of key, claiming a slot if it has none.
+ */
+static inline struct taas_rl_entry *taas_rl_lookup(struct taas_rl_entry *tab, uint64_t seed,
+                                                   uint64_t key, uint64_t now)
+{
+    uint32_t h = taas_rl_hash(key, seed);
+    struct taas_rl_entry *victim = NULL;
+
+    for (unsigned int i = 0; i < TAAS_RL_PROBE; i++) {
+        struct taas_rl_entry *e = &tab[(h & ~(TAAS_RL_PROBE - 1U)) + i];
+
+        if (e->key == key) {
+            e->last = now;
+            return e;
+        }
+        if (!e->key) {
+            victim = e;
+            break;
+        }
+        if (!victim || e->last < victim->last)
+            victim = e;
+    }
+
+    victim->key = key;
+    victim->last = now;
+    for (unsigned int c = 0; c < TAAS_RL_CLASSES; c++)
+        victim->tat[c] = 0;
+    return victim;
+}
+
+/*
+ * taas_rl_admit - Charge one request to a budget.
+ * Returns 0 if admitted, otherwise the ticks until it would be.
+ */
+static inline uint64_t taas_rl_admit(struct taas_rl_entry *e, unsigned int cls,
+                                     const struct taas_rl_limit *l, uint64_t now)
+{
+    uint64_t tat = e->tat[cls] > now ? e->tat[cls] : now;
+
+    if (tat - now > l->tau)
+        return tat - now - l->tau;
+
+    e->tat[cls] = tat + l->interval;
+    return 0;
+}
+
+#endif /* TAAS_RATELIMIT_H */
@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: GPL-2.0
+ *
+ * TaaS telemetry
+ *
+ * Shared-memory layout written by taas_node and read by taas_exporter.
+ * Every thread that serves requests (core 3 and each signer) owns one
+ * segment and is its only writer, so recording is a handful of plain
+ * stores: no locks, no atomics read-modify-write, no syscalls. The
+ * exporter only ever reads, on the housekeeping cores.
+ *
+ * Each segment keeps:
+ * - cumulative log-linear histograms (4 buckets per power of two) of
+ *   RX-to-TX residence per mode and of signing time, for Prometheus;
+ * - a ring of the last TAAS_TEL_RING requests, for exact recent
+ *   quantiles. head is published with release ordering after the
+ *   record is written; a reader copies, re-reads head and discards any
+ *   record the writer may have overwritten meanwhile.
+ *
+ * All durations are in ticks of the node's timer (timer_hz per second).
+ */
+#ifndef TAAS_TELEMETRY_H
+#define TAAS_TELEMETRY_H
+
+#include <stdint.h>
+
+#define TAAS_TEL_SHM      "/taas_telemetry"
+#define TAAS_TEL_MAGIC    0x4d4c4554U   /* "TELM" */
+#define TAAS_TEL_VERSION  4
+
+#define TAAS_TEL_SEGMENTS 4             /* core 3 + up to 3 signers */
+#define TAAS_TEL_RING     4096
+#define TAAS_TEL_SUB      4             /* histogram buckets per octave */
+#define TAAS_TEL_BUCKETS  (64 * TAAS_TEL_SUB)
+#define TAAS_TEL_PEERS    8             /* taas_node --peer */
+
+enum taas_tel_mode {
+    TAAS_TEL_RAW,
+    TAAS_TEL_TSA,
+    TAAS_TEL_BATCH,
+    TAAS_TEL_HMAC,
+    TAAS_TEL_MODES
+};
+
+struct taas_tel_record {
+    uint32_t residence;     /* ticks from receive to reply sent */
+    uint32_t sign;          /* ticks spent signing, 0 if unsigned */
+    uint32_t mode;
+    uint32_t reserved;
+};
+
+struct taas_tel_segment {
+    _Alignas(64) uint64_t head;
+    uint64_t requests[TAAS_TEL_MODES];
+    uint64_t residence_sum[TAAS_TEL_MODES];
+    uint64_t residence[TAAS_TEL_MODES][TAAS_TEL_BUCKETS];
+    uint64_t signatures;
+    uint64_t sign_sum;
+    uint64_t sign[TAAS_TEL_BUCKETS];
+    uint64_t tx_errors;     /* replies the socket refused, skipped */
+    struct taas_tel_record ring[TAAS_TEL_RING];
+};
+
+/* Cross-check of one federation peer, updated once per drift check */
+struct taas_tel_peer {
+    char     name[48];                  /* --peer as given */
+    int64_t  offset_ns;                 /* peer - this node, best sample of the last round */
+    int64_t  delay_ns;                  /* round trip net of the peer's residence */
+    uint64_t rounds;                    /* rounds with at least one reply */
+    uint64_t lost;                      /* rounds without any */
+};
+
+struct taas_tel_page {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t timer_hz;
+    int32_t  pid;
+    uint32_t nr_segments;
+
+    /* Clock discipline and overload, written by core 3 only */
+    _Alignas(64) int64_t clock_offset_ns;
+    int64_t  clock_freq_mppb;           /* servo frequency, 1/1000 ppb */
+    uint64_t clock_corrections;
+    uint64_t clock_steps;
+    uint64_t clock_pps;                 /* 1 while disciplined from PPS */
+    uint64_t shed;                      /* signed requests dropped, rings full */
+    uint64_t limited_raw;               /* raw/HMAC dropped over a source's budget */
+    uint64_t limited_signed;            /* TSA/batch answered busy, same */
+    uint32_t nr_peers;
+    uint32_t reserved;
+    struct taas_tel_peer peer[TAAS_TEL_PEERS];
+
+    struct taas_tel_segment seg[TAAS_TEL_SEGMENTS];
+};
+
+/*
+ * taas_tel_bucket - Histogram bucket of a duration.
+ * Values 0-3 are exact; above that, bucket 4k+s covers
+ * [(4 + s) << (k - 1), (5 + s) << (k - 1)), a resolution of 25%.
+ */
+static inline unsigned int taas_tel_bucket(uint64_t v)
+{
+    unsigned int msb;
+
+    if (v < TAAS_TEL_SUB)
+        return (unsigned int)v;
+
+    msb = 63 - (unsigned int)__builtin_clzll(v);
+    return (msb - 1) * TAAS_TEL_SUB + (unsigned int)((v >> (msb - 2)) & (TAAS_TEL_SUB - 1));
+}
+
+/* Exclusive upper bound of a bucket, in ticks */
+static inline uint64_t taas_tel_bucket_limit(unsigned int b)
+{
+    if (b < TAAS_TEL_SUB)
+        return b + 1;
+
+    return (uint64_t)(TAAS_TEL_SUB + 1 + b % TAAS_TEL_SUB) << (b / TAAS_TEL_SUB - 1);
+}
+
+/* Single-writer increment: the exporter may read at any time */
+static inline void taas_tel_add(uint64_t *p, uint64_t v)
+{
+    __atomic_store_n(p, *p + v, __ATOMIC_RELAXED);
+}
+
+static inline void taas_tel_set(int64_t *p, int64_t v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+
+/*
+ * taas_tel_record - Account one served request in the caller's segment.
+ */
+static inline void taas_tel_record(struct taas_tel_segment *s, unsigned int mode,
+                                   uint64_t residence, uint64_t sign)
+{
+    uint64_t head = s->head;
+    struct taas_tel_record *r = &s->ring[head & (TAAS_TEL_RING - 1)];
+
+    r->residence = residence > UINT32_MAX ? UINT32_MAX : (uint32_t)residence;
+    r->sign      = sign > UINT32_MAX ? UINT32_MAX : (uint32_t)sign;
+    r->mode      = mode;
+
+    taas_tel_add(&s->requests[mode], 1);
+    taas_tel_add(&s->residence_sum[mode], residence);
+    taas_tel_add(&s->residence[mode][taas_tel_bucket(residence)], 1);
+    if (sign) {
+        taas_tel_add(&s->signatures, 1);
+        taas_tel_add(&s->sign_sum, sign);
+        taas_tel_add(&s->sign[taas_tel_bucket(sign)], 1);
+    }
+
+    __atomic_store_n(&s->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* TAAS_TELEMETRY_H */
@@ -0,0 +1,109 @@
+/* SPDX-License-Identifier: GPL-2.0
+ *
+ * TaaS timer backends
+ *
+ * The tick source is chosen at build time (make TIMER=st|cntvct), so
+ * the hot path compiles down to the one read it needs:
+ *
+ * - TAAS_TIMER_ST:     BCM2837 system timer, 1MHz, through the
+ *                      uncached register mapping of /dev/taas_timer.
+ *                      Three MMIO loads plus a rollover retry.
+ * - TAAS_TIMER_CNTVCT: ARMv8 architected counter (CNTVCT_EL0), one
+ *                      system register read at CNTFRQ_EL0 (19.2MHz on
+ *                      the Pi 3), no mapping needed.
+ *
+ * taas_clock.c reads whichever source the published anchor names, so
+ * both readers are always available; taas_timer_read() is the one the
+ * node was built for.
+ */
+#ifndef TAAS_TIMER_H
+#define TAAS_TIMER_H
+
+#include <stdint.h>
+
+#include "taas_ioctl.h"
+
+#ifndef TAAS_TIMER_SOURCE
+#define TAAS_TIMER_SOURCE TAAS_TIMER_ST
+#endif
+
+#define TAAS_ST_HZ   1000000ULL
+#define TAAS_ST_LOW  0x04           /* register offsets in the mapping */
+#define TAAS_ST_HIGH 0x08
+
+/*
+ * taas_st_read - Atomic read of the 64-bit BCM2837 timer
+ * Uses optimistic concurrency control (lock-free).
+ *
+ * Since we are reading two 32-bit registers to form a 64-bit value,
+ * we must ensure the high bits didn't roll over during the read of low bits.
+ */
+static inline uint64_t taas_st_read(const volatile void *regs)
+{
+    const volatile uint32_t *lo = (const volatile uint32_t *)((const volatile char *)regs + TAAS_ST_LOW);
+    const volatile uint32_t *hi = (const volatile uint32_t *)((const volatile char *)regs + TAAS_ST_HIGH);
+    uint32_t h1, l, h2;
+
+    do {
+        h1 = *hi;
+        l  = *lo;
+        h2 = *hi;
+    } while (h1 != h2);
+    return ((uint64_t)h1 << 32) | l;
+}
+
+#ifdef __aarch64__
+/*
+ * taas_cntvct_read - Read the virtual counter.
+ * The isb keeps the read from being speculated ahead of the code that
+ * asked for the time, as the kernel's vDSO does.
+ */
+static inline uint64_t taas_cntvct_read(void)
+{
+    uint64_t v;
+
+    __asm__ __volatile__("isb\n\tmrs %0, cntvct_el0" : "=r"(v) :: "memory");
+    return v;
+}
+
+static inline uint64_t taas_cntfrq_read(void)
+{
+    uint64_t f;
+
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(f));
+    return f;
+}
+#elif TAAS_TIMER_SOURCE == TAAS_TIMER_CNTVCT
+#error "TIMER=cntvct needs an aarch64 build"
+#endif
+
+/* Ticks per second of the build's source */
+static inline uint64_t taas_timer_hz(void)
+{
+#if TAAS_TIMER_SOURCE == TAAS_TIMER_CNTVCT
+    return taas_cntfrq_read();
+#else
+    return TAAS_ST_HZ;
+#endif
+}
+
+/* regs: the TAAS_MMAP_TIMER mapping, unused by register-free sources */
+static inline uint64_t taas_timer_read(const volatile void *regs)
+{
+#if TAAS_TIMER_SOURCE == TAAS_TIMER_CNTVCT
+    (void)regs;
+    return taas_cntvct_read();
+#else
+    return taas_st_read(regs);
+#endif
+}
+
+/*
+ * taas_anchor_to_utc - The time equation: one multiply, shift and add.
+ */
+static inline uint64_t taas_anchor_to_utc(const struct taas_anchor *a, uint64_t ticks)
+{
+    return a->base_utc_ns + (((ticks - a->base_hw_ticks) * a->mult) >> a->shift);
+}
+
+#endif /* TAAS_TIMER_H */
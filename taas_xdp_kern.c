@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * TaaS XDP steering program
+ *
+ * Attached to the node's interface when taas_node runs with --xdp.
+ * Raw-mode requests (UDP/1588, IPv4 without options, payload that is
+ * neither a 32-byte TSA hash nor a versioned message) are redirected
+ * into the AF_XDP socket bound to their RX queue. Everything else, and
+ * every packet arriving on a queue without a socket, continues up the
+ * normal stack to the UDP socket path.
+ *
+ * Build: clang -O2 -g -target bpf -c taas_xdp_kern.c -o taas_xdp_kern.o
+ */
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+
+#include "taas_proto.h"
+
+struct {
+    __uint(type, BPF_MAP_TYPE_XSKMAP);
+    __uint(max_entries, 64);
+    __type(key, __u32);
+    __type(value, __u32);
+} xsks_map SEC(".maps");
+
+SEC("xdp")
+int taas_xdp_steer(struct xdp_md *ctx)
+{
+    void *data = (void *)(long)ctx->data;
+    void *data_end = (void *)(long)ctx->data_end;
+    struct ethhdr *eth = data;
+    struct iphdr *ip;
+    struct udphdr *udp;
+    __u32 *magic;
+    __u16 payload;
+
+    if ((void *)(eth + 1) > data_end || eth->h_proto != bpf_htons(ETH_P_IP))
+        return XDP_PASS;
+
+    ip = (void *)(eth + 1);
+    if ((void *)(ip + 1) > data_end || ip->ihl != 5 || ip->protocol != IPPROTO_UDP ||
+        (ip->frag_off & bpf_htons(0x3fff)))
+        return XDP_PASS;
+
+    udp = (void *)(ip + 1);
+    if ((void *)(udp + 1) > data_end || udp->dest != bpf_htons(TAAS_PORT))
+        return XDP_PASS;
+
+    /* A length below the header would wrap the payload size: leave it to the stack */
+    if (bpf_ntohs(udp->len) < sizeof(*udp))
+        return XDP_PASS;
+
+    /* Signed and versioned modes need the full node, not the fast path */
+    payload = bpf_ntohs(udp->len) - sizeof(*udp);
+    if (payload == 32)
+        return XDP_PASS;
+
+    magic = (void *)(udp + 1);
+    if (payload >= sizeof(*magic) && (void *)(magic + 1) <= data_end && *magic == TAAS_MAGIC)
+        return XDP_PASS;
+
+    /* Falls back to XDP_PASS if no socket is bound to this queue */
+    return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS);
+}
+
+char _license[] SEC("license") = "GPL";
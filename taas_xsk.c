@@ -0,0 +1,383 @@
+/*
+ * TaaS Node - AF_XDP fast path for raw-mode timestamps
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * One AF_XDP socket on one RX queue, driven entirely by polling from
+ * core 3. Every UMEM frame cycles through the same loop:
+ *
+ *   fill ring -> RX ring -> (reply built in place) -> TX ring
+ *             -> completion ring -> fill ring
+ *
+ * so no frame is ever copied and no allocation happens after open.
+ * Zero-copy and native XDP are tried first; copy mode and generic
+ * (SKB) XDP keep it working on drivers without support, e.g. WiFi.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "taas_proto.h"
+#include "taas_xsk.h"
+
+#define XSK_NUM_FRAMES  4096
+#define XSK_FRAME_SIZE  2048
+#define XSK_RING_SIZE   2048    /* RX/TX; fill/completion hold every frame */
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/* Reply on the wire: eth + ip + udp + uint64_t, padded to the minimum frame */
+#define XSK_REPLY_LEN (sizeof(struct ethhdr) + sizeof(struct iphdr) + \
+                       sizeof(struct udphdr) + sizeof(uint64_t))
+#define XSK_MIN_FRAME 60
+
+/* Userspace view of one mmap'd ring. cached_* are private shadows of
+ * the shared indices so the hot path touches shared lines only once
+ * per batch.
+ */
+struct xsk_ring {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *descs;
+    uint32_t mask;
+    uint32_t cached_prod;
+    uint32_t cached_cons;
+    void *map;
+    size_t map_len;
+};
+
+struct taas_xsk {
+    int fd;
+    int ifindex;
+    uint32_t xdp_flags;
+    struct bpf_object *obj;
+    void *umem;
+    struct xsk_ring rx, tx, fill, comp;
+    unsigned int tx_pending;
+};
+
+static inline uint32_t load_acquire(const uint32_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(uint32_t *p, uint32_t v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static int ring_map(int fd, struct xsk_ring *r, const struct xdp_ring_offset *off,
+                    uint64_t pgoff, uint32_t entries, size_t desc_size)
+{
+    r->map_len = off->desc + entries * desc_size;
+    r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        return -1;
+    }
+
+    r->producer = (uint32_t *)((char *)r->map + off->producer);
+    r->consumer = (uint32_t *)((char *)r->map + off->consumer);
+    r->flags    = (uint32_t *)((char *)r->map + off->flags);
+    r->descs    = (char *)r->map + off->desc;
+    r->mask     = entries - 1;
+    return 0;
+}
+
+static void ring_unmap(struct xsk_ring *r)
+{
+    if (r->map)
+        munmap(r->map, r->map_len);
+    r->map = NULL;
+}
+
+/*
+ * fill_push - Hand a frame back to the kernel for reception.
+ * The fill ring is sized for every frame, so it can never overflow.
+ */
+static inline void fill_push(struct taas_xsk *x, uint64_t addr)
+{
+    uint64_t *slots = x->fill.descs;
+
+    slots[x->fill.cached_prod++ & x->fill.mask] = addr;
+}
+
+static inline void fill_commit(struct taas_xsk *x)
+{
+    store_release(x->fill.producer, x->fill.cached_prod);
+
+    /* With need_wakeup the driver may park until told the ring refilled */
+    if (__atomic_load_n(x->fill.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP)
+        recvfrom(x->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+}
+
+static int load_program(struct taas_xsk *x, const char *prog_path, unsigned int queue)
+{
+    struct bpf_program *prog;
+    int prog_fd, map_fd;
+
+    x->obj = bpf_object__open_file(prog_path, NULL);
+    if (!x->obj || libbpf_get_error(x->obj)) {
+        x->obj = NULL;
+        fprintf(stderr, "taas: xdp: cannot open %s\n", prog_path);
+        return -1;
+    }
+    if (bpf_object__load(x->obj)) {
+        fprintf(stderr, "taas: xdp: program load failed\n");
+        return -1;
+    }
+
+    prog = bpf_object__find_program_by_name(x->obj, "taas_xdp_steer");
+    map_fd = bpf_object__find_map_fd_by_name(x->obj, "xsks_map");
+    if (!prog || map_fd < 0)
+        return -1;
+    prog_fd = bpf_program__fd(prog);
+
+    /* Native first, generic (SKB) mode for drivers without XDP support */
+    x->xdp_flags = XDP_FLAGS_DRV_MODE;
+    if (bpf_xdp_attach(x->ifindex, prog_fd, x->xdp_flags, NULL) < 0) {
+        x->xdp_flags = XDP_FLAGS_SKB_MODE;
+        if (bpf_xdp_attach(x->ifindex, prog_fd, x->xdp_flags, NULL) < 0) {
+            x->xdp_flags = 0;
+            perror("taas: xdp: attach");
+            return -1;
+        }
+    }
+
+    if (bpf_map_update_elem(map_fd, &queue, &x->fd, BPF_ANY) < 0) {
+        perror("taas: xdp: xsks_map update");
+        return -1;
+    }
+    return 0;
+}
+
+struct taas_xsk *taas_xsk_open(const char *ifname, unsigned int queue, const char *prog_path)
+{
+    struct taas_xsk *x = calloc(1, sizeof(*x));
+    struct xdp_umem_reg reg;
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp;
+    socklen_t optlen = sizeof(off);
+    uint32_t ring = XSK_RING_SIZE, frames = XSK_NUM_FRAMES;
+
+    if (!x)
+        return NULL;
+    x->fd = -1;
+
+    x->ifindex = (int)if_nametoindex(ifname);
+    if (!x->ifindex) {
+        fprintf(stderr, "taas: xdp: unknown interface %s\n", ifname);
+        goto fail;
+    }
+
+    x->umem = mmap(NULL, (size_t)XSK_NUM_FRAMES * XSK_FRAME_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (x->umem == MAP_FAILED) {
+        x->umem = NULL;
+        goto fail;
+    }
+
+    x->fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (x->fd < 0) {
+        perror("taas: xdp: socket");
+        goto fail;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uint64_t)(uintptr_t)x->umem;
+    reg.len = (uint64_t)XSK_NUM_FRAMES * XSK_FRAME_SIZE;
+    reg.chunk_size = XSK_FRAME_SIZE;
+    if (setsockopt(x->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0 ||
+        setsockopt(x->fd, SOL_XDP, XDP_UMEM_FILL_RING, &frames, sizeof(frames)) < 0 ||
+        setsockopt(x->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &frames, sizeof(frames)) < 0 ||
+        setsockopt(x->fd, SOL_XDP, XDP_RX_RING, &ring, sizeof(ring)) < 0 ||
+        setsockopt(x->fd, SOL_XDP, XDP_TX_RING, &ring, sizeof(ring)) < 0 ||
+        getsockopt(x->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0) {
+        perror("taas: xdp: ring setup");
+        goto fail;
+    }
+
+    if (ring_map(x->fd, &x->rx, &off.rx, XDP_PGOFF_RX_RING, ring, sizeof(struct xdp_desc)) ||
+        ring_map(x->fd, &x->tx, &off.tx, XDP_PGOFF_TX_RING, ring, sizeof(struct xdp_desc)) ||
+        ring_map(x->fd, &x->fill, &off.fr, XDP_UMEM_PGOFF_FILL_RING, frames, sizeof(uint64_t)) ||
+        ring_map(x->fd, &x->comp, &off.cr, XDP_UMEM_PGOFF_COMPLETION_RING, frames, sizeof(uint64_t))) {
+        perror("taas: xdp: ring mmap");
+        goto fail;
+    }
+
+    /* Every frame starts out owned by the kernel, ready for RX */
+    for (uint32_t i = 0; i < XSK_NUM_FRAMES; i++)
+        fill_push(x, (uint64_t)i * XSK_FRAME_SIZE);
+    store_release(x->fill.producer, x->fill.cached_prod);
+
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = (uint32_t)x->ifindex;
+    sxdp.sxdp_queue_id = queue;
+    sxdp.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+    if (bind(x->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+        sxdp.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+        if (bind(x->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+            perror("taas: xdp: bind");
+            goto fail;
+        }
+    }
+
+    if (load_program(x, prog_path, queue) < 0)
+        goto fail;
+
+    printf("[TaaS] AF_XDP fast path on %s queue %u (%s, %s).\n", ifname, queue,
+           (sxdp.sxdp_flags & XDP_ZEROCOPY) ? "zero-copy" : "copy",
+           (x->xdp_flags & XDP_FLAGS_DRV_MODE) ? "native" : "generic");
+    return x;
+
+fail:
+    taas_xsk_close(x);
+    return NULL;
+}
+
+void taas_xsk_close(struct taas_xsk *x)
+{
+    if (!x)
+        return;
+
+    if (x->xdp_flags)
+        bpf_xdp_detach(x->ifindex, x->xdp_flags, NULL);
+    if (x->obj)
+        bpf_object__close(x->obj);
+
+    ring_unmap(&x->rx);
+    ring_unmap(&x->tx);
+    ring_unmap(&x->fill);
+    ring_unmap(&x->comp);
+
+    if (x->fd >= 0)
+        close(x->fd);
+    if (x->umem)
+        munmap(x->umem, (size_t)XSK_NUM_FRAMES * XSK_FRAME_SIZE);
+    free(x);
+}
+
+unsigned int taas_xsk_recv(struct taas_xsk *x, struct taas_xsk_desc *descs, unsigned int max)
+{
+    const struct xdp_desc *ring = x->rx.descs;
+    uint32_t avail = load_acquire(x->rx.producer) - x->rx.cached_cons;
+    unsigned int n = avail < max ? avail : max;
+
+    for (unsigned int i = 0; i < n; i++) {
+        const struct xdp_desc *d = &ring[(x->rx.cached_cons + i) & x->rx.mask];
+
+        descs[i].addr = d->addr;
+        descs[i].len  = d->len;
+    }
+
+    /* The frames stay ours: they leave through TX or go back to fill */
+    x->rx.cached_cons += n;
+    if (n)
+        store_release(x->rx.consumer, x->rx.cached_cons);
+    return n;
+}
+
+static uint16_t ip_checksum(const void *hdr, unsigned int len)
+{
+    const uint16_t *p = hdr;
+    uint32_t sum = 0;
+
+    for (; len > 1; len -= 2)
+        sum += *p++;
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+void taas_xsk_reply(struct taas_xsk *x, const struct taas_xsk_desc *d, uint64_t utc_ns)
+{
+    uint8_t *frame = (uint8_t *)x->umem + d->addr;
+    struct ethhdr *eth = (struct ethhdr *)frame;
+    struct iphdr *ip = (struct iphdr *)(eth + 1);
+    struct udphdr *udp = (struct udphdr *)(ip + 1);
+    uint8_t mac[ETH_ALEN];
+    uint32_t addr;
+    uint16_t port;
+    uint32_t len = XSK_REPLY_LEN < XSK_MIN_FRAME ? XSK_MIN_FRAME : XSK_REPLY_LEN;
+    uint32_t prod = x->tx.cached_prod;
+
+    /* The steering program only lets through what we can answer, but a
+     * short frame or a full TX ring just recycles the frame (drop).
+     */
+    if (d->len < sizeof(*eth) + sizeof(*ip) + sizeof(*udp) ||
+        prod - load_acquire(x->tx.consumer) > x->tx.mask) {
+        fill_push(x, d->addr);
+        return;
+    }
+
+    memcpy(mac, eth->h_dest, ETH_ALEN);
+    memcpy(eth->h_dest, eth->h_source, ETH_ALEN);
+    memcpy(eth->h_source, mac, ETH_ALEN);
+
+    addr = ip->saddr;
+    ip->saddr = ip->daddr;
+    ip->daddr = addr;
+    ip->tot_len = htons(sizeof(*ip) + sizeof(*udp) + sizeof(uint64_t));
+    ip->ttl = 64;
+    ip->check = 0;
+    ip->check = ip_checksum(ip, sizeof(*ip));
+
+    port = udp->source;
+    udp->source = udp->dest;
+    udp->dest = port;
+    udp->len = htons(sizeof(*udp) + sizeof(uint64_t));
+    udp->check = 0;     /* optional over IPv4 */
+
+    memcpy(udp + 1, &utc_ns, sizeof(utc_ns));
+    memset(frame + XSK_REPLY_LEN, 0, len - XSK_REPLY_LEN);
+
+    struct xdp_desc *tx = &((struct xdp_desc *)x->tx.descs)[prod & x->tx.mask];
+    tx->addr = d->addr;
+    tx->len = len;
+    tx->options = 0;
+    x->tx.cached_prod = prod + 1;
+    x->tx_pending++;
+}
+
+void taas_xsk_flush(struct taas_xsk *x)
+{
+    const uint64_t *comp = x->comp.descs;
+    uint32_t done;
+
+    if (x->tx_pending) {
+        store_release(x->tx.producer, x->tx.cached_prod);
+        if (__atomic_load_n(x->tx.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP)
+            sendto(x->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+        x->tx_pending = 0;
+    }
+
+    /* Transmitted frames come back here; return them to reception */
+    done = load_acquire(x->comp.producer) - x->comp.cached_cons;
+    for (uint32_t i = 0; i < done; i++)
+        fill_push(x, comp[(x->comp.cached_cons + i) & x->comp.mask]);
+    x->comp.cached_cons += done;
+    if (done)
+        store_release(x->comp.consumer, x->comp.cached_cons);
+
+    if (x->fill.cached_prod != *x->fill.producer)
+        fill_commit(x);
+}
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: GPL-2.0
+ *
+ * TaaS AF_XDP fast path
+ *
+ * Serves raw-mode timestamps straight from the NIC's RX queue: frames
+ * steered by taas_xdp_kern.o land in a UMEM, the reply is built in the
+ * same frame and pushed to the TX ring. No socket buffers, no UDP
+ * stack, no copies in zero-copy mode.
+ *
+ * The module knows nothing about time; the caller stamps each frame
+ * between taas_xsk_recv() and taas_xsk_reply().
+ */
+#ifndef TAAS_XSK_H
+#define TAAS_XSK_H
+
+#include <stdint.h>
+
+struct taas_xsk;
+
+struct taas_xsk_desc {
+    uint64_t addr;
+    uint32_t len;
+};
+
+/*
+ * taas_xsk_open - Load and attach the steering program on ifname and
+ * bind an AF_XDP socket to queue. Returns NULL (with a message on
+ * stderr) if anything is unsupported; the caller keeps the socket path.
+ */
+struct taas_xsk *taas_xsk_open(const char *ifname, unsigned int queue, const char *prog_path);
+
+/* Detach the program and release the socket and UMEM */
+void taas_xsk_close(struct taas_xsk *x);
+
+/* Take up to max received frames. Never blocks. */
+unsigned int taas_xsk_recv(struct taas_xsk *x, struct taas_xsk_desc *descs, unsigned int max);
+
+/* Turn a received request into its raw reply in place and queue it */
+void taas_xsk_reply(struct taas_xsk *x, const struct taas_xsk_desc *d, uint64_t utc_ns);
+
+/* Submit queued replies and recycle completed frames to the fill ring */
+void taas_xsk_flush(struct taas_xsk *x);
+
+#endif /* TAAS_XSK_H */